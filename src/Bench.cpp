@@ -0,0 +1,147 @@
+/*
+ * Fixed-workload benchmark of the telemetry and receive paths
+ */
+
+#include <Arduino.h>
+#include "mbed.h"
+
+#include "Bench.h"
+#include "JsonStream.h"
+#include "LatencyProbe.h"
+#include "Log.h"
+#include "MessageProperties.h"
+#include "SensorSample.h"
+#include "Telemetry.h"
+
+#if BENCH_ENABLED
+
+// Every field fresh: the largest payloads the device builds
+static const SensorSample benchSample =
+{
+    123456, 0xFFFF, 0xFFFF,
+    25.31f, 48.72f, 1013.25f,
+    { 12, -998, 31 },
+    { 1250, -3500, 70 },
+    { 300, -105, 512 },
+};
+
+// A full twin as delivered after a connect, settings the app parses included
+static const char benchTwin[] =
+    "{\"desired\":{\"alertsOnly\":false,"
+    "\"sensors\":{\"temperature\":true,\"humidity\":true,\"pressure\":60,\"accelerometer\":true,"
+    "\"gyroscope\":false,\"magnetometer\":300},"
+    "\"latencyProbe\":{\"intervalMs\":0,\"count\":0},\"$version\":42},"
+    "\"reported\":{\"firmwareVersion\":\"1.0.0\",\"alertsOnly\":{\"value\":false,\"ac\":200,\"av\":41},"
+    "\"connection\":{\"state\":\"connected\",\"connects\":3,\"failures\":1},\"$version\":97}}";
+
+// Sequence numbers are never negative, so this matches no probe in flight
+static const char benchEcho[] = "{\"probe\":{\"seq\":-1,\"t\":123456}}";
+
+static JsonStream parser;
+static bool useCycleCounter = false;
+
+static int benchTelemetryJson()
+{
+    char payload[700];
+    int headerLen = snprintf(payload, sizeof(payload),
+        "{\"messageId\":%d,\"deviceId\":\"%s\",\"timestamp\":\"%s\",", 1234, "bench", "2024-01-01T00:00:00Z");
+    int fieldsLen = telemetryJsonFields(benchSample, payload + headerLen, sizeof(payload) - headerLen - 1);
+    MessageProperties props;
+    messagePropertiesInitJson(&props);
+    messagePropertiesSetMessageId(&props, "1234");
+    return headerLen + fieldsLen + 1;
+}
+
+static int benchTelemetryComponents()
+{
+    int total = 0;
+    for (int c = 0; c < TELEMETRY_COMPONENT_COUNT; c++)
+    {
+        char payload[320];
+        total += telemetryJsonFields(benchSample, payload + 1, sizeof(payload) - 2, c) + 2;
+        MessageProperties props;
+        messagePropertiesInitJson(&props);
+        messagePropertiesSetMessageId(&props, "1234");
+        messagePropertiesSetComponent(&props, telemetryComponentName(c));
+    }
+    return total;
+}
+
+static int benchReceiveTwin()
+{
+    jsonStreamReset(&parser);
+    jsonStreamFeedString(&parser, benchTwin, sizeof(benchTwin) - 1);
+    return sizeof(benchTwin) - 1;
+}
+
+static int benchReceiveProbe()
+{
+    latencyProbeEcho(benchEcho);
+    return sizeof(benchEcho) - 1;
+}
+
+struct BenchWorkload
+{
+    const char* name;
+    int (*run)();
+};
+
+static const BenchWorkload workloads[] =
+{
+    { "telemetry_json", benchTelemetryJson },
+    { "telemetry_components", benchTelemetryComponents },
+    { "receive_twin", benchReceiveTwin },
+    { "receive_probe", benchReceiveProbe },
+};
+
+/**
+ * Start the DWT cycle counter; false if it does not count (no debug unit,
+ * or an emulator without one)
+ */
+static bool cycleCounterStart()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t before = DWT->CYCCNT;
+    for (volatile int i = 0; i < 100; i++) {}
+    return DWT->CYCCNT != before;
+}
+
+static uint32_t cycles()
+{
+    return useCycleCounter ? DWT->CYCCNT : micros() * (SystemCoreClock / 1000000);
+}
+
+static void onBenchValue(JsonStream*, const char*, const char*, bool)
+{
+}
+
+void benchRun()
+{
+    parser.onValue = onBenchValue;
+    useCycleCounter = cycleCounterStart();
+
+    LOG_INFO("BENCH BEGIN %d", BENCH_ITERATIONS);
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+        int bytes = 0;
+        uint32_t start = cycles();
+        for (int i = 0; i < BENCH_ITERATIONS; i++)
+        {
+            bytes = workloads[w].run();
+        }
+        uint32_t elapsed = cycles() - start;
+        LOG_INFO("BENCH %s %lu %d", workloads[w].name, (unsigned long)(elapsed / BENCH_ITERATIONS), bytes);
+    }
+    LOG_INFO("BENCH END (%s)", useCycleCounter ? "cycle counter" : "micros");
+}
+
+#else
+
+void benchRun()
+{
+    LOG_INFO("Benchmark not built (BENCH_ENABLED=0)");
+}
+
+#endif // BENCH_ENABLED
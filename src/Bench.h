@@ -0,0 +1,46 @@
+/*
+ * Fixed-workload benchmark of the telemetry and receive paths
+ *
+ * Runs the code that builds telemetry and parses inbound messages on canned
+ * inputs, BENCH_ITERATIONS times each, and logs the cost per iteration:
+ *
+ *   BENCH BEGIN 20
+ *   BENCH telemetry_json 27510 251
+ *   ...
+ *   BENCH END (cycle counter)
+ *
+ * (workload, cycles per iteration, bytes produced or consumed). Nothing is
+ * sent or applied: the sample is fixed, the payloads are dropped and the
+ * twin goes through a parser of its own, with no settings callbacks.
+ *
+ * Cycles come from the DWT cycle counter, so on a device they include
+ * flash wait states and interrupts. Where the counter does not run they are
+ * derived from micros() and SystemCoreClock; under Renode, which advances
+ * time by instructions executed (tools/renode/az3166.resc), that makes them
+ * instruction counts.
+ *
+ * Runs in loop(), which stalls while it does, so it is only built with
+ * BENCH_ENABLED=1: CI builds each environment again with it for
+ * tools/renode_bench.py, which presses 'b' on the emulated board. Add
+ * -DBENCH_ENABLED=1 to build_flags to press 'b' in the serial monitor of
+ * a device.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#ifndef BENCH_ENABLED
+#define BENCH_ENABLED 0
+#endif
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 20
+#endif
+
+/**
+ * Run every workload and log the results; only logs that it is not built
+ * when BENCH_ENABLED is 0
+ */
+void benchRun();
+
+#endif // BENCH_H
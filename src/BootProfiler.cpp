@@ -0,0 +1,57 @@
+/*
+ * Boot profiler
+ */
+
+#include <Arduino.h>
+
+#include "BootProfiler.h"
+#include "Log.h"
+
+static const char* const phaseNames[BOOT_PHASE_COUNT] = {
+    "wifi",
+    "dns",
+    "iotInit",
+    "connect",
+};
+
+static unsigned long phaseStart[BOOT_PHASE_COUNT];
+static unsigned long phaseMs[BOOT_PHASE_COUNT];
+
+void bootProfileStart(BootPhase phase)
+{
+    phaseStart[phase] = millis();
+}
+
+void bootProfileStop(BootPhase phase)
+{
+    phaseMs[phase] += millis() - phaseStart[phase];
+}
+
+unsigned long bootProfileGet(BootPhase phase)
+{
+    return phaseMs[phase];
+}
+
+void bootProfilePrint()
+{
+    LOG_INFO("Boot profile:");
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+    {
+        LOG_INFO("  %-10s %6lu ms", phaseNames[i], phaseMs[i]);
+    }
+    LOG_INFO("  %-10s %6lu ms", "total", millis());
+}
+
+bool bootProfileToJson(char* buffer, size_t size)
+{
+    size_t used = 0;
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+    {
+        int n = snprintf(buffer + used, size - used, "%s\"%s\":%lu",
+            i == 0 ? "{" : ",", phaseNames[i], phaseMs[i]);
+        if (n < 0 || (size_t)n >= size - used) return false;
+        used += n;
+    }
+    int n = snprintf(buffer + used, size - used, ",\"total\":%lu}", millis());
+    return n >= 0 && (size_t)n < size - used;
+}
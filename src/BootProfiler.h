@@ -0,0 +1,50 @@
+/*
+ * Boot profiler
+ *
+ * Records how long each phase of the first connection takes, from the
+ * connection thread (Connection.cpp), so slow boots can be traced to WiFi,
+ * DNS, provisioning or the TLS/MQTT connect. Phases that run more than once
+ * before the first connection (retries, DPS and hub lookups) accumulate.
+ */
+
+#ifndef BOOT_PROFILER_H
+#define BOOT_PROFILER_H
+
+#include <stddef.h>
+
+enum BootPhase
+{
+    BOOT_PHASE_WIFI,
+    BOOT_PHASE_DNS,
+    BOOT_PHASE_IOT_INIT,
+    BOOT_PHASE_CONNECT,
+    BOOT_PHASE_COUNT
+};
+
+/**
+ * Mark the start of a phase
+ */
+void bootProfileStart(BootPhase phase);
+
+/**
+ * Mark the end of a phase; time accumulates if a phase runs more than once
+ */
+void bootProfileStop(BootPhase phase);
+
+/**
+ * Milliseconds recorded for a phase
+ */
+unsigned long bootProfileGet(BootPhase phase);
+
+/**
+ * Print all phases and the total to Serial
+ */
+void bootProfilePrint();
+
+/**
+ * Write phases as a JSON object, e.g. {"wifi":812,"dns":64,"iotInit":2210,...}
+ * Returns false if the buffer is too small.
+ */
+bool bootProfileToJson(char* buffer, size_t size);
+
+#endif // BOOT_PROFILER_H
@@ -0,0 +1,423 @@
+/*
+ * Connection state machine
+ */
+
+#include <Arduino.h>
+#include "mbed.h"
+#include "AZ3166WiFi.h"
+#include "AzureIoTHub.h"
+#include "DeviceConfig.h"
+#include "NetworkInterface.h"
+#include "PubSubClient.h"
+#include "SystemWiFi.h"
+
+#include "BootProfiler.h"
+#include "Connection.h"
+#include "Log.h"
+#include "Trace.h"
+#include "WiFiFastJoin.h"
+
+#if CONNECTION_PROFILE == PROFILE_DPS_SAS || CONNECTION_PROFILE == PROFILE_DPS_SAS_GROUP || CONNECTION_PROFILE == PROFILE_DPS_CERT
+#define CONNECTION_DPS 1
+#else
+#define CONNECTION_DPS 0
+#endif
+
+#if CONNECTION_PROFILE == PROFILE_IOTHUB_SAS || CONNECTION_PROFILE == PROFILE_DPS_SAS || CONNECTION_PROFILE == PROFILE_DPS_SAS_GROUP
+#define CONNECTION_SAS 1
+#else
+#define CONNECTION_SAS 0
+#endif
+
+enum ConnectionEvent
+{
+    EVENT_NONE,
+    EVENT_DONE,         // the state's work succeeded
+    EVENT_FAILED,       // the state's work failed
+    EVENT_LOST,         // the hub connection dropped
+    EVENT_TIMEOUT,      // the state's timeout expired
+};
+
+typedef ConnectionEvent (*StateAction)();
+
+struct StateInfo
+{
+    StateAction enter;      // returns the event it ends with, if any
+    bool blocking;          // enter runs on the connection thread
+    void (*exit)();
+    StateAction poll;       // called every connectionLoop()
+    unsigned long timeoutMs;
+};
+
+struct Transition
+{
+    ConnectionState from;
+    ConnectionEvent event;
+    bool (*guard)();        // NULL: always
+    ConnectionState to;
+};
+
+#define CONNECTION_STATE_NAME(name, text) #name,
+static const char* const stateNames[CONN_STATE_COUNT] = {
+    CONNECTION_STATE_LIST(CONNECTION_STATE_NAME)
+};
+#undef CONNECTION_STATE_NAME
+
+#define CONNECTION_STATE_TEXT(name, text) text,
+static const char* const stateTexts[CONN_STATE_COUNT] = {
+    CONNECTION_STATE_LIST(CONNECTION_STATE_TEXT)
+};
+#undef CONNECTION_STATE_TEXT
+
+static ConnectionListener listener = NULL;
+static ConnectionState current = CONN_WIFI_DOWN;
+static unsigned long stateSince = 0;
+static unsigned long timeoutMs = 0;         // of the current state, 0 for none
+static bool started = false;
+static bool provisioned = false;
+static unsigned long provisionedAt = 0;     // when azureIoTInit() made the SAS token
+static bool booting = true;                 // boot profile phases until the first connection
+static unsigned long backoffMs = 0;
+
+// Connection thread: one blocking entry action at a time
+static Thread worker(osPriorityBelowNormal, CONNECTION_THREAD_STACK);
+static Semaphore workQueued(0);
+static Semaphore workDone(0);
+static StateAction work = NULL;
+static ConnectionEvent workResult = EVENT_NONE;
+static bool busy = false;
+
+// Metrics (provisioned, provisionedAt, connects and failures are written by the
+// connection thread, read once it is done)
+static unsigned long stateMs[CONN_STATE_COUNT];
+static unsigned long connects = 0;
+static unsigned long failures = 0;
+
+// ===== GUARDS =====
+
+static bool wifiLost()
+{
+    return WiFi.status() != WL_CONNECTED;
+}
+
+static bool initDue()
+{
+    if (!provisioned) return true;
+    return CONNECTION_SAS && CONNECTION_TOKEN_REFRESH_MS > 0
+        && millis() - provisionedAt >= CONNECTION_TOKEN_REFRESH_MS;
+}
+
+// ===== ACTIONS =====
+
+static void phaseStart(BootPhase phase)
+{
+    if (booting) bootProfileStart(phase);
+}
+
+static void phaseStop(BootPhase phase)
+{
+    if (booting) bootProfileStop(phase);
+}
+
+/**
+ * Look the hostname up once before the framework does. The network stack
+ * keeps the answer for its TTL, so the framework's own lookup is answered
+ * from that cache, and the time the lookup took shows up on its own in the
+ * boot profile and the trace instead of inside init or connect.
+ */
+static void warmResolver(const char* hostname)
+{
+    if (hostname == NULL || hostname[0] == '\0') return;
+    SocketAddress address;
+    unsigned long start = millis();
+    phaseStart(BOOT_PHASE_DNS);
+    TRACE_BEGIN(DNS_RESOLVE);
+    int result = WiFiInterface()->gethostbyname(hostname, &address);
+    TRACE_END(DNS_RESOLVE, result == 0);
+    phaseStop(BOOT_PHASE_DNS);
+    if (result != 0)
+    {
+        LOG_WARN("DNS: %s not resolved (%d), the framework will retry", hostname, result);
+        return;
+    }
+    LOG_INFO("DNS: %s -> %s, %lu ms", hostname, address.get_ip_address(), millis() - start);
+}
+
+static ConnectionEvent enterJoining()
+{
+    LOG_INFO("Connecting to WiFi (credentials from EEPROM)...");
+    
+    // Uses the cached BSSID/channel/lease when valid, else a full join
+    unsigned long joinStart = millis();
+    phaseStart(BOOT_PHASE_WIFI);
+    TRACE_BEGIN(WIFI_JOIN);
+    bool joined = wifiFastJoin();
+    TRACE_END(WIFI_JOIN, joined);
+    phaseStop(BOOT_PHASE_WIFI);
+    if (!joined)
+    {
+        LOG_ERROR("WiFi connection failed!");
+        LOG_INFO("Use the serial CLI to configure:");
+        LOG_INFO("  set_wifi <ssid> <password>");
+        return EVENT_FAILED;
+    }
+    
+    LOG_INFO("WiFi connected! IP: %s", WiFi.localIP().get_address());
+    LOG_INFO("  Join: %s, %lu ms", wifiFastJoinWasFast() ? "fast" : "full", millis() - joinStart);
+    return EVENT_DONE;
+}
+
+static ConnectionEvent enterProvisioning()
+{
+    // DPS registration happens during init
+#if CONNECTION_DPS
+    warmResolver(DeviceConfig_GetDpsEndpoint());
+#endif
+    phaseStart(BOOT_PHASE_IOT_INIT);
+    TRACE_BEGIN(IOT_INIT);
+    provisioned = azureIoTInit();
+    TRACE_END(IOT_INIT, provisioned);
+    phaseStop(BOOT_PHASE_IOT_INIT);
+    if (!provisioned)
+    {
+        LOG_ERROR("IoT init failed");
+        failures++;
+        return EVENT_FAILED;
+    }
+    provisionedAt = millis();
+    return EVENT_DONE;
+}
+
+static ConnectionEvent enterConnecting()
+{
+    // Known once init has parsed it or DPS has assigned it
+    warmResolver(azureIoTGetHostname());
+    phaseStart(BOOT_PHASE_CONNECT);
+    TRACE_BEGIN(CONNECT);
+    bool connected = azureIoTConnect();
+    TRACE_END(CONNECT, connected);
+    phaseStop(BOOT_PHASE_CONNECT);
+    if (!connected)
+    {
+        LOG_ERROR("IoT Hub connection failed");
+        failures++;
+        return EVENT_FAILED;
+    }
+    connects++;
+    LOG_INFO("IoT Hub connected (MQTT keep-alive %d s)", MQTT_KEEPALIVE);
+    return EVENT_DONE;
+}
+
+static ConnectionEvent enterConnected()
+{
+    if (booting)
+    {
+        LOG_INFO("Connection thread: %lu of %lu stack bytes used",
+            (unsigned long)worker.max_stack(), (unsigned long)worker.stack_size());
+    }
+    booting = false;
+    backoffMs = 0;
+    return EVENT_NONE;
+}
+
+static ConnectionEvent pollConnected()
+{
+    if (azureIoTIsConnected()) return EVENT_NONE;
+    TRACE_INSTANT(DISCONNECT, 0);
+    LOG_WARN("IoT Hub connection lost");
+    return EVENT_LOST;
+}
+
+static ConnectionEvent enterBackoff()
+{
+    backoffMs = backoffMs == 0 ? CONNECTION_BACKOFF_MIN_MS : backoffMs * 2;
+    if (backoffMs > CONNECTION_BACKOFF_MAX_MS) backoffMs = CONNECTION_BACKOFF_MAX_MS;
+    
+    // +-25% so a fleet that lost the same hub does not retry in lockstep
+    timeoutMs = backoffMs - backoffMs / 4 + random(0, backoffMs / 2 + 1);
+    LOG_INFO("Retrying in %lu ms", timeoutMs);
+    return EVENT_NONE;
+}
+
+// ===== TABLES =====
+
+static const StateInfo states[CONN_STATE_COUNT] = {
+    //  enter               blocking    exit    poll            timeout
+    {   NULL,               false,      NULL,   NULL,           CONNECTION_WIFI_RETRY_MS    },  // WIFI_DOWN
+    {   enterJoining,       true,       NULL,   NULL,           0                           },  // WIFI_JOINING
+    {   enterProvisioning,  true,       NULL,   NULL,           0                           },  // PROVISIONING
+    {   enterConnecting,    true,       NULL,   NULL,           0                           },  // CONNECTING
+    {   enterConnected,     false,      NULL,   pollConnected,  0                           },  // CONNECTED
+    {   enterBackoff,       false,      NULL,   NULL,           0                           },  // BACKOFF
+};
+
+static const Transition transitions[] = {
+    {   CONN_WIFI_DOWN,     EVENT_TIMEOUT,      NULL,           CONN_WIFI_JOINING   },
+    {   CONN_WIFI_JOINING,  EVENT_DONE,         initDue,        CONN_PROVISIONING   },
+    {   CONN_WIFI_JOINING,  EVENT_DONE,         NULL,           CONN_CONNECTING     },
+    {   CONN_WIFI_JOINING,  EVENT_FAILED,       NULL,           CONN_WIFI_DOWN      },
+    {   CONN_PROVISIONING,  EVENT_DONE,         NULL,           CONN_CONNECTING     },
+    {   CONN_PROVISIONING,  EVENT_FAILED,       NULL,           CONN_BACKOFF        },
+    {   CONN_CONNECTING,    EVENT_DONE,         NULL,           CONN_CONNECTED      },
+    {   CONN_CONNECTING,    EVENT_FAILED,       NULL,           CONN_BACKOFF        },
+    {   CONN_CONNECTED,     EVENT_LOST,         wifiLost,       CONN_WIFI_DOWN      },
+    {   CONN_CONNECTED,     EVENT_LOST,         NULL,           CONN_BACKOFF        },
+    {   CONN_BACKOFF,       EVENT_TIMEOUT,      wifiLost,       CONN_WIFI_DOWN      },
+    {   CONN_BACKOFF,       EVENT_TIMEOUT,      initDue,        CONN_PROVISIONING   },
+    {   CONN_BACKOFF,       EVENT_TIMEOUT,      NULL,           CONN_CONNECTING     },
+};
+
+#define TRANSITION_COUNT (sizeof(transitions) / sizeof(transitions[0]))
+
+// ===== ENGINE =====
+
+static void enter(ConnectionState next)
+{
+    unsigned long now = millis();
+    if (states[current].exit) states[current].exit();
+    stateMs[current] += now - stateSince;
+    
+    ConnectionState previous = current;
+    current = next;
+    stateSince = now;
+    timeoutMs = states[next].timeoutMs;
+    LOG_DEBUG("Connection: %s -> %s", stateNames[previous], stateNames[next]);
+    if (listener) listener(previous, next);
+}
+
+static void workerLoop()
+{
+    for (;;)
+    {
+        workQueued.wait();
+        workResult = work();
+        workDone.release();
+    }
+}
+
+/**
+ * Run the entry action of the current state, or hand it to the connection
+ * thread; EVENT_NONE until connectionLoop() collects the result then
+ */
+static ConnectionEvent runEntry()
+{
+    const StateInfo& state = states[current];
+    if (state.enter == NULL) return EVENT_NONE;
+    if (!state.blocking) return state.enter();
+    
+    work = state.enter;
+    busy = true;
+    workQueued.release();
+    return EVENT_NONE;
+}
+
+/**
+ * Apply an event, then the events the entry actions end with
+ */
+static void dispatch(ConnectionEvent event)
+{
+    while (event != EVENT_NONE)
+    {
+        const Transition* match = NULL;
+        for (size_t i = 0; i < TRANSITION_COUNT && match == NULL; i++)
+        {
+            const Transition& t = transitions[i];
+            if (t.from == current && t.event == event && (t.guard == NULL || t.guard())) match = &t;
+        }
+        if (match == NULL) return;
+        
+        enter(match->to);
+        event = runEntry();
+    }
+}
+
+void connectionStart(ConnectionListener onChange)
+{
+    listener = onChange;
+    started = true;
+    stateSince = millis();
+    worker.start(workerLoop);
+    enter(CONN_WIFI_JOINING);
+    dispatch(runEntry());
+}
+
+void connectionLoop()
+{
+    if (!started) return;
+    
+    // No timeouts or polls while a blocking step runs: it cannot be cut short
+    if (busy)
+    {
+        if (workDone.wait(0) <= 0) return;
+        busy = false;
+        dispatch(workResult);
+        return;
+    }
+    
+    if (states[current].poll)
+    {
+        ConnectionEvent event = states[current].poll();
+        if (event != EVENT_NONE)
+        {
+            dispatch(event);
+            return;
+        }
+    }
+    if (timeoutMs > 0 && millis() - stateSince >= timeoutMs)
+    {
+        dispatch(EVENT_TIMEOUT);
+    }
+}
+
+ConnectionState connectionState()
+{
+    return current;
+}
+
+const char* connectionStateName(ConnectionState state)
+{
+    return state < CONN_STATE_COUNT ? stateNames[state] : "";
+}
+
+const char* connectionStateText(ConnectionState state)
+{
+    return state < CONN_STATE_COUNT ? stateTexts[state] : "";
+}
+
+bool connectionHasWifi()
+{
+    return current != CONN_WIFI_DOWN && current != CONN_WIFI_JOINING;
+}
+
+bool connectionIsConnected()
+{
+    return current == CONN_CONNECTED;
+}
+
+bool connectionBusy()
+{
+    return busy;
+}
+
+void connectionReprovision()
+{
+    if (!busy) provisioned = false;
+}
+
+bool connectionReportJson(char* buffer, size_t size)
+{
+    int n = snprintf(buffer, size,
+        "{\"state\":\"%s\",\"connects\":%lu,\"failures\":%lu,\"stack\":{\"size\":%lu,\"used\":%lu},\"seconds\":{",
+        stateNames[current], connects, failures,
+        (unsigned long)worker.stack_size(), (unsigned long)worker.max_stack());
+    if (n < 0 || (size_t)n >= size) return false;
+    size_t length = n;
+    for (int i = 0; i < CONN_STATE_COUNT; i++)
+    {
+        unsigned long ms = stateMs[i] + (i == current ? millis() - stateSince : 0);
+        n = snprintf(buffer + length, size - length, "%s\"%s\":%lu", i ? "," : "", stateNames[i], ms / 1000);
+        if (n < 0 || (size_t)n >= size - length) return false;
+        length += n;
+    }
+    return length + 2 < size && snprintf(buffer + length, size - length, "}}") == 2;
+}
@@ -0,0 +1,139 @@
+/*
+ * Connection state machine
+ *
+ * The connectivity lifecycle as an explicit state machine, driven from
+ * loop() by connectionLoop(). Each state has entry/exit actions, a poll
+ * for the events it waits on and an optional timeout. Transitions are a
+ * table of (state, event, guard) -> next state, first match wins:
+ *
+ *   WIFI_DOWN      timeout -> WIFI_JOINING
+ *   WIFI_JOINING   joined -> PROVISIONING (init due) or CONNECTING; failed -> WIFI_DOWN
+ *   PROVISIONING   azureIoTInit() (DPS registration, SAS token) -> CONNECTING;
+ *                  failed -> BACKOFF
+ *   CONNECTING     resolve, TLS handshake and MQTT connect -> CONNECTED; failed -> BACKOFF
+ *   CONNECTED      lost -> BACKOFF, or WIFI_DOWN without WiFi
+ *   BACKOFF        timeout -> WIFI_DOWN without WiFi, PROVISIONING if init
+ *                  is due, else CONNECTING
+ *
+ * Init is due the first time, after connectionReprovision(), and on the
+ * SAS profiles once the token is CONNECTION_TOKEN_REFRESH_MS old:
+ * azureIoTInit() is the only call that makes a new token, and the hub
+ * closes the connection when the old one expires.
+ *
+ * Backoff doubles from CONNECTION_BACKOFF_MIN_MS to CONNECTION_BACKOFF_MAX_MS
+ * with +-25% jitter, and resets on a connection. The app follows state
+ * changes through a listener (LEDs, display, watchdog, reports) and asks
+ * connectionIsConnected() rather than keeping flags of its own. Time spent
+ * in each state and the connect/failure counts are kept for
+ * connectionReportJson().
+ *
+ * The entry actions for joining, provisioning and connecting block in the
+ * framework (WiFi.begin(), DPS registration, TLS handshake), so they run
+ * on a connection thread of their own; connectionLoop() picks up the
+ * result. loop() keeps sampling, queueing and feeding the watchdog in the
+ * meantime, and a connect that hangs is caught by the MQTT deadline.
+ */
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+
+// Wait before retrying a failed WiFi join
+#ifndef CONNECTION_WIFI_RETRY_MS
+#define CONNECTION_WIFI_RETRY_MS 30000
+#endif
+
+#ifndef CONNECTION_BACKOFF_MIN_MS
+#define CONNECTION_BACKOFF_MIN_MS 2000
+#endif
+
+#ifndef CONNECTION_BACKOFF_MAX_MS
+#define CONNECTION_BACKOFF_MAX_MS 120000
+#endif
+
+// Age of the SAS token after which a reconnect runs azureIoTInit() again
+// for a new one (SAS profiles); 0 to always reconnect with the first
+#ifndef CONNECTION_TOKEN_REFRESH_MS
+#define CONNECTION_TOKEN_REFRESH_MS (50UL * 60 * 1000)
+#endif
+
+// Connection thread stack. The TLS handshake and DPS registration run on
+// it and used to run on the main thread, so it gets the main thread's
+// stack size, 8 KB where the mbed configuration does not give one. The
+// high-water mark is logged at the first connection and reported under
+// "connection", to size it by.
+#ifndef CONNECTION_THREAD_STACK
+#if defined(MBED_CONF_APP_MAIN_STACK_SIZE)
+#define CONNECTION_THREAD_STACK MBED_CONF_APP_MAIN_STACK_SIZE
+#elif defined(MBED_CONF_RTOS_MAIN_THREAD_STACK_SIZE)
+#define CONNECTION_THREAD_STACK MBED_CONF_RTOS_MAIN_THREAD_STACK_SIZE
+#else
+#define CONNECTION_THREAD_STACK 8192
+#endif
+#endif
+
+// X(state, display text)
+#define CONNECTION_STATE_LIST(X)            \
+    X(WIFI_DOWN,     "WiFi down")           \
+    X(WIFI_JOINING,  "Joining WiFi")        \
+    X(PROVISIONING,  "Provisioning")        \
+    X(CONNECTING,    "Connecting")          \
+    X(CONNECTED,     "Connected")           \
+    X(BACKOFF,       "Retrying")
+
+#define CONNECTION_STATE_ENUM(name, text) CONN_##name,
+enum ConnectionState
+{
+    CONNECTION_STATE_LIST(CONNECTION_STATE_ENUM)
+    CONN_STATE_COUNT
+};
+#undef CONNECTION_STATE_ENUM
+
+typedef void (*ConnectionListener)(ConnectionState from, ConnectionState to);
+
+/**
+ * Start in WIFI_JOINING; the listener sees every transition, after the
+ * exit action of from and before the entry action of to. Transitions,
+ * and so the listener, only run on the loop() thread.
+ */
+void connectionStart(ConnectionListener listener);
+
+/**
+ * Run timeouts and poll for the events of the current state; call from loop()
+ */
+void connectionLoop();
+
+ConnectionState connectionState();
+const char* connectionStateName(ConnectionState state);
+const char* connectionStateText(ConnectionState state);
+
+/**
+ * WiFi up (any state past joining)
+ */
+bool connectionHasWifi();
+
+/**
+ * The hub connection is usable (CONNECTED)
+ */
+bool connectionIsConnected();
+
+/**
+ * A join, provisioning or connect is running on the connection thread.
+ * It uses the network; leave it alone until it ends.
+ */
+bool connectionBusy();
+
+/**
+ * Register again (DPS) before the next connect instead of retrying the
+ * same hub; ignored while a step runs on the connection thread
+ */
+void connectionReprovision();
+
+/**
+ * {"state":"CONNECTED","connects":3,"failures":1,"stack":{"size":8192,"used":5230},
+ *  "seconds":{"CONNECTED":3600,...}}
+ */
+bool connectionReportJson(char* buffer, size_t size);
+
+#endif // CONNECTION_H
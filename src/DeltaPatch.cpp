@@ -0,0 +1,222 @@
+/*
+ * Streaming delta patch applier
+ */
+
+#include <string.h>
+
+#include "DeltaPatch.h"
+
+enum DeltaState
+{
+    DP_HEADER,
+    DP_DIFF_LENGTH,
+    DP_EXTRA_LENGTH,
+    DP_SEEK,
+    DP_ZEROS,               // varint: unchanged bytes next
+    DP_LITERAL_COUNT,       // varint: changed bytes next
+    DP_LITERAL,
+    DP_EXTRA,
+    DP_DONE,
+    DP_ERROR,
+};
+
+// Old image bytes copied per read
+#define COPY_CHUNK 64
+
+static uint32_t readLe32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void deltaPatchInit(DeltaPatch* p)
+{
+    memset(p, 0, sizeof(*p));
+    p->state = DP_HEADER;
+}
+
+static bool fail(DeltaPatch* p)
+{
+    p->state = DP_ERROR;
+    return false;
+}
+
+/**
+ * Copy unchanged bytes from the old image
+ */
+static bool copyZeros(DeltaPatch* p, DeltaReadCallback read, DeltaWriteCallback write)
+{
+    uint8_t buffer[COPY_CHUNK];
+    while (p->zerosLeft > 0)
+    {
+        uint32_t n = p->zerosLeft < COPY_CHUNK ? p->zerosLeft : COPY_CHUNK;
+        if (!read(p->oldPos, buffer, n)) return fail(p);
+        // State first: a resume from inside write() must not repeat these bytes
+        p->oldPos += n;
+        p->written += n;
+        p->zerosLeft -= n;
+        p->diffLeft -= n;
+        if (p->zerosLeft == 0) p->state = p->diffLeft > 0 ? DP_LITERAL_COUNT : DP_EXTRA;
+        if (!write(buffer, n)) return fail(p);
+    }
+    return true;
+}
+
+/**
+ * Move on after a record's extra bytes
+ */
+static bool endRecord(DeltaPatch* p)
+{
+    int64_t oldPos = (int64_t)p->oldPos + p->seek;
+    if (oldPos < 0 || oldPos > p->sourceSize) return fail(p);
+    p->oldPos = (uint32_t)oldPos;
+    p->state = p->written == p->targetSize ? DP_DONE : DP_DIFF_LENGTH;
+    return true;
+}
+
+/**
+ * Produce output that needs no further input
+ */
+static bool pump(DeltaPatch* p, DeltaReadCallback read, DeltaWriteCallback write)
+{
+    for (;;)
+    {
+        if (p->state == DP_ZEROS && p->zerosLeft > 0)
+        {
+            if (!copyZeros(p, read, write)) return false;
+        }
+        else if (p->state == DP_EXTRA && p->extraLeft == 0)
+        {
+            if (!endRecord(p)) return false;
+        }
+        else
+        {
+            return p->state != DP_ERROR;
+        }
+    }
+}
+
+/**
+ * Accumulate a varint byte; returns true when the value is complete
+ */
+static bool varintByte(DeltaPatch* p, uint8_t b)
+{
+    if (p->varintShift > 28)
+    {
+        fail(p);
+        return false;
+    }
+    p->varint |= (uint32_t)(b & 0x7F) << p->varintShift;
+    p->varintShift += 7;
+    return (b & 0x80) == 0;
+}
+
+static uint32_t takeVarint(DeltaPatch* p)
+{
+    uint32_t value = p->varint;
+    p->varint = 0;
+    p->varintShift = 0;
+    return value;
+}
+
+static bool feedByte(DeltaPatch* p, uint8_t b, DeltaReadCallback read, DeltaWriteCallback write)
+{
+    p->consumed++;
+    switch (p->state)
+    {
+    case DP_HEADER:
+        p->header[p->headerLength++] = b;
+        if (p->headerLength < DELTA_PATCH_HEADER_SIZE) return true;
+        if (memcmp(p->header, DELTA_PATCH_MAGIC, 4) != 0) return fail(p);
+        p->sourceSize = readLe32(p->header + 4);
+        p->targetSize = readLe32(p->header + 8);
+        p->state = p->targetSize > 0 ? DP_DIFF_LENGTH : DP_DONE;
+        return true;
+
+    case DP_DIFF_LENGTH:
+        if (!varintByte(p, b)) return p->state != DP_ERROR;
+        p->diffLeft = takeVarint(p);
+        p->state = DP_EXTRA_LENGTH;
+        return true;
+
+    case DP_EXTRA_LENGTH:
+        if (!varintByte(p, b)) return p->state != DP_ERROR;
+        p->extraLeft = takeVarint(p);
+        p->state = DP_SEEK;
+        return true;
+
+    case DP_SEEK:
+    {
+        if (!varintByte(p, b)) return p->state != DP_ERROR;
+        uint32_t zigzag = takeVarint(p);
+        p->seek = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        if ((uint64_t)p->written + p->diffLeft + p->extraLeft > p->targetSize
+            || (uint64_t)p->oldPos + p->diffLeft > p->sourceSize)
+        {
+            return fail(p);
+        }
+        p->state = p->diffLeft > 0 ? DP_ZEROS : DP_EXTRA;
+        return true;
+    }
+
+    case DP_ZEROS:
+        if (!varintByte(p, b)) return p->state != DP_ERROR;
+        p->zerosLeft = takeVarint(p);
+        if (p->zerosLeft > p->diffLeft) return fail(p);
+        if (p->zerosLeft == 0) p->state = DP_LITERAL_COUNT;
+        return true;    // pump() copies the run
+
+    case DP_LITERAL_COUNT:
+        if (!varintByte(p, b)) return p->state != DP_ERROR;
+        p->literalsLeft = takeVarint(p);
+        if (p->literalsLeft == 0 || p->literalsLeft > p->diffLeft) return fail(p);
+        p->state = DP_LITERAL;
+        return true;
+
+    case DP_LITERAL:
+    {
+        uint8_t old;
+        if (!read(p->oldPos, &old, 1)) return fail(p);
+        uint8_t out = old + b;
+        p->oldPos++;
+        p->written++;
+        p->diffLeft--;
+        if (--p->literalsLeft == 0) p->state = p->diffLeft > 0 ? DP_ZEROS : DP_EXTRA;
+        return write(&out, 1) || fail(p);
+    }
+
+    case DP_EXTRA:
+        p->written++;
+        p->extraLeft--;
+        return write(&b, 1) || fail(p);
+
+    default:
+        // Trailing data after the image is complete, or an earlier error
+        return fail(p);
+    }
+}
+
+bool deltaPatchFeed(DeltaPatch* p, const uint8_t* data, size_t length,
+    DeltaReadCallback read, DeltaWriteCallback write)
+{
+    if (!pump(p, read, write)) return false;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (!feedByte(p, data[i], read, write) || !pump(p, read, write)) return false;
+    }
+    return true;
+}
+
+bool deltaPatchDone(const DeltaPatch* p)
+{
+    return p->state == DP_DONE;
+}
+
+uint32_t deltaPatchSourceSize(const DeltaPatch* p)
+{
+    return p->state == DP_HEADER ? 0 : p->sourceSize;
+}
+
+uint32_t deltaPatchTargetSize(const DeltaPatch* p)
+{
+    return p->state == DP_HEADER ? 0 : p->targetSize;
+}
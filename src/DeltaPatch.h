@@ -0,0 +1,78 @@
+/*
+ * Streaming delta patch applier
+ *
+ * Rebuilds a new firmware image from the running one and a patch made by
+ * tools/make_delta.py. The format follows bsdiff's control/diff/extra
+ * scheme, laid out sequentially so it can be applied as it downloads:
+ *
+ *   header   "MXD1", uint32 sourceSize, uint32 targetSize (little endian)
+ *   records  until targetSize bytes are produced:
+ *     varint diffLength, varint extraLength, zigzag varint seek
+ *     diff     diffLength output bytes, each old[oldPos++] + delta, coded as
+ *              (varint zeroRun, varint literalCount, literalCount deltas)...
+ *     extra    extraLength bytes copied to the output as is
+ *     oldPos  += seek
+ *
+ * Zero runs (unchanged bytes) cost a varint instead of one byte each,
+ * which stands in for the compression stage bsdiff relies on.
+ *
+ * The whole applier state is this struct. A copy taken at any point, even
+ * from inside the write callback, is a consistent resume point: restore
+ * it and continue with the patch from its consumed offset.
+ */
+
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DELTA_PATCH_MAGIC "MXD1"
+#define DELTA_PATCH_HEADER_SIZE 12
+
+// Read length bytes of the running image at offset
+typedef bool (*DeltaReadCallback)(uint32_t offset, uint8_t* data, size_t length);
+
+// Append bytes to the new image
+typedef bool (*DeltaWriteCallback)(const uint8_t* data, size_t length);
+
+struct DeltaPatch
+{
+    uint8_t state;
+    uint8_t headerLength;
+    uint8_t header[DELTA_PATCH_HEADER_SIZE];
+    uint8_t varintShift;
+    uint32_t varint;
+
+    uint32_t sourceSize;
+    uint32_t targetSize;
+    uint32_t consumed;          // patch bytes taken in
+    uint32_t oldPos;
+    uint32_t written;           // output bytes produced
+
+    uint32_t diffLeft;
+    uint32_t extraLeft;
+    int32_t seek;
+    uint32_t zerosLeft;
+    uint32_t literalsLeft;
+};
+
+void deltaPatchInit(DeltaPatch* patch);
+
+/**
+ * Consume the next patch bytes, writing output as it is produced. Pass no
+ * data to flush output that needs no more input (e.g. after a resume or at
+ * the end). Returns false if the patch is malformed or a callback failed.
+ */
+bool deltaPatchFeed(DeltaPatch* patch, const uint8_t* data, size_t length,
+    DeltaReadCallback read, DeltaWriteCallback write);
+
+bool deltaPatchDone(const DeltaPatch* patch);
+
+/**
+ * Source and target image sizes, once the header has been read (else 0)
+ */
+uint32_t deltaPatchSourceSize(const DeltaPatch* patch);
+uint32_t deltaPatchTargetSize(const DeltaPatch* patch);
+
+#endif // DELTA_PATCH_H
@@ -0,0 +1,135 @@
+/*
+ * Hub failover
+ */
+
+#include <Arduino.h>
+#include "AzureIoTHub.h"
+#include "DeviceConfig.h"
+
+#include "Connection.h"
+#include "Failover.h"
+#include "Log.h"
+#include "Retained.h"
+#include "Trace.h"
+
+#define FAILOVER_MAGIC 0x464F5652   // "FOVR"
+
+#if CONNECTION_PROFILE == PROFILE_DPS_SAS || CONNECTION_PROFILE == PROFILE_DPS_SAS_GROUP || CONNECTION_PROFILE == PROFILE_DPS_CERT
+#define FAILOVER_DPS 1
+#else
+#define FAILOVER_DPS 0
+#endif
+
+// Counters kept across soft resets; a reset always starts on the primary
+struct FailoverStats
+{
+    uint32_t magic;
+    uint32_t count;
+    uint32_t failedOverSeconds;     // completed stays away from the primary
+    uint32_t checksum;
+};
+
+static RETAINED FailoverStats stats;
+
+static char primary[128];
+static char hub[128];                   // assigned by the last registration
+static bool active = false;
+static bool moved = false;              // hub changed, not reported yet
+static bool down = false;               // hub unreachable since downSince
+static unsigned long downSince = 0;
+static unsigned long activeSince = 0;
+
+static void statsCommit()
+{
+    stats.magic = FAILOVER_MAGIC;
+    stats.checksum = retainedChecksum(&stats, offsetof(FailoverStats, checksum));
+}
+
+void failoverProvisioned()
+{
+    const char* hostname = azureIoTGetHostname();
+    if (primary[0] == '\0')
+    {
+        if (stats.magic != FAILOVER_MAGIC
+            || stats.checksum != retainedChecksum(&stats, offsetof(FailoverStats, checksum)))
+        {
+            memset(&stats, 0, sizeof(stats));
+            statsCommit();
+        }
+        strncpy(primary, hostname, sizeof(primary) - 1);
+        strncpy(hub, hostname, sizeof(hub) - 1);
+        if (FAILOVER_DPS)
+        {
+            LOG_INFO("Failover: %s, DPS registration again after %lu s down", primary,
+                (unsigned long)(FAILOVER_AFTER_MS / 1000));
+        }
+        return;
+    }
+
+    if (strcmp(hostname, hub) == 0)
+    {
+        LOG_INFO("Failover: DPS assigned %s again", hub);
+        return;
+    }
+
+    unsigned long now = millis();
+    bool toSecondary = strcmp(hostname, primary) != 0;
+    if (toSecondary && !active)
+    {
+        stats.count++;
+        activeSince = now;
+    }
+    else if (!toSecondary && active)
+    {
+        stats.failedOverSeconds += (now - activeSince) / 1000;
+    }
+    statsCommit();
+    LOG_WARN("Failover: DPS moved the device from %s to %s", hub, hostname);
+    strncpy(hub, hostname, sizeof(hub) - 1);
+    active = toSecondary;
+    moved = true;
+    TRACE_INSTANT(FAILOVER, toSecondary);
+}
+
+bool failoverLoop(bool hasWifi, bool connected)
+{
+    if (!FAILOVER_DPS) return false;
+
+    // Without WiFi the hub is not to blame
+    unsigned long now = millis();
+    if (!hasWifi || connected)
+    {
+        down = false;
+    }
+    else if (!down)
+    {
+        down = true;
+        downSince = now;
+    }
+
+    if (down && now - downSince >= FAILOVER_AFTER_MS)
+    {
+        LOG_WARN("Failover: %s down for %lu s, registering with DPS again", hub, (now - downSince) / 1000);
+        connectionReprovision();
+        downSince = now;    // register again after another FAILOVER_AFTER_MS
+    }
+
+    // Reported from the new hub: queued while offline, it would only
+    // push acks out of the control lane
+    if (!moved || !connected) return false;
+    moved = false;
+    return true;
+}
+
+bool failoverActive()
+{
+    return active;
+}
+
+bool failoverReportJson(char* buffer, size_t size)
+{
+    uint32_t seconds = stats.failedOverSeconds + (active ? (millis() - activeSince) / 1000 : 0);
+    int n = snprintf(buffer, size, "{\"hub\":\"%s\",\"hostname\":\"%s\",\"count\":%lu,\"failedOverSeconds\":%lu}",
+        active ? "secondary" : "primary", azureIoTGetHostname(), (unsigned long)stats.count, (unsigned long)seconds);
+    return n > 0 && (size_t)n < size;
+}
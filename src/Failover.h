@@ -0,0 +1,58 @@
+/*
+ * Hub failover
+ *
+ * A device is bound to the hub DPS assigned it, so an incident at that hub
+ * (or its region) leaves it dark. On the DPS profiles, when the hub stays
+ * unreachable for FAILOVER_AFTER_MS while WiFi is up, the device registers
+ * with DPS again (connectionReprovision()) and connects to whichever hub
+ * its allocation policy picks. If that is the same hub, the device keeps
+ * retrying it and registers again after another FAILOVER_AFTER_MS.
+ *
+ * The hub of the first registration after boot is the primary. There is
+ * no probing of the primary and no planned move back: the device stays on
+ * the hub it is on until the next sustained outage or the next boot, and
+ * each of those asks DPS again. It returns to the primary when DPS
+ * assigns it there, so an allocation policy that prefers the primary
+ * (e.g. static configuration or lowest latency) brings it back once that
+ * hub is up.
+ *
+ * The connection string profile names one hub and the framework cannot
+ * connect to another, so failover is off there. The number of failovers
+ * and the time spent away from the primary are kept across soft resets
+ * and reported under "failover".
+ */
+
+#ifndef FAILOVER_H
+#define FAILOVER_H
+
+#include <stddef.h>
+
+// Time without a hub connection (WiFi up) before registering again
+#ifndef FAILOVER_AFTER_MS
+#define FAILOVER_AFTER_MS (2UL * 60 * 1000)
+#endif
+
+/**
+ * The hub is known: call after every azureIoTInit() that succeeded. The
+ * first one is the primary.
+ */
+void failoverProvisioned();
+
+/**
+ * Track the connection and register again when the hub stays down.
+ * Returns true once connected after the device moved to another hub:
+ * report failoverReportJson().
+ */
+bool failoverLoop(bool hasWifi, bool connected);
+
+/**
+ * Whether the device is on a hub other than the primary
+ */
+bool failoverActive();
+
+/**
+ * {"hub":"secondary","hostname":"...","count":2,"failedOverSeconds":1800}
+ */
+bool failoverReportJson(char* buffer, size_t size);
+
+#endif // FAILOVER_H
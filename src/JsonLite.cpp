@@ -0,0 +1,135 @@
+/*
+ * Minimal JSON helpers
+ */
+
+#include <Arduino.h>
+
+#include "JsonLite.h"
+
+static const char* skipSpace(const char* p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+const char* jsonFind(const char* json, const char* key)
+{
+    if (json == NULL) return NULL;
+    const char* p = skipSpace(json);
+    if (*p != '{') return NULL;
+    size_t keyLen = strlen(key);
+    p = skipSpace(p + 1);
+    while (*p == '"')
+    {
+        const char* name = p + 1;
+        const char* nameEnd = jsonValueEnd(p) - 1;
+        const char* colon = skipSpace(nameEnd + 1);
+        if (*nameEnd != '"' || *colon != ':') return NULL;
+        const char* value = skipSpace(colon + 1);
+        if ((size_t)(nameEnd - name) == keyLen && strncmp(name, key, keyLen) == 0) return value;
+
+        // Step over the whole value, so members of nested objects never match
+        p = skipSpace(jsonValueEnd(value));
+        if (*p != ',') return NULL;
+        p = skipSpace(p + 1);
+    }
+    return NULL;
+}
+
+const char* jsonValueEnd(const char* value)
+{
+    const char* p = skipSpace(value);
+    if (*p == '"')
+    {
+        p++;
+        while (*p && *p != '"')
+        {
+            if (*p == '\\' && p[1]) p++;
+            p++;
+        }
+        return *p ? p + 1 : p;
+    }
+    if (*p == '{' || *p == '[')
+    {
+        int depth = 0;
+        bool inString = false;
+        for (; *p; p++)
+        {
+            if (inString)
+            {
+                if (*p == '\\' && p[1]) p++;
+                else if (*p == '"') inString = false;
+                continue;
+            }
+            if (*p == '"') inString = true;
+            else if (*p == '{' || *p == '[') depth++;
+            else if ((*p == '}' || *p == ']') && --depth == 0) return p + 1;
+        }
+        return p;
+    }
+    while (*p && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\r' && *p != '\n') p++;
+    return p;
+}
+
+const char* jsonArrayNext(const char* pos, const char** end)
+{
+    const char* p = skipSpace(pos);
+    if (*p == '[' || *p == ',') p = skipSpace(p + 1);
+    if (*p == '\0' || *p == ']') return NULL;
+    *end = jsonValueEnd(p);
+    return p;
+}
+
+bool jsonGetRaw(const char* json, const char* key, char* buffer, size_t size)
+{
+    const char* value = jsonFind(json, key);
+    if (value == NULL) return false;
+    const char* end = jsonValueEnd(value);
+    if (*value == '"')
+    {
+        value++;
+        if (end > value && end[-1] == '"') end--;
+    }
+    size_t len = end - value;
+    if (len >= size) return false;
+    memcpy(buffer, value, len);
+    buffer[len] = '\0';
+    return true;
+}
+
+bool jsonGetString(const char* json, const char* key, char* buffer, size_t size)
+{
+    const char* value = jsonFind(json, key);
+    return value != NULL && *value == '"' && jsonGetRaw(json, key, buffer, size);
+}
+
+bool jsonGetNumber(const char* json, const char* key, float* value)
+{
+    const char* p = jsonFind(json, key);
+    if (p == NULL) return false;
+    char* end;
+    float v = strtof(p, &end);
+    if (end == p) return false;
+    *value = v;
+    return true;
+}
+
+bool jsonGetInt(const char* json, const char* key, int* value)
+{
+    const char* p = jsonFind(json, key);
+    if (p == NULL) return false;
+    char* end;
+    long v = strtol(p, &end, 10);
+    if (end == p) return false;
+    *value = (int)v;
+    return true;
+}
+
+bool jsonGetBool(const char* json, const char* key, bool* value)
+{
+    const char* p = jsonFind(json, key);
+    if (p == NULL) return false;
+    if (strncmp(p, "true", 4) == 0) { *value = true; return true; }
+    if (strncmp(p, "false", 5) == 0) { *value = false; return true; }
+    return false;
+}
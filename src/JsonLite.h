@@ -0,0 +1,44 @@
+/*
+ * Minimal JSON helpers
+ *
+ * strstr-style lookups for the small, trusted documents the device receives
+ * (desired properties, C2D commands). There is no validation and no DOM.
+ * A key is only looked up among the members of the object passed, never
+ * inside nested values, so {"desired":{...},"reported":{...}} cannot
+ * match a name from the wrong section; go down a level with jsonFind().
+ */
+
+#ifndef JSON_LITE_H
+#define JSON_LITE_H
+
+#include <stddef.h>
+
+/**
+ * Pointer to the value of member key of the object json, or NULL
+ */
+const char* jsonFind(const char* json, const char* key);
+
+/**
+ * Pointer just past the value starting at value (object, array, string,
+ * number or literal)
+ */
+const char* jsonValueEnd(const char* value);
+
+/**
+ * Iterate an array: pass the '[' the first time, then the previous element's
+ * end. Returns the next element (and its end in *end), or NULL when done.
+ */
+const char* jsonArrayNext(const char* pos, const char** end);
+
+/**
+ * Copy the value of key in json into buffer as a standalone document
+ * (objects/arrays included); strings are copied without quotes
+ */
+bool jsonGetRaw(const char* json, const char* key, char* buffer, size_t size);
+
+bool jsonGetString(const char* json, const char* key, char* buffer, size_t size);
+bool jsonGetNumber(const char* json, const char* key, float* value);
+bool jsonGetInt(const char* json, const char* key, int* value);
+bool jsonGetBool(const char* json, const char* key, bool* value);
+
+#endif // JSON_LITE_H
@@ -0,0 +1,351 @@
+/*
+ * Incremental JSON parser
+ */
+
+#include <string.h>
+
+#include "JsonStream.h"
+#include "Placement.h"
+
+enum JsonStreamState
+{
+    ST_VALUE,               // a value must follow
+    ST_VALUE_OR_CLOSE,      // just after '['
+    ST_KEY_OR_CLOSE,        // just after '{'
+    ST_KEY,                 // after ',' in an object
+    ST_KEY_STRING,
+    ST_COLON,
+    ST_STRING,
+    ST_LITERAL,             // number, true, false, null
+    ST_AFTER,               // after a value: ',' or a close
+    ST_DONE,
+    ST_ERROR,
+};
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static HOT_PATH void appendToken(JsonStream* s, char c)
+{
+    if (s->tokenLength < sizeof(s->token) - 1) s->token[s->tokenLength++] = c;
+    else s->tokenOverflow = true;
+}
+
+static void startToken(JsonStream* s)
+{
+    s->tokenLength = 0;
+    s->tokenOverflow = false;
+    s->escape = false;
+    s->unicode = 0;
+}
+
+static const char* endToken(JsonStream* s)
+{
+    s->token[s->tokenLength] = '\0';
+    return s->token;
+}
+
+// ===== PATHS =====
+
+static void setPath(JsonStream* s, const char* separator, const char* name)
+{
+    size_t length = s->base[s->depth];
+    // No leading '.' for top-level keys
+    size_t separatorLength = (length == 0 && separator[0] == '.') ? 0 : strlen(separator);
+    size_t nameLength = strlen(name);
+    s->pathOverflow = s->baseOverflow[s->depth];
+    if (length + separatorLength + nameLength >= sizeof(s->path))
+    {
+        s->pathOverflow = true;
+        s->pathLength = length;
+        s->path[length] = '\0';
+        return;
+    }
+    memcpy(s->path + length, separator, separatorLength);
+    memcpy(s->path + length + separatorLength, name, nameLength + 1);
+    s->pathLength = length + separatorLength + nameLength;
+}
+
+static void setMemberPath(JsonStream* s, const char* key, bool keyOverflow)
+{
+    setPath(s, ".", key);
+    if (keyOverflow) s->pathOverflow = true;
+}
+
+static void setElementPath(JsonStream* s)
+{
+    setPath(s, "[]", "");
+}
+
+// ===== VALUES =====
+
+static void finishValue(JsonStream* s)
+{
+    s->state = s->depth == 0 ? ST_DONE : ST_AFTER;
+}
+
+static void emitValue(JsonStream* s, bool isString)
+{
+    const char* value = endToken(s);
+    if (!s->tokenOverflow && !s->pathOverflow && s->onValue)
+    {
+        s->onValue(s, s->path, value, isString);
+    }
+    finishValue(s);
+}
+
+static bool validLiteral(const char* text)
+{
+    if (strcmp(text, "true") == 0 || strcmp(text, "false") == 0 || strcmp(text, "null") == 0) return true;
+    return text[0] == '-' || (text[0] >= '0' && text[0] <= '9');
+}
+
+static bool openContainer(JsonStream* s, char c)
+{
+    if (s->depth == JSON_STREAM_DEPTH) return false;
+
+    bool isArray = c == '[';
+    bool capture = false;
+    if (!s->pathOverflow && s->onBegin)
+    {
+        capture = s->onBegin(s, s->path, isArray);
+    }
+
+    s->depth++;
+    s->isArray[s->depth] = isArray;
+    s->base[s->depth] = (uint8_t)s->pathLength;
+    s->baseOverflow[s->depth] = s->pathOverflow;
+
+    if (capture && s->captureDepth == 0)
+    {
+        s->captureDepth = s->depth;
+        s->captureLength = 0;
+        s->captureOverflow = false;
+        s->capture[s->captureLength++] = c;
+    }
+
+    if (isArray)
+    {
+        setElementPath(s);
+        s->state = ST_VALUE_OR_CLOSE;
+    }
+    else
+    {
+        s->state = ST_KEY_OR_CLOSE;
+    }
+    return true;
+}
+
+static bool closeContainer(JsonStream* s, char c)
+{
+    if (s->depth == 0 || s->isArray[s->depth] != (c == ']')) return false;
+
+    // Back to the container's own path
+    s->pathLength = s->base[s->depth];
+    s->path[s->pathLength] = '\0';
+    s->pathOverflow = s->baseOverflow[s->depth];
+
+    if (s->captureDepth == s->depth)
+    {
+        s->capture[s->captureLength] = '\0';
+        s->captureDepth = 0;
+        if (!s->pathOverflow && s->onCaptured)
+        {
+            s->onCaptured(s, s->path, s->captureOverflow ? NULL : s->capture);
+        }
+    }
+    if (!s->pathOverflow && s->onEnd)
+    {
+        s->onEnd(s, s->path);
+    }
+
+    s->depth--;
+    finishValue(s);
+    return true;
+}
+
+// ===== STATE MACHINE =====
+
+static HOT_PATH bool feedString(JsonStream* s, char c)
+{
+    if (s->unicode > 0)
+    {
+        int digit = (c >= '0' && c <= '9') ? c - '0'
+                  : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                  : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (digit < 0) return false;
+        s->codepoint = (s->codepoint << 4) | digit;
+        if (--s->unicode == 0) appendToken(s, s->codepoint < 0x80 ? (char)s->codepoint : '?');
+        return true;
+    }
+    if (s->escape)
+    {
+        s->escape = false;
+        switch (c)
+        {
+        case 'n': appendToken(s, '\n'); break;
+        case 't': appendToken(s, '\t'); break;
+        case 'r': appendToken(s, '\r'); break;
+        case 'b': appendToken(s, '\b'); break;
+        case 'f': appendToken(s, '\f'); break;
+        case 'u': s->unicode = 4; s->codepoint = 0; break;
+        default:  appendToken(s, c); break;
+        }
+        return true;
+    }
+    if (c == '\\')
+    {
+        s->escape = true;
+        return true;
+    }
+    if (c != '"')
+    {
+        appendToken(s, c);
+        return true;
+    }
+
+    // Closing quote
+    if (s->state == ST_KEY_STRING)
+    {
+        setMemberPath(s, endToken(s), s->tokenOverflow);
+        s->state = ST_COLON;
+    }
+    else
+    {
+        emitValue(s, true);
+    }
+    return true;
+}
+
+static HOT_PATH bool feedValue(JsonStream* s, char c)
+{
+    if (c == '{' || c == '[') return openContainer(s, c);
+    if (c == '"')
+    {
+        startToken(s);
+        s->state = ST_STRING;
+        return true;
+    }
+    if (c == '-' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))
+    {
+        startToken(s);
+        appendToken(s, c);
+        s->state = ST_LITERAL;
+        return true;
+    }
+    return false;
+}
+
+static HOT_PATH bool dispatch(JsonStream* s, char c)
+{
+    if (s->state == ST_STRING || s->state == ST_KEY_STRING) return feedString(s, c);
+
+    if (s->state == ST_LITERAL)
+    {
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+            || c == '-' || c == '+' || c == '.')
+        {
+            appendToken(s, c);
+            return true;
+        }
+        if (!validLiteral(endToken(s))) return false;
+        emitValue(s, false);
+        // The terminating character belongs to the enclosing state
+    }
+
+    if (isSpace(c)) return true;
+
+    switch (s->state)
+    {
+    case ST_VALUE_OR_CLOSE:
+        if (c == ']') return closeContainer(s, c);
+        return feedValue(s, c);
+
+    case ST_VALUE:
+        return feedValue(s, c);
+
+    case ST_KEY_OR_CLOSE:
+        if (c == '}') return closeContainer(s, c);
+        // fall through
+    case ST_KEY:
+        if (c != '"') return false;
+        startToken(s);
+        s->state = ST_KEY_STRING;
+        return true;
+
+    case ST_COLON:
+        if (c != ':') return false;
+        s->state = ST_VALUE;
+        return true;
+
+    case ST_AFTER:
+        if (c == ',')
+        {
+            if (s->isArray[s->depth])
+            {
+                setElementPath(s);
+                s->state = ST_VALUE;
+            }
+            else
+            {
+                s->state = ST_KEY;
+            }
+            return true;
+        }
+        if (c == ']' || c == '}') return closeContainer(s, c);
+        return false;
+
+    default:
+        // Anything but whitespace after the document, or after an error
+        return false;
+    }
+}
+
+void jsonStreamReset(JsonStream* s)
+{
+    s->state = ST_VALUE;
+    s->depth = 0;
+    s->base[0] = 0;
+    s->baseOverflow[0] = false;
+    s->path[0] = '\0';
+    s->pathLength = 0;
+    s->pathOverflow = false;
+    s->captureDepth = 0;
+    startToken(s);
+}
+
+HOT_PATH bool jsonStreamFeed(JsonStream* s, char c)
+{
+    if (s->state == ST_ERROR) return false;
+
+    if (s->captureDepth != 0)
+    {
+        if (s->captureLength < sizeof(s->capture) - 1) s->capture[s->captureLength++] = c;
+        else s->captureOverflow = true;
+    }
+
+    if (!dispatch(s, c))
+    {
+        s->state = ST_ERROR;
+        return false;
+    }
+    return true;
+}
+
+HOT_PATH bool jsonStreamFeedString(JsonStream* s, const char* text, size_t length)
+{
+    if (length == 0) length = strlen(text);
+    for (size_t i = 0; i < length; i++)
+    {
+        if (!jsonStreamFeed(s, text[i])) return false;
+    }
+    return true;
+}
+
+bool jsonStreamDone(const JsonStream* s)
+{
+    // A bare top-level number is only complete once followed by whitespace
+    return s->state == ST_DONE;
+}
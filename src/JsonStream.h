@@ -0,0 +1,105 @@
+/*
+ * Incremental JSON parser
+ *
+ * Consumes a document one character at a time in constant memory, so it
+ * can sit behind a socket and handle documents of any size. Instead of a
+ * tree it reports what it sees by path:
+ *
+ *   {"desired":{"alertsOnly":true,"rules":[{"id":"hot",...},...]}}
+ *
+ *   onBegin("desired.rules", array)       container opened
+ *   onBegin("desired.rules[]", object)    return true to capture it
+ *   onCaptured("desired.rules[]", "{\"id\":\"hot\",...}")
+ *   onValue("desired.alertsOnly", "true", false)
+ *   onEnd("desired.rules")
+ *
+ * Array elements share the path "<array>[]". Captured containers are
+ * delivered as raw JSON (NULL if larger than the capture buffer), which
+ * lets small objects inside a large document be handled by the JsonLite
+ * helpers. Strings are unescaped; \u escapes outside ASCII become '?'.
+ */
+
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef JSON_STREAM_DEPTH
+#define JSON_STREAM_DEPTH 8
+#endif
+
+#ifndef JSON_STREAM_PATH_MAX
+#define JSON_STREAM_PATH_MAX 96
+#endif
+
+// Longest key or scalar value reported; longer ones are skipped
+#ifndef JSON_STREAM_TOKEN_MAX
+#define JSON_STREAM_TOKEN_MAX 64
+#endif
+
+// Largest container captured whole (a rule, the firmware request)
+#ifndef JSON_STREAM_CAPTURE_MAX
+#define JSON_STREAM_CAPTURE_MAX 416
+#endif
+
+struct JsonStream;
+
+typedef bool (*JsonStreamBeginCallback)(JsonStream* stream, const char* path, bool isArray);
+typedef void (*JsonStreamEndCallback)(JsonStream* stream, const char* path);
+typedef void (*JsonStreamValueCallback)(JsonStream* stream, const char* path, const char* value, bool isString);
+typedef void (*JsonStreamCapturedCallback)(JsonStream* stream, const char* path, const char* json);
+
+struct JsonStream
+{
+    // Callbacks, any may be NULL
+    JsonStreamBeginCallback onBegin;
+    JsonStreamEndCallback onEnd;
+    JsonStreamValueCallback onValue;
+    JsonStreamCapturedCallback onCaptured;
+
+    // Parser state
+    uint8_t state;
+    uint8_t depth;
+    bool escape;
+    bool isArray[JSON_STREAM_DEPTH + 1];
+    uint8_t base[JSON_STREAM_DEPTH + 1];    // path length of each open container
+    bool baseOverflow[JSON_STREAM_DEPTH + 1];
+    char path[JSON_STREAM_PATH_MAX];
+    size_t pathLength;
+    bool pathOverflow;                      // current path was truncated
+    char token[JSON_STREAM_TOKEN_MAX];
+    size_t tokenLength;
+    bool tokenOverflow;
+    uint8_t unicode;                        // \uXXXX hex digits still to read
+    uint16_t codepoint;
+
+    // Raw capture of one container
+    char capture[JSON_STREAM_CAPTURE_MAX];
+    size_t captureLength;
+    uint8_t captureDepth;                   // 0: not capturing
+    bool captureOverflow;
+};
+
+/**
+ * Start a new document; callbacks are kept
+ */
+void jsonStreamReset(JsonStream* stream);
+
+/**
+ * Feed the next character. Returns false once the document is malformed;
+ * further input is ignored until the next reset.
+ */
+bool jsonStreamFeed(JsonStream* stream, char c);
+
+/**
+ * Feed a whole buffer (or C string if length is 0)
+ */
+bool jsonStreamFeedString(JsonStream* stream, const char* text, size_t length = 0);
+
+/**
+ * True once a complete top-level value has been parsed
+ */
+bool jsonStreamDone(const JsonStream* stream);
+
+#endif // JSON_STREAM_H
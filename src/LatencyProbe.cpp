@@ -0,0 +1,212 @@
+/*
+ * Round-trip latency probe
+ */
+
+#include <Arduino.h>
+#include "AzureIoTHub.h"
+
+#include "JsonLite.h"
+#include "LatencyProbe.h"
+#include "Log.h"
+#include "MessageProperties.h"
+#include "OutboundQueue.h"
+#include "Trace.h"
+
+struct InFlight
+{
+    bool used;
+    unsigned long seq;
+    unsigned long sentAt;
+};
+
+static InFlight inFlight[LATENCY_PROBE_IN_FLIGHT];
+static unsigned long intervalMs = 0;
+static unsigned long count = 0;         // probes in this run, 0 for no limit
+static bool running = false;
+static unsigned long nextSeq = 0;
+static unsigned long lastSent = 0;
+static unsigned long lastReport = 0;
+static bool reportDue = false;
+
+// Results of the current (or last) run
+static unsigned long sent = 0;
+static unsigned long received = 0;
+static unsigned long lost = 0;
+static unsigned long minMs = 0;
+static unsigned long maxMs = 0;
+static unsigned long totalMs = 0;
+static unsigned long histogram[LATENCY_PROBE_BUCKETS];
+
+static int bucketOf(unsigned long rttMs)
+{
+    int bucket = 0;
+    while (bucket < LATENCY_PROBE_BUCKETS - 1 && rttMs >= ((unsigned long)LATENCY_PROBE_FIRST_BUCKET_MS << bucket))
+    {
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * Upper edge of the bucket holding the given share of the round trips (an
+ * estimate, at most 2x off), capped at the maximum
+ */
+static unsigned long percentile(int percent)
+{
+    unsigned long target = (received * percent + 99) / 100;
+    unsigned long seen = 0;
+    for (int i = 0; i < LATENCY_PROBE_BUCKETS - 1; i++)
+    {
+        seen += histogram[i];
+        unsigned long edge = (unsigned long)LATENCY_PROBE_FIRST_BUCKET_MS << i;
+        if (seen >= target && seen > 0) return edge < maxMs ? edge : maxMs;
+    }
+    return maxMs;
+}
+
+static bool sendProbe()
+{
+    InFlight* slot = NULL;
+    for (int i = 0; i < LATENCY_PROBE_IN_FLIGHT && slot == NULL; i++)
+    {
+        if (!inFlight[i].used) slot = &inFlight[i];
+    }
+    // Acks go first
+    if (slot == NULL || outboundDepth(LANE_CONTROL) > 0) return false;
+
+    MessageProperties props;
+    messagePropertiesInitJson(&props);
+    messagePropertiesAdd(&props, "probe", "1");
+    char body[64];
+    unsigned long sentAt = millis();
+    snprintf(body, sizeof(body), "{\"probe\":{\"seq\":%lu,\"t\":%lu}}", nextSeq, sentAt);
+    TRACE_BEGIN(PUBLISH);
+    bool published = azureIoTSendTelemetry(body, props.encoded);
+    TRACE_END(PUBLISH, published ? strlen(body) : 0);
+    if (!published) return false;
+
+    slot->used = true;
+    slot->seq = nextSeq++;
+    slot->sentAt = sentAt;
+    sent++;
+    return true;
+}
+
+void latencyProbeStart(unsigned long interval, unsigned long probes)
+{
+    if (interval != 0 && interval < LATENCY_PROBE_MIN_INTERVAL_MS) interval = LATENCY_PROBE_MIN_INTERVAL_MS;
+
+    // The full twin arrives again on every connect: same settings, same run
+    if (interval == intervalMs && probes == count && (running || sent > 0)) return;
+    intervalMs = interval;
+    count = probes;
+    running = interval != 0;
+    if (!running)
+    {
+        LOG_INFO("Latency probe: off");
+        return;
+    }
+
+    memset(inFlight, 0, sizeof(inFlight));
+    memset(histogram, 0, sizeof(histogram));
+    sent = received = lost = minMs = maxMs = totalMs = 0;
+    reportDue = false;
+    lastSent = lastReport = millis();
+    LOG_INFO("Latency probe: every %lu ms, %lu probes", intervalMs, count);
+}
+
+bool latencyProbeLoop(bool connected)
+{
+    unsigned long now = millis();
+    bool inFlightLeft = false;
+    for (int i = 0; i < LATENCY_PROBE_IN_FLIGHT; i++)
+    {
+        if (!inFlight[i].used) continue;
+        if (now - inFlight[i].sentAt >= LATENCY_PROBE_TIMEOUT_MS)
+        {
+            inFlight[i].used = false;
+            lost++;
+        }
+        else
+        {
+            inFlightLeft = true;
+        }
+    }
+    if (running)
+    {
+        // Paused while disconnected
+        bool done = count != 0 && sent >= count;
+        if (connected && !done && now - lastSent >= intervalMs)
+        {
+            lastSent = now;
+            sendProbe();
+        }
+
+        if (done && !inFlightLeft)
+        {
+            running = false;
+            reportDue = true;
+            LOG_INFO("Latency probe: done, %lu of %lu answered, median < %lu ms", received, sent, percentile(50));
+        }
+        else if (now - lastReport >= LATENCY_PROBE_REPORT_MS)
+        {
+            lastReport = now;
+            reportDue = true;
+        }
+    }
+
+    // Queued offline, the report would only push acks out of the control
+    // lane; the latest results go out once connected
+    if (!reportDue || !connected) return false;
+    reportDue = false;
+    return true;
+}
+
+bool latencyProbeEcho(const char* payload)
+{
+    const char* probe = jsonFind(payload, "probe");
+    int seq;
+    if (probe == NULL || *probe != '{' || !jsonGetInt(probe, "seq", &seq)) return false;
+
+    // Late (already counted lost), duplicated or from an earlier run: ignored
+    for (int i = 0; i < LATENCY_PROBE_IN_FLIGHT; i++)
+    {
+        if (!inFlight[i].used || inFlight[i].seq != (unsigned long)seq) continue;
+        inFlight[i].used = false;
+
+        unsigned long rttMs = millis() - inFlight[i].sentAt;
+        if (received == 0 || rttMs < minMs) minMs = rttMs;
+        if (rttMs > maxMs) maxMs = rttMs;
+        totalMs += rttMs;
+        histogram[bucketOf(rttMs)]++;
+        received++;
+        TRACE_INSTANT(PROBE_ECHO, rttMs > 0xFFFF ? 0xFFFF : rttMs);
+        LOG_DEBUG("Latency probe #%d: %lu ms", seq, rttMs);
+        break;
+    }
+    return true;
+}
+
+bool latencyProbeSettingsJson(char* buffer, size_t size)
+{
+    int n = snprintf(buffer, size, "{\"intervalMs\":%lu,\"count\":%lu}", intervalMs, count);
+    return n > 0 && (size_t)n < size;
+}
+
+bool latencyProbeReportJson(char* buffer, size_t size)
+{
+    int n = snprintf(buffer, size,
+        "{\"running\":%s,\"sent\":%lu,\"received\":%lu,\"lost\":%lu,\"minMs\":%lu,\"avgMs\":%lu,\"maxMs\":%lu,"
+        "\"p50Ms\":%lu,\"p95Ms\":%lu,\"bucketMs\":%d,\"histogram\":[",
+        running ? "true" : "false", sent, received, lost, minMs, received ? totalMs / received : 0, maxMs,
+        percentile(50), percentile(95), LATENCY_PROBE_FIRST_BUCKET_MS);
+    if (n < 0 || (size_t)n >= size) return false;
+    size_t length = n;
+    for (int i = 0; i < LATENCY_PROBE_BUCKETS; i++)
+    {
+        n = snprintf(buffer + length, size - length, "%s%lu", i ? "," : "", histogram[i]);
+        if (n < 0 || (size_t)n >= size - length) return false;
+        length += n;
+    }
+    return length + 2 < size && snprintf(buffer + length, size - length, "]}") == 2;
+}
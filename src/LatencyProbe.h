@@ -0,0 +1,92 @@
+/*
+ * Round-trip latency probe
+ *
+ * Measures device -> IoT Hub -> back-end -> device latency. While running
+ * and connected, a probe message is published every interval:
+ *
+ *   {"probe":{"seq":17,"t":123456}}    with application property probe=1
+ *
+ * It is published directly rather than through the outbound queue, and
+ * timed from just before the publish, so the time it would spend queued
+ * is not part of the round trip. A probe waits while an ack is queued.
+ * An echo service (tools/latency_echo.py) reads it from the hub's events
+ * endpoint, or from a local broker standing in for the hub, and sends the
+ * body back as a C2D message. latencyProbeEcho() matches the sequence
+ * number against the probes in flight and adds the round trip (publish,
+ * hub, service, C2D delivery and the device's receive path) to a
+ * histogram. Probes not answered within LATENCY_PROBE_TIMEOUT_MS count as
+ * lost.
+ *
+ * Started from the "latencyProbe" desired property, for "count" probes or
+ * until the interval is set to 0; set both members together. The same
+ * settings again (the full twin after a reconnect) do not restart a run.
+ * The histogram, percentiles and loss are reported under "latency" every
+ * LATENCY_PROBE_REPORT_MS and at the end of a run, once connected. Histogram bucket i
+ * holds round trips under LATENCY_PROBE_FIRST_BUCKET_MS << i; the last
+ * one holds the rest.
+ */
+
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <stddef.h>
+
+#ifndef LATENCY_PROBE_TIMEOUT_MS
+#define LATENCY_PROBE_TIMEOUT_MS 30000
+#endif
+
+// Probes in flight at most; one due while all are waiting is skipped, as
+// is one due while the control lane has acks queued
+#ifndef LATENCY_PROBE_IN_FLIGHT
+#define LATENCY_PROBE_IN_FLIGHT 16
+#endif
+
+// Probes bypass the control lane's rate limit; this keeps them at its
+// sustained rate (30/min)
+#ifndef LATENCY_PROBE_MIN_INTERVAL_MS
+#define LATENCY_PROBE_MIN_INTERVAL_MS 2000
+#endif
+
+#ifndef LATENCY_PROBE_REPORT_MS
+#define LATENCY_PROBE_REPORT_MS 60000
+#endif
+
+#ifndef LATENCY_PROBE_FIRST_BUCKET_MS
+#define LATENCY_PROBE_FIRST_BUCKET_MS 16
+#endif
+
+// 16 ms .. 16 s, then everything slower
+#ifndef LATENCY_PROBE_BUCKETS
+#define LATENCY_PROBE_BUCKETS 12
+#endif
+
+/**
+ * Start a run (clearing the previous results) sending a probe every
+ * intervalMs, count probes or 0 for no limit; intervalMs 0 stops
+ */
+void latencyProbeStart(unsigned long intervalMs, unsigned long count);
+
+/**
+ * Send due probes and expire lost ones; call from loop(). Returns true
+ * when the results are worth reporting and the hub is connected; a report
+ * that comes due offline waits for the connection.
+ */
+bool latencyProbeLoop(bool connected);
+
+/**
+ * Handle an inbound message; returns false if it is not a probe echo
+ */
+bool latencyProbeEcho(const char* payload);
+
+/**
+ * {"intervalMs":1000,"count":100}
+ */
+bool latencyProbeSettingsJson(char* buffer, size_t size);
+
+/**
+ * {"running":false,"sent":100,"received":98,"lost":2,"minMs":180,"avgMs":240,
+ *  "maxMs":910,"p50Ms":256,"p95Ms":512,"bucketMs":16,"histogram":[0,0,0,0,12,80,5,1,0,0,0,0]}
+ */
+bool latencyProbeReportJson(char* buffer, size_t size);
+
+#endif // LATENCY_PROBE_H
@@ -0,0 +1,332 @@
+/*
+ * Asynchronous serial logging
+ *
+ * Record layout in the ring (little endian, byte granular, may wrap):
+ *   uint16 length   total record length including this header
+ *   uint8  level
+ *   uint8  kind     LOG_KIND_TEXT or LOG_KIND_DEFERRED
+ *   text bytes, or format pointer followed by the packed arguments
+ *
+ * Producers copy a record in under a critical section; the drain thread is
+ * the only consumer.
+ */
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include "mbed.h"
+
+#include "Log.h"
+
+#define LOG_KIND_TEXT       0
+#define LOG_KIND_DEFERRED   1
+#define LOG_HEADER_SIZE     4
+#define LOG_SPEC_MAX        32
+#define LOG_DRAIN_IDLE_MS   5
+
+#if (LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) != 0
+#error "LOG_BUFFER_SIZE must be a power of two"
+#endif
+
+static uint8_t ring[LOG_BUFFER_SIZE];
+static volatile uint32_t head = 0;     // next byte written (producers)
+static volatile uint32_t tail = 0;     // next byte read (drain thread)
+static volatile unsigned long dropped = 0;
+static unsigned long droppedReported = 0;
+
+static Thread drainThread(osPriorityLow, 2048);
+static bool started = false;
+
+// ===== RING =====
+
+static void ringCopyIn(uint32_t pos, const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        ring[(pos + i) & (LOG_BUFFER_SIZE - 1)] = data[i];
+    }
+}
+
+static void ringCopyOut(uint32_t pos, uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        data[i] = ring[(pos + i) & (LOG_BUFFER_SIZE - 1)];
+    }
+}
+
+/**
+ * Append a complete record, or count it as dropped if it does not fit
+ */
+static void ringPush(const uint8_t* record, size_t len)
+{
+    core_util_critical_section_enter();
+    if (LOG_BUFFER_SIZE - (head - tail) < len)
+    {
+        dropped++;
+    }
+    else
+    {
+        ringCopyIn(head, record, len);
+        head += len;
+    }
+    core_util_critical_section_exit();
+}
+
+// ===== DEFERRED FORMATTING =====
+
+/**
+ * Parse one conversion spec starting at '%'. Returns its length and the
+ * conversion character, and how many '*' fields it has.
+ */
+static int parseSpec(const char* spec, char* conversion, int* stars, int* longs)
+{
+    int i = 1;
+    *stars = 0;
+    *longs = 0;
+    while (spec[i] && strchr("-+ #0", spec[i])) i++;
+    while (spec[i] == '*' || (spec[i] >= '0' && spec[i] <= '9') || spec[i] == '.')
+    {
+        if (spec[i] == '*') (*stars)++;
+        i++;
+    }
+    while (spec[i] && strchr("hlzjt", spec[i]))
+    {
+        if (spec[i] == 'l') (*longs)++;
+        i++;
+    }
+    *conversion = spec[i];
+    return spec[i] ? i + 1 : i;
+}
+
+#define PACK(type, value) \
+    do { type v_ = (value); if (used + sizeof(v_) > size) return -1; \
+         memcpy(out + used, &v_, sizeof(v_)); used += sizeof(v_); } while (0)
+
+/**
+ * Pack the arguments described by format into out; returns bytes used,
+ * or -1 if they do not fit. %s arguments are truncated to fit.
+ */
+static int packArgs(uint8_t* out, size_t size, const char* format, va_list args)
+{
+    size_t used = 0;
+    for (const char* p = format; *p; p++)
+    {
+        if (*p != '%') continue;
+        if (p[1] == '%') { p++; continue; }
+
+        char conversion;
+        int stars, longs;
+        int len = parseSpec(p, &conversion, &stars, &longs);
+        for (int s = 0; s < stars; s++) PACK(int, va_arg(args, int));
+
+        switch (conversion)
+        {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            if (longs >= 2) PACK(long long, va_arg(args, long long));
+            else if (longs == 1) PACK(long, va_arg(args, long));
+            else PACK(int, va_arg(args, int));
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            PACK(double, va_arg(args, double));
+            break;
+        case 'p':
+            PACK(void*, va_arg(args, void*));
+            break;
+        case 's':
+        {
+            const char* str = va_arg(args, const char*);
+            if (str == NULL) str = "(null)";
+            size_t n = strlen(str);
+            if (used + n + 1 > size) n = size > used + 1 ? size - used - 1 : 0;
+            if (used + n + 1 > size) return -1;
+            memcpy(out + used, str, n);
+            out[used + n] = '\0';
+            used += n + 1;
+            break;
+        }
+        default:
+            break;
+        }
+        p += len - 1;
+    }
+    return (int)used;
+}
+
+#define UNPACK(type, var) \
+    type var; memcpy(&var, args + used, sizeof(var)); used += sizeof(var)
+
+/**
+ * Format a deferred record back into text
+ */
+static void formatDeferred(char* text, size_t size, const char* format, const uint8_t* args, size_t argsLen)
+{
+    size_t out = 0;
+    size_t used = 0;
+    for (const char* p = format; *p && out + 1 < size; p++)
+    {
+        if (*p != '%') { text[out++] = *p; continue; }
+        if (p[1] == '%') { text[out++] = '%'; p++; continue; }
+
+        char conversion;
+        int stars, longs;
+        int len = parseSpec(p, &conversion, &stars, &longs);
+
+        // Copy the spec, substituting '*' fields with their stored values
+        char spec[LOG_SPEC_MAX];
+        size_t specLen = 0;
+        for (int i = 0; i < len && specLen + 12 < sizeof(spec); i++)
+        {
+            if (p[i] == '*' && used + sizeof(int) <= argsLen)
+            {
+                UNPACK(int, star);
+                specLen += snprintf(spec + specLen, sizeof(spec) - specLen, "%d", star);
+            }
+            else
+            {
+                spec[specLen++] = p[i];
+            }
+        }
+        spec[specLen] = '\0';
+
+        int n = 0;
+        switch (conversion)
+        {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            if (longs >= 2) { UNPACK(long long, v); n = snprintf(text + out, size - out, spec, v); }
+            else if (longs == 1) { UNPACK(long, v); n = snprintf(text + out, size - out, spec, v); }
+            else { UNPACK(int, v); n = snprintf(text + out, size - out, spec, v); }
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        {
+            UNPACK(double, v);
+            n = snprintf(text + out, size - out, spec, v);
+            break;
+        }
+        case 'p':
+        {
+            UNPACK(void*, v);
+            n = snprintf(text + out, size - out, spec, v);
+            break;
+        }
+        case 's':
+        {
+            const char* str = (const char*)(args + used);
+            used += strlen(str) + 1;
+            n = snprintf(text + out, size - out, spec, str);
+            break;
+        }
+        default:
+            break;
+        }
+        if (n > 0) out += (size_t)n < size - out ? (size_t)n : size - out - 1;
+        if (used > argsLen) break;
+        p += len - 1;
+    }
+    text[out] = '\0';
+}
+
+// ===== DRAIN THREAD =====
+
+static void drainLoop()
+{
+    uint8_t record[LOG_RECORD_MAX];
+    char text[LOG_RECORD_MAX + 64];
+
+    while (true)
+    {
+        if (tail == head)
+        {
+            if (dropped != droppedReported)
+            {
+                droppedReported = dropped;
+                Serial.printf("[log] %lu messages dropped\r\n", droppedReported);
+            }
+            Thread::wait(LOG_DRAIN_IDLE_MS);
+            continue;
+        }
+
+        uint8_t header[LOG_HEADER_SIZE];
+        ringCopyOut(tail, header, sizeof(header));
+        uint16_t len = header[0] | (header[1] << 8);
+        ringCopyOut(tail, record, len);
+        tail += len;
+
+        const uint8_t* body = record + LOG_HEADER_SIZE;
+        size_t bodyLen = len - LOG_HEADER_SIZE;
+        if (header[3] == LOG_KIND_DEFERRED)
+        {
+            const char* format;
+            memcpy(&format, body, sizeof(format));
+            formatDeferred(text, sizeof(text), format, body + sizeof(format), bodyLen - sizeof(format));
+            Serial.print(text);
+        }
+        else
+        {
+            Serial.write(body, bodyLen);
+        }
+        Serial.print("\r\n");
+    }
+}
+
+// ===== PUBLIC API =====
+
+void logInit()
+{
+    if (started) return;
+    started = true;
+    drainThread.start(drainLoop);
+}
+
+void logWrite(int level, const char* format, ...)
+{
+    uint8_t record[LOG_RECORD_MAX];
+    size_t len = LOG_HEADER_SIZE;
+
+    va_list args;
+    va_start(args, format);
+#if LOG_DEFERRED
+    memcpy(record + len, &format, sizeof(format));
+    len += sizeof(format);
+    int packed = packArgs(record + len, sizeof(record) - len, format, args);
+    record[3] = LOG_KIND_DEFERRED;
+    if (packed < 0)
+    {
+        // Arguments too large to defer; fall back to formatting here
+        va_end(args);
+        va_start(args, format);
+        len = LOG_HEADER_SIZE;
+        int n = vsnprintf((char*)record + len, sizeof(record) - len, format, args);
+        len += n < 0 ? 0 : ((size_t)n < sizeof(record) - len ? (size_t)n : sizeof(record) - len - 1);
+        record[3] = LOG_KIND_TEXT;
+    }
+    else
+    {
+        len += packed;
+    }
+#else
+    int n = vsnprintf((char*)record + len, sizeof(record) - len, format, args);
+    len += n < 0 ? 0 : ((size_t)n < sizeof(record) - len ? (size_t)n : sizeof(record) - len - 1);
+    record[3] = LOG_KIND_TEXT;
+#endif
+    va_end(args);
+
+    record[0] = len & 0xFF;
+    record[1] = len >> 8;
+    record[2] = (uint8_t)level;
+
+    // Records queued before logInit() are written once the thread starts
+    ringPush(record, len);
+}
+
+void logFlush()
+{
+    while (started && tail != head)
+    {
+        Thread::wait(1);
+    }
+}
+
+unsigned long logDropped()
+{
+    return dropped;
+}
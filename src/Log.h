@@ -0,0 +1,88 @@
+/*
+ * Asynchronous serial logging
+ *
+ * LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG append one line to a RAM ring buffer
+ * and return; a low-priority thread drains the ring to Serial, so a slow UART
+ * never stalls loop(). Messages above LOG_LEVEL compile to nothing.
+ *
+ * With LOG_DEFERRED (the default) a record holds only the format string
+ * pointer and the raw argument values; the text is formatted on the drain
+ * thread. Format strings must therefore be string literals. %s arguments are
+ * copied into the record, truncated to what fits in LOG_RECORD_MAX.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+// Highest level compiled in
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// 1: store format pointer + arguments, format on the drain thread
+// 0: format into the ring at the call site
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED 1
+#endif
+
+// Ring buffer size in bytes (power of two)
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 4096
+#endif
+
+// Largest single record (header + text or arguments)
+#ifndef LOG_RECORD_MAX
+#define LOG_RECORD_MAX 256
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logWrite(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logWrite(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+/**
+ * Start the drain thread; call once after Serial.begin()
+ */
+void logInit();
+
+/**
+ * Queue one line; use the LOG_* macros instead of calling this directly
+ */
+void logWrite(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Block until everything queued has been written (e.g. before a reset)
+ */
+void logFlush();
+
+/**
+ * Number of records dropped because the ring was full
+ */
+unsigned long logDropped();
+
+#endif // LOG_H
@@ -0,0 +1,135 @@
+/*
+ * D2C message property bag
+ */
+
+#include <Arduino.h>
+
+#include "MessageProperties.h"
+#include "Retained.h"
+
+#define BOOT_NONCE_MAGIC 0x4D494431   // "MID1"
+
+struct BootNonce
+{
+    uint32_t magic;
+    uint32_t nonce;
+    uint32_t checksum;
+};
+
+static RETAINED BootNonce boot;
+static bool bootCounted = false;
+
+static bool unreserved(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '-' || c == '_' || c == '.' || c == '~';
+}
+
+/**
+ * Append text to the bag, percent-encoding it when encode is set
+ */
+static bool append(MessageProperties* props, const char* text, bool encode)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t length = props->length;
+    for (const char* c = text; *c; c++)
+    {
+        bool plain = !encode || unreserved(*c);
+        if (length + (plain ? 1 : 3) >= sizeof(props->encoded)) return false;
+        if (plain)
+        {
+            props->encoded[length++] = *c;
+        }
+        else
+        {
+            props->encoded[length++] = '%';
+            props->encoded[length++] = hex[(unsigned char)*c >> 4];
+            props->encoded[length++] = hex[*c & 0x0F];
+        }
+    }
+    props->length = length;
+    props->encoded[length] = '\0';
+    return true;
+}
+
+static bool addProperty(MessageProperties* props, const char* name, bool encodeName, const char* value)
+{
+    size_t mark = props->length;
+    if ((mark == 0 || append(props, "&", false))
+        && append(props, name, encodeName)
+        && append(props, "=", false)
+        && append(props, value, true))
+    {
+        return true;
+    }
+
+    // Leave the bag as it was rather than with half a property
+    props->length = mark;
+    props->encoded[mark] = '\0';
+    props->overflow = true;
+    return false;
+}
+
+void messagePropertiesInit(MessageProperties* props)
+{
+    props->encoded[0] = '\0';
+    props->length = 0;
+    props->overflow = false;
+}
+
+void messagePropertiesInitJson(MessageProperties* props)
+{
+    messagePropertiesInit(props);
+    messagePropertiesSetContentType(props, "application/json", "utf-8");
+}
+
+bool messagePropertiesAdd(MessageProperties* props, const char* name, const char* value)
+{
+    return addProperty(props, name, true, value);
+}
+
+bool messagePropertiesAddInt(MessageProperties* props, const char* name, long value)
+{
+    char text[12];
+    snprintf(text, sizeof(text), "%ld", value);
+    return addProperty(props, name, true, text);
+}
+
+bool messagePropertiesSetContentType(MessageProperties* props, const char* contentType, const char* contentEncoding)
+{
+    // System property names are sent as-is; IoT Hub matches the literal "$."
+    return addProperty(props, "$.ct", false, contentType)
+        && (contentEncoding == NULL || addProperty(props, "$.ce", false, contentEncoding));
+}
+
+bool messagePropertiesSetMessageId(MessageProperties* props, const char* messageId)
+{
+    return addProperty(props, "$.mid", false, messageId);
+}
+
+bool messagePropertiesSetComponent(MessageProperties* props, const char* component)
+{
+    return addProperty(props, "$.sub", false, component);
+}
+
+uint32_t messageBootNonce()
+{
+    if (!bootCounted)
+    {
+        bootCounted = true;
+        if (boot.magic == BOOT_NONCE_MAGIC
+            && boot.checksum == retainedChecksum(&boot, offsetof(BootNonce, checksum)))
+        {
+            boot.nonce++;
+        }
+        else
+        {
+            // Power-on: SRAM comes up in a random state, so the invalid block
+            // and the time since reset make a seed other devices do not share
+            boot.nonce = retainedChecksum(&boot, sizeof(boot)) ^ micros();
+        }
+        boot.magic = BOOT_NONCE_MAGIC;
+        boot.checksum = retainedChecksum(&boot, offsetof(BootNonce, checksum));
+    }
+    return boot.nonce;
+}
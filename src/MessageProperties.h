@@ -0,0 +1,64 @@
+/*
+ * D2C message property bag
+ *
+ * Builds the URL-encoded property string IoT Hub expects at the end of the
+ * telemetry topic, encoding each name/value once as it is added:
+ *
+ *   MessageProperties props;
+ *   messagePropertiesInit(&props);
+ *   messagePropertiesSetContentType(&props, "application/json", "utf-8");
+ *   messagePropertiesAdd(&props, "alert", "hot");
+ *   outboundEnqueue(LANE_ALERT, OUTBOUND_TELEMETRY, payload, props.encoded);
+ *
+ * System properties ($.ct / $.ce) let hub message routing query the body;
+ * application properties can be routed on without parsing the body at all.
+ *
+ * The message counter restarts at every boot, so $.mid carries a boot
+ * nonce as well ("<nonce>-<count>", see messageBootNonce()) to stay unique
+ * for duplicate detection downstream.
+ */
+
+#ifndef MESSAGE_PROPERTIES_H
+#define MESSAGE_PROPERTIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "OutboundQueue.h"
+
+struct MessageProperties
+{
+    char encoded[OUTBOUND_PROPS_MAX];
+    size_t length;
+    bool overflow;          // a property did not fit and was left out
+};
+
+void messagePropertiesInit(MessageProperties* props);
+
+/**
+ * Add an application property; name and value are URL-encoded
+ */
+bool messagePropertiesAdd(MessageProperties* props, const char* name, const char* value);
+bool messagePropertiesAddInt(MessageProperties* props, const char* name, long value);
+
+/**
+ * System properties: content type/encoding ($.ct, $.ce), message id ($.mid)
+ * and the Plug and Play component the telemetry belongs to ($.sub)
+ */
+bool messagePropertiesSetContentType(MessageProperties* props, const char* contentType, const char* contentEncoding);
+bool messagePropertiesSetMessageId(MessageProperties* props, const char* messageId);
+bool messagePropertiesSetComponent(MessageProperties* props, const char* component);
+
+/**
+ * Properties for a JSON body: $.ct=application/json, $.ce=utf-8
+ */
+void messagePropertiesInitJson(MessageProperties* props);
+
+/**
+ * Number that changes on every boot: one more than the last boot's after a
+ * soft reset (kept in retained RAM), a random seed after a power-on
+ */
+uint32_t messageBootNonce();
+
+
+#endif // MESSAGE_PROPERTIES_H
@@ -0,0 +1,739 @@
+/*
+ * Over-the-air firmware update
+ */
+
+#include <Arduino.h>
+#include "CheckSumUtils.h"
+#include "http_client.h"
+#include "mbed.h"
+#include "mbedtls/sha256.h"
+#include "mico.h"
+
+#include "DeltaPatch.h"
+#include "JsonLite.h"
+#include "Log.h"
+#include "OtaUpdate.h"
+#include "OutboundQueue.h"
+#include "Retained.h"
+#include "Watchdog.h"
+
+#define OTA_MAGIC           0x4F544131  // "OTA1"
+#define OTA_URL_MAX         128
+#define OTA_VERSION_MAX     16
+#define OTA_FLUSH_SIZE      512         // flash write size; each one is a resume point
+#define OTA_PIECE_MAX       64          // largest single write from the applier
+#define OTA_PAGES           2           // one filling while the other is written
+#define OTA_RETRY_MS        10000       // times the retry count
+#define OTA_REBOOT_DELAY_MS 5000        // lets the final report go out
+#define OTA_HASH_CHUNK      256         // running image bytes hashed per read
+#define OTA_DOWNLOAD_STACK  6144        // TLS handshake, applier and hash buffers
+
+enum OtaStatus
+{
+    OTA_IDLE,
+    OTA_DOWNLOADING,
+    OTA_REBOOTING,          // image handed to the bootloader
+    OTA_INSTALLED,          // running the image of the last update
+    OTA_FAILED,
+};
+
+static const char* const statusNames[] = { "idle", "downloading", "rebooting", "installed", "failed" };
+
+struct OtaJob
+{
+    uint32_t magic;
+    uint8_t status;
+    bool delta;
+    uint8_t attempts;               // of this version and url, this one included
+    char url[OTA_URL_MAX];
+    char version[OTA_VERSION_MAX];
+    uint8_t sha256[32];
+    uint8_t sourceSha256[32];       // of the running image, for a delta
+    uint32_t size;                  // new image bytes
+    uint32_t flashOffset;           // image bytes written to OTA_TEMP
+    mbedtls_sha256_context sha;     // over the bytes in flash
+    CRC16_Context crc;              // the bootloader checks this one
+    char error[32];
+    DeltaPatch patch;               // last: the writer snapshots the rest
+    uint32_t checksum;
+};
+
+// A page of image output and the applier state once it is in flash
+struct OtaPage
+{
+    uint8_t data[OTA_FLUSH_SIZE + OTA_PIECE_MAX];
+    size_t length;
+    DeltaPatch patch;
+};
+
+// A "firmware" desired property, parsed
+struct OtaRequest
+{
+    char url[OTA_URL_MAX];
+    char version[OTA_VERSION_MAX];
+    uint8_t sha256[32];
+    uint8_t sourceSha256[32];
+    bool delta;
+    int size;
+};
+
+// While a transfer runs, the download thread owns the applier (job.patch)
+// and the pages being filled, and the writer thread owns flashOffset, sha,
+// crc and saved. The loop thread only reads status and progress, and takes
+// the rest back once transferEnded is released.
+static OtaJob job;
+static RETAINED OtaJob saved;       // matches flash: the resume point
+
+static OtaPage pages[OTA_PAGES];
+static uint8_t flashPage[OTA_FLUSH_SIZE + OTA_PIECE_MAX];
+static OtaPage* filling = NULL;
+static uint8_t fillIndex = 0;
+static uint8_t writeIndex = 0;
+static volatile bool writerFailed = false;
+static uint32_t produced = 0;       // image bytes handed to pages (shared, see below)
+static Semaphore freePages(OTA_PAGES);
+static Semaphore queuedPages(0);
+static Thread writerThread(osPriorityBelowNormal, 1536);
+static Thread downloadThread(osPriorityBelowNormal, OTA_DOWNLOAD_STACK);
+static Semaphore transferStart(0);
+static Semaphore transferEnded(0);
+static bool threadsStarted = false;
+
+static bool transferRunning = false;
+static bool transferAbort = false;  // shared, see below
+static bool sourceMismatch = false;
+static bool transferFailed = false;
+static size_t transferBytes = 0;
+static uint32_t transferOffset = 0; // patch or image offset requested
+static uint32_t transferFlashed = 0;// image bytes in flash when it started
+static int transferStatus = 0;
+static OtaRequest pending;          // arrived while a transfer was running
+static bool hasPending = false;
+
+static unsigned long downloadStart = 0;
+static uint32_t downloadBytes = 0;  // received since downloadStart (shared, see below)
+static const char* caCert = NULL;
+static uint8_t retries = 0;
+static unsigned long nextAttempt = 0;
+static unsigned long rebootAt = 0;
+static int lastProgress = 0;
+
+// While a transfer runs, the download thread counts produced and
+// downloadBytes and polls transferAbort, and the loop thread reads the
+// counters and sets the flag: both sides go through a critical section.
+// Outside a transfer the loop thread owns them.
+
+static uint32_t sharedGet(const uint32_t* value)
+{
+    core_util_critical_section_enter();
+    uint32_t copy = *value;
+    core_util_critical_section_exit();
+    return copy;
+}
+
+static void sharedAdd(uint32_t* value, uint32_t add)
+{
+    core_util_critical_section_enter();
+    *value += add;
+    core_util_critical_section_exit();
+}
+
+static bool abortRequested()
+{
+    core_util_critical_section_enter();
+    bool abort = transferAbort;
+    core_util_critical_section_exit();
+    return abort;
+}
+
+static void requestAbort(bool abort)
+{
+    core_util_critical_section_enter();
+    transferAbort = abort;
+    core_util_critical_section_exit();
+}
+
+static uint32_t jobChecksum(const OtaJob* j)
+{
+    return retainedChecksum(j, offsetof(OtaJob, checksum));
+}
+
+static void save()
+{
+    job.checksum = jobChecksum(&job);
+    memcpy(&saved, &job, sizeof(saved));
+}
+
+static int progressPercent()
+{
+    return job.size ? (int)((uint64_t)sharedGet(&produced) * 100 / job.size) : 0;
+}
+
+static void report()
+{
+    char firmware[192];
+    char reported[208];
+    if (!otaReportJson(firmware, sizeof(firmware))) return;
+    snprintf(reported, sizeof(reported), "{\"firmware\":%s}", firmware);
+    outboundEnqueue(LANE_CONTROL, OUTBOUND_REPORTED, reported);
+}
+
+static void failJob(const char* reason)
+{
+    LOG_ERROR("OTA: %s", reason);
+    job.status = OTA_FAILED;
+    strncpy(job.error, reason, sizeof(job.error) - 1);
+    job.error[sizeof(job.error) - 1] = '\0';
+    save();
+    report();
+}
+
+// ===== IMAGE I/O =====
+
+static bool readRunningImage(uint32_t offset, uint8_t* data, size_t length)
+{
+    mico_logic_partition_t* info = MicoFlashGetInfo(MICO_PARTITION_APPLICATION);
+    if (info == NULL || (uint64_t)offset + length > info->partition_length) return false;
+    volatile uint32_t flashOffset = offset;
+    return MicoFlashRead(MICO_PARTITION_APPLICATION, &flashOffset, data, length) == kNoErr;
+}
+
+// ===== FLASH WRITER =====
+
+/**
+ * Program data at offset in OTA_TEMP. The resume point moves past a page
+ * only after it is programmed, so after a reset the page there may already
+ * be in flash, whole or in part: only bytes still erased are programmed,
+ * and any other difference fails the job (a retry erases the partition).
+ */
+static bool programFlash(uint32_t offset, const uint8_t* data, size_t length)
+{
+    volatile uint32_t readOffset = offset;
+    if (MicoFlashRead(MICO_PARTITION_OTA_TEMP, &readOffset, flashPage, length) != kNoErr) return false;
+    size_t i = 0;
+    while (i < length)
+    {
+        if (flashPage[i] == data[i])
+        {
+            i++;
+            continue;
+        }
+        if (flashPage[i] != 0xFF) return false;
+        size_t end = i;
+        while (end < length && flashPage[end] == 0xFF)
+        {
+            end++;
+        }
+        volatile uint32_t writeOffset = offset + i;
+        if (MicoFlashWrite(MICO_PARTITION_OTA_TEMP, &writeOffset, data + i, end - i) != kNoErr) return false;
+        i = end;
+    }
+    return true;
+}
+
+/**
+ * Program one page, fold it into the hashes and move the resume point past
+ * it. Runs on the writer thread while the next page fills.
+ */
+static bool commitPage(const OtaPage* page)
+{
+    if (!programFlash(job.flashOffset, page->data, page->length)) return false;
+    mbedtls_sha256_update(&job.sha, page->data, page->length);
+    CRC16_Update(&job.crc, page->data, page->length);
+    job.flashOffset += page->length;
+
+    // Everything but the live applier state, which is ahead of flash
+    memcpy(&saved, &job, offsetof(OtaJob, patch));
+    memcpy(&saved.patch, &page->patch, sizeof(saved.patch));
+    saved.checksum = jobChecksum(&saved);
+    return true;
+}
+
+static void writerLoop()
+{
+    while (true)
+    {
+        queuedPages.wait();
+        OtaPage* page = &pages[writeIndex];
+        writeIndex = (writeIndex + 1) % OTA_PAGES;
+        if (!writerFailed && !commitPage(page))
+        {
+            writerFailed = true;
+        }
+        freePages.release();
+    }
+}
+
+static void queuePage()
+{
+    memcpy(&filling->patch, &job.patch, sizeof(filling->patch));
+    filling = NULL;
+    queuedPages.release();
+}
+
+/**
+ * Wait until every queued page is in flash; a partly filled page is
+ * written too if keep is set, else dropped
+ */
+static void drainPages(bool keep)
+{
+    if (filling != NULL)
+    {
+        if (keep && filling->length > 0)
+        {
+            queuePage();
+        }
+        else
+        {
+            filling = NULL;
+            fillIndex = (fillIndex + OTA_PAGES - 1) % OTA_PAGES;
+            freePages.release();
+        }
+    }
+
+    // All pages back on the free list: the writer is idle
+    for (int i = 0; i < OTA_PAGES; i++)
+    {
+        freePages.wait();
+    }
+    for (int i = 0; i < OTA_PAGES; i++)
+    {
+        freePages.release();
+    }
+}
+
+static bool writeImage(const uint8_t* data, size_t length)
+{
+    if (writerFailed || produced + length > job.size) return false;
+    if (filling == NULL)
+    {
+        // Blocks only if the writer is a full page behind
+        freePages.wait();
+        filling = &pages[fillIndex];
+        fillIndex = (fillIndex + 1) % OTA_PAGES;
+        filling->length = 0;
+    }
+    memcpy(filling->data + filling->length, data, length);
+    filling->length += length;
+    sharedAdd(&produced, length);
+
+    // The applier state already accounts for everything in the page
+    if (filling->length >= OTA_FLUSH_SIZE)
+    {
+        queuePage();
+    }
+    return true;
+}
+
+/**
+ * Continue from the resume point, dropping whatever was not yet in flash
+ */
+static void restoreSaved()
+{
+    drainPages(false);
+    memcpy(&job, &saved, sizeof(job));
+    produced = job.flashOffset;
+    writerFailed = false;
+}
+
+// ===== DOWNLOAD =====
+
+/**
+ * Whether the first size bytes of the running image are the ones the
+ * patch was made from
+ */
+static bool verifySource(uint32_t size)
+{
+    uint8_t buffer[OTA_HASH_CHUNK];
+    uint8_t digest[32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t offset = 0; offset < size; offset += OTA_HASH_CHUNK)
+    {
+        size_t n = size - offset < OTA_HASH_CHUNK ? size - offset : OTA_HASH_CHUNK;
+        if (!readRunningImage(offset, buffer, n)) return false;
+        mbedtls_sha256_update(&sha, buffer, n);
+    }
+    mbedtls_sha256_finish(&sha, digest);
+    return memcmp(digest, job.sourceSha256, sizeof(digest)) == 0;
+}
+
+static bool feedPatch(const uint8_t* data, size_t length)
+{
+    // The header gives the source size: check the source before any output
+    if (job.patch.consumed < DELTA_PATCH_HEADER_SIZE)
+    {
+        size_t n = DELTA_PATCH_HEADER_SIZE - job.patch.consumed;
+        if (n > length) n = length;
+        if (!deltaPatchFeed(&job.patch, data, n, readRunningImage, writeImage)) return false;
+        data += n;
+        length -= n;
+        if (job.patch.consumed < DELTA_PATCH_HEADER_SIZE) return true;
+        if (!verifySource(deltaPatchSourceSize(&job.patch)))
+        {
+            sourceMismatch = true;
+            return false;
+        }
+    }
+    return deltaPatchFeed(&job.patch, data, length, readRunningImage, writeImage);
+}
+
+static void onBody(const char* data, size_t length)
+{
+    if (transferFailed || abortRequested()) return;
+    transferBytes += length;
+    sharedAdd(&downloadBytes, length);
+    const uint8_t* p = (const uint8_t*)data;
+    if (job.delta)
+    {
+        transferFailed = !feedPatch(p, length);
+        return;
+    }
+    while (length > 0)
+    {
+        size_t n = length < OTA_PIECE_MAX ? length : OTA_PIECE_MAX;
+        if (!writeImage(p, n))
+        {
+            transferFailed = true;
+            return;
+        }
+        p += n;
+        length -= n;
+    }
+}
+
+/**
+ * One request for everything from the resume point on, over one connection;
+ * otaLoop() picks up the result
+ */
+static void downloadLoop()
+{
+    while (true)
+    {
+        transferStart.wait();
+        char range[24];
+        snprintf(range, sizeof(range), "bytes=%lu-", (unsigned long)transferOffset);
+        {
+            HTTPClient client(caCert, HTTP_GET, job.url, onBody);
+            client.set_header("Range", range);
+            const Http_Response* response = client.send();
+            transferStatus = response != NULL ? response->status_code : 0;
+        }
+        transferEnded.release();
+    }
+}
+
+static void startThreads()
+{
+    if (threadsStarted) return;
+    threadsStarted = true;
+    writerThread.start(writerLoop);
+    downloadThread.start(downloadLoop);
+}
+
+static void startTransfer()
+{
+    transferOffset = job.delta ? job.patch.consumed : produced;
+    transferFailed = false;
+    transferBytes = 0;
+    transferStatus = 0;
+    sourceMismatch = false;
+    transferFlashed = produced;
+    transferRunning = true;
+    transferStart.release();
+}
+
+// ===== JOB =====
+
+static bool parseSha256(const char* hex, uint8_t* out)
+{
+    if (strlen(hex) != 64) return false;
+    for (int i = 0; i < 32; i++)
+    {
+        char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+        char* end;
+        out[i] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end != '\0') return false;
+    }
+    return true;
+}
+
+static bool parseRequest(const char* json, OtaRequest* request)
+{
+    char shaHex[65];
+    char from[OTA_VERSION_MAX];
+    memset(request, 0, sizeof(*request));
+    if (!jsonGetString(json, "version", request->version, sizeof(request->version))
+        || !jsonGetString(json, "url", request->url, sizeof(request->url))
+        || !jsonGetInt(json, "size", &request->size) || request->size <= 0
+        || !jsonGetString(json, "sha256", shaHex, sizeof(shaHex))
+        || !parseSha256(shaHex, request->sha256))
+    {
+        LOG_WARN("OTA: invalid firmware request");
+        return false;
+    }
+
+    request->delta = jsonGetString(json, "from", from, sizeof(from));
+    if (!request->delta) return true;
+    if (strcmp(from, FIRMWARE_VERSION) != 0)
+    {
+        LOG_WARN("OTA: patch for %s, running %s", from, FIRMWARE_VERSION);
+        return false;
+    }
+    // The version alone does not tell builds (profiles) apart
+    if (!jsonGetString(json, "fromSha256", shaHex, sizeof(shaHex)) || !parseSha256(shaHex, request->sourceSha256))
+    {
+        LOG_WARN("OTA: patch without fromSha256");
+        return false;
+    }
+    return true;
+}
+
+static int throughputTenths()
+{
+    unsigned long elapsed = millis() - downloadStart;
+    return elapsed ? (int)((uint64_t)sharedGet(&downloadBytes) * 10000 / 1024 / elapsed) : 0;
+}
+
+static void finish()
+{
+    drainPages(true);
+    if (writerFailed || job.flashOffset != job.size)
+    {
+        failJob("image incomplete");
+        return;
+    }
+    int rate = throughputTenths();
+    LOG_INFO("OTA: %lu bytes in %lu ms (%d.%d KB/s)", (unsigned long)downloadBytes,
+        millis() - downloadStart, rate / 10, rate % 10);
+
+    uint8_t digest[32];
+    mbedtls_sha256_context sha;
+    memcpy(&sha, &job.sha, sizeof(sha));
+    mbedtls_sha256_finish(&sha, digest);
+    if (memcmp(digest, job.sha256, sizeof(digest)) != 0)
+    {
+        failJob("sha256 mismatch");
+        return;
+    }
+
+    uint16_t crc;
+    CRC16_Final(&job.crc, &crc);
+    if (mico_ota_switch_to_new_fw(job.size, crc) != kNoErr)
+    {
+        failJob("bootloader switch failed");
+        return;
+    }
+
+    LOG_INFO("OTA: %s verified, rebooting in %d s", job.version, OTA_REBOOT_DELAY_MS / 1000);
+    job.status = OTA_REBOOTING;
+    save();
+    report();
+    rebootAt = millis() + OTA_REBOOT_DELAY_MS;
+}
+
+void otaInit()
+{
+    memset(&job, 0, sizeof(job));
+    if (saved.magic != OTA_MAGIC || saved.checksum != jobChecksum(&saved)) return;
+
+    memcpy(&job, &saved, sizeof(job));
+    produced = job.flashOffset;
+    if (job.status == OTA_REBOOTING)
+    {
+        // The reboot was ours; the bootloader should have installed the image
+        bool installed = strcmp(job.version, FIRMWARE_VERSION) == 0;
+        job.status = installed ? OTA_INSTALLED : OTA_FAILED;
+        if (!installed) strcpy(job.error, "not installed");
+        LOG_INFO("OTA: update to %s %s", job.version, installed ? "installed" : "not installed");
+        save();
+    }
+    else if (job.status == OTA_DOWNLOADING)
+    {
+        LOG_INFO("OTA: resuming %s at %lu of %lu bytes", job.version,
+            (unsigned long)job.flashOffset, (unsigned long)job.size);
+        lastProgress = progressPercent();
+        downloadStart = millis();
+        startThreads();
+    }
+}
+
+void otaSetCaCert(const char* pem)
+{
+    caCert = pem;
+}
+
+static bool startJob(const OtaRequest* request)
+{
+    // Already running it, already on it, or failed at it too often
+    if (strcmp(request->version, FIRMWARE_VERSION) == 0) return true;
+    bool same = job.status != OTA_IDLE && strcmp(job.version, request->version) == 0 && strcmp(job.url, request->url) == 0;
+    if (same && job.status != OTA_FAILED) return true;
+    if (same && job.attempts >= OTA_MAX_ATTEMPTS) return true;
+    uint8_t attempts = same ? job.attempts + 1 : 1;
+
+    mico_logic_partition_t* info = MicoFlashGetInfo(MICO_PARTITION_OTA_TEMP);
+    if (info == NULL || (uint32_t)request->size > info->partition_length)
+    {
+        LOG_WARN("OTA: image of %d bytes does not fit", request->size);
+        return false;
+    }
+
+    // A replaced download may still have pages in flight
+    drainPages(false);
+    writerFailed = false;
+    memset(&job, 0, sizeof(job));
+    job.magic = OTA_MAGIC;
+    job.status = OTA_DOWNLOADING;
+    job.delta = request->delta;
+    job.attempts = attempts;
+    strcpy(job.url, request->url);
+    strcpy(job.version, request->version);
+    memcpy(job.sha256, request->sha256, sizeof(job.sha256));
+    memcpy(job.sourceSha256, request->sourceSha256, sizeof(job.sourceSha256));
+    job.size = request->size;
+    deltaPatchInit(&job.patch);
+    mbedtls_sha256_init(&job.sha);
+    mbedtls_sha256_starts(&job.sha, 0);
+    CRC16_Init(&job.crc);
+
+    LOG_INFO("OTA: %s %s -> %s from %s (attempt %d)", job.delta ? "delta" : "full image", FIRMWARE_VERSION,
+        job.version, job.url, job.attempts);
+    watchdogKick();
+    MicoFlashErase(MICO_PARTITION_OTA_TEMP, 0, job.size);
+    watchdogKick();
+
+    produced = 0;
+    retries = 0;
+    lastProgress = 0;
+    nextAttempt = millis();
+    downloadStart = millis();
+    downloadBytes = 0;
+    save();
+    startThreads();
+    report();
+    return true;
+}
+
+bool otaRequest(const char* json)
+{
+    OtaRequest request;
+    if (!parseRequest(json, &request)) return false;
+
+    // The transfer cannot be cut short: drop the rest of its body and
+    // start this one when it ends, unless it is the same update
+    if (transferRunning)
+    {
+        if (strcmp(job.version, request.version) == 0 && strcmp(job.url, request.url) == 0) return true;
+        memcpy(&pending, &request, sizeof(pending));
+        hasPending = true;
+        requestAbort(true);
+        return true;
+    }
+    return startJob(&request);
+}
+
+/**
+ * Act on the end of a transfer: finished, or retry from the resume point
+ */
+static void endTransfer()
+{
+    transferRunning = false;
+    watchdogKick();
+    if (abortRequested())
+    {
+        // Back to a consistent job, in case the replacement does not start
+        restoreSaved();
+        return;
+    }
+
+    // 200 means the server sent the whole file: only usable from the start
+    int status = transferStatus;
+    bool complete = job.delta ? deltaPatchDone(&job.patch) : produced == job.size;
+    if (!transferFailed && !writerFailed && complete && (status == 206 || (status == 200 && transferOffset == 0)))
+    {
+        finish();
+        return;
+    }
+    if (sourceMismatch)
+    {
+        drainPages(false);
+        failJob("patch is for another image");
+        return;
+    }
+
+    // Only failures without progress in between count
+    restoreSaved();
+    if (produced > transferFlashed) retries = 0;
+    if (++retries >= OTA_MAX_RETRIES)
+    {
+        char reason[32];
+        snprintf(reason, sizeof(reason), "download failed (HTTP %d)", status);
+        failJob(reason);
+        return;
+    }
+    LOG_WARN("OTA: download stopped at %lu of %lu bytes (HTTP %d), retry %d", (unsigned long)produced,
+        (unsigned long)job.size, status, retries);
+    nextAttempt = millis() + (unsigned long)OTA_RETRY_MS * retries;
+}
+
+void otaLoop()
+{
+    if (job.status == OTA_REBOOTING)
+    {
+        if (rebootAt != 0 && (long)(millis() - rebootAt) >= 0)
+        {
+            logFlush();
+            NVIC_SystemReset();
+        }
+        return;
+    }
+    if (transferRunning && transferEnded.wait(0) > 0)
+    {
+        endTransfer();
+    }
+    if (!transferRunning && hasPending)
+    {
+        hasPending = false;
+        requestAbort(false);
+        startJob(&pending);
+    }
+    if (job.status != OTA_DOWNLOADING) return;
+    if (!transferRunning)
+    {
+        if ((long)(millis() - nextAttempt) >= 0) startTransfer();
+        return;
+    }
+
+    int progress = progressPercent();
+    if (progress / 10 != lastProgress / 10)
+    {
+        int rate = throughputTenths();
+        LOG_INFO("OTA: %d%% (%lu of %lu bytes, %d.%d KB/s)", progress,
+            (unsigned long)sharedGet(&produced), (unsigned long)job.size, rate / 10, rate % 10);
+        report();
+    }
+    lastProgress = progress;
+}
+
+bool otaInProgress()
+{
+    return job.status == OTA_DOWNLOADING || job.status == OTA_REBOOTING;
+}
+
+bool otaReportJson(char* buffer, size_t size)
+{
+    int n;
+    if (job.magic != OTA_MAGIC)
+    {
+        n = snprintf(buffer, size, "{\"current\":\"%s\",\"status\":\"idle\"}", FIRMWARE_VERSION);
+    }
+    else
+    {
+        int rate = job.status == OTA_DOWNLOADING ? throughputTenths() : 0;
+        n = snprintf(buffer, size, "{\"current\":\"%s\",\"target\":\"%s\",\"status\":\"%s\",\"progress\":%d,\"throughputKBps\":%d.%d,\"error\":\"%s\"}",
+            FIRMWARE_VERSION, job.version, statusNames[job.status], progressPercent(), rate / 10, rate % 10, job.error);
+    }
+    return n > 0 && (size_t)n < size;
+}
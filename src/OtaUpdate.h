@@ -0,0 +1,85 @@
+/*
+ * Over-the-air firmware update
+ *
+ * Driven by the "firmware" desired property:
+ *
+ *   "firmware": {
+ *     "version": "1.1.0",
+ *     "url": "http://192.168.1.10:8000/app-1.0.0-1.1.0.mxd",
+ *     "size": 412345,                  // bytes of the new image
+ *     "sha256": "9f86d0...",           // of the new image
+ *     "from": "1.0.0",                 // only for delta patches
+ *     "fromSha256": "2c26b4..."        // of the image the patch is for
+ *   }
+ *
+ * With "from" the download is a delta patch (tools/make_delta.py) applied
+ * against the running image as it streams in; without it, a full image.
+ * The running image is hashed against fromSha256 before the patch produces
+ * any output. A download thread fetches the new image into the OTA_TEMP
+ * partition with one HTTP Range request from the resume point to the end,
+ * so loop() and telemetry keep running. Output is double buffered: a
+ * writer thread programs and hashes one 512-byte page while the download
+ * fills the other. The resume point (patch offset, applier state, running
+ * hashes) is kept in retained RAM, so a dropped connection or a soft reset
+ * continues where it stopped. Once the SHA-256 matches, the bootloader is
+ * told to install the image and the device reboots. Progress is sent as
+ * the "firmware" reported property.
+ */
+
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stddef.h>
+
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION "1.0.0"
+#endif
+
+// Failed requests in a row, without progress in between, before the
+// update is abandoned
+#ifndef OTA_MAX_RETRIES
+#define OTA_MAX_RETRIES 5
+#endif
+
+// Times a failed update is started over when it is requested again
+#ifndef OTA_MAX_ATTEMPTS
+#define OTA_MAX_ATTEMPTS 3
+#endif
+
+/**
+ * Resume an update interrupted by a soft reset, or pick up the result of
+ * the one that caused the last reboot. Call once in setup().
+ */
+void otaInit();
+
+/**
+ * CA certificate (PEM) for https:// update URLs
+ */
+void otaSetCaCert(const char* pem);
+
+/**
+ * Start the update described by a "firmware" desired property object.
+ * The current job continues if it is the same update, and a failed one
+ * starts over (up to OTA_MAX_ATTEMPTS times); nothing happens if the
+ * version is already running. A new update waits for the running request
+ * to end. Returns false if the request is invalid.
+ */
+bool otaRequest(const char* firmwareJson);
+
+/**
+ * Start or retry the download, report progress, and verify the image once
+ * it is in; reboots into the new image when done. Call from loop() while
+ * WiFi is up.
+ */
+void otaLoop();
+
+bool otaInProgress();
+
+/**
+ * The "firmware" reported property, e.g.
+ * {"current":"1.0.0","target":"1.1.0","status":"downloading","progress":42,
+ *  "throughputKBps":21.5,"error":""}
+ */
+bool otaReportJson(char* buffer, size_t size);
+
+#endif // OTA_UPDATE_H
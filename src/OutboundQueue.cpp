@@ -0,0 +1,317 @@
+/*
+ * Outbound message queue with priority lanes
+ */
+
+#include <Arduino.h>
+#include "AzureIoTHub.h"
+
+#include "Log.h"
+#include "MessageProperties.h"
+#include "OutboundQueue.h"
+#include "Trace.h"
+#include "Watchdog.h"
+
+// A message in a lane's ring: this header, the payload and a NUL, the
+// properties and a NUL, padded to OUTBOUND_ALIGN
+struct OutboundMessage
+{
+    uint16_t size;                      // bytes taken in the ring, header included
+    uint16_t length;                    // payload bytes
+    uint8_t kind;
+    uint8_t attempts;
+    uint8_t reserved[2];
+};
+
+#define OUTBOUND_ALIGN 4
+
+struct LaneConfig
+{
+    const char* name;
+    uint16_t bytes;         // ring size
+    uint16_t perMinute;     // sustained rate
+    uint8_t burst;          // bucket size
+};
+
+static const LaneConfig laneConfig[LANE_COUNT] = {
+    { "alert",     OUTBOUND_ALERT_BYTES,     20, 5 },
+    { "control",   OUTBOUND_CONTROL_BYTES,   30, 10 },
+    { "telemetry", OUTBOUND_TELEMETRY_BYTES, 60, 5 },
+    { "backlog",   OUTBOUND_BACKLOG_BYTES,   20, 2 },
+};
+
+// A message costs TOKEN_COST units and a lane earns perMinute units per ms,
+// i.e. perMinute messages per minute without any division
+#define TOKEN_COST 60000UL
+
+// Messages are kept in order in the lane's ring. One that does not fit
+// between the tail and the end of the ring starts again at offset 0, and
+// the ring then ends at "end" until the head has passed it.
+struct Lane
+{
+    uint8_t* ring;
+    uint16_t head;          // oldest message
+    uint16_t tail;          // where the next one goes
+    uint16_t end;           // end of the messages when wrapped, else the ring size
+    bool wrapped;           // tail is below head
+    uint8_t count;
+    unsigned long tokens;
+    unsigned long lastRefill;
+    unsigned long dropped;
+};
+
+static uint8_t storage[OUTBOUND_ALERT_BYTES + OUTBOUND_CONTROL_BYTES + OUTBOUND_TELEMETRY_BYTES + OUTBOUND_BACKLOG_BYTES]
+    __attribute__((aligned(OUTBOUND_ALIGN)));
+static Lane lanes[LANE_COUNT];
+static bool initialized = false;
+
+static void reset(Lane& lane, uint16_t bytes)
+{
+    lane.head = 0;
+    lane.tail = 0;
+    lane.end = bytes;
+    lane.wrapped = false;
+}
+
+static void init()
+{
+    if (initialized) return;
+    initialized = true;
+    int offset = 0;
+    for (int i = 0; i < LANE_COUNT; i++)
+    {
+        lanes[i].ring = &storage[offset];
+        reset(lanes[i], laneConfig[i].bytes);
+        lanes[i].tokens = laneConfig[i].burst * TOKEN_COST;
+        lanes[i].lastRefill = millis();
+        offset += laneConfig[i].bytes;
+    }
+}
+
+/**
+ * Add the tokens earned since the last refill, capped at the burst size
+ */
+static void refill(int laneIndex)
+{
+    Lane& lane = lanes[laneIndex];
+    unsigned long now = millis();
+    unsigned long elapsed = now - lane.lastRefill;
+    lane.lastRefill = now;
+    unsigned long max = laneConfig[laneIndex].burst * TOKEN_COST;
+    unsigned long add = elapsed > TOKEN_COST ? max : elapsed * laneConfig[laneIndex].perMinute;
+    lane.tokens = (max - lane.tokens < add) ? max : lane.tokens + add;
+}
+
+static size_t messageSize(size_t length, size_t propsLength)
+{
+    size_t size = sizeof(OutboundMessage) + length + 1 + propsLength + 1;
+    return (size + OUTBOUND_ALIGN - 1) & ~(size_t)(OUTBOUND_ALIGN - 1);
+}
+
+static char* payloadOf(OutboundMessage& message)
+{
+    return (char*)(&message + 1);
+}
+
+static char* propsOf(OutboundMessage& message)
+{
+    return payloadOf(message) + message.length + 1;
+}
+
+static OutboundMessage& front(int laneIndex)
+{
+    Lane& lane = lanes[laneIndex];
+    return *(OutboundMessage*)(lane.ring + lane.head);
+}
+
+static void popFront(int laneIndex)
+{
+    Lane& lane = lanes[laneIndex];
+    lane.head += front(laneIndex).size;
+    lane.count--;
+    if (lane.count == 0)
+    {
+        reset(lane, laneConfig[laneIndex].bytes);
+    }
+    else if (lane.wrapped && lane.head >= lane.end)
+    {
+        lane.head = 0;
+        lane.end = laneConfig[laneIndex].bytes;
+        lane.wrapped = false;
+    }
+}
+
+/**
+ * Take size bytes at the tail, or NULL if they are not free
+ */
+static OutboundMessage* allocate(int laneIndex, size_t size)
+{
+    Lane& lane = lanes[laneIndex];
+    uint16_t at;
+    if (lane.wrapped)
+    {
+        if ((size_t)(lane.head - lane.tail) < size) return NULL;
+        at = lane.tail;
+    }
+    else if ((size_t)(laneConfig[laneIndex].bytes - lane.tail) >= size)
+    {
+        at = lane.tail;
+    }
+    else if (lane.head >= size && lane.count > 0)
+    {
+        lane.end = lane.tail;
+        lane.wrapped = true;
+        at = 0;
+    }
+    else
+    {
+        return NULL;
+    }
+    lane.tail = at + size;
+    lane.count++;
+    OutboundMessage* message = (OutboundMessage*)(lane.ring + at);
+    message->size = (uint16_t)size;
+    return message;
+}
+
+/**
+ * Reserve size bytes at the tail, making room if the lane is full; NULL if
+ * the message is larger than the lane
+ */
+static OutboundMessage* pushBack(int laneIndex, size_t size)
+{
+    if (size > laneConfig[laneIndex].bytes) return NULL;
+    OutboundMessage* message;
+    while ((message = allocate(laneIndex, size)) == NULL)
+    {
+        OutboundMessage& oldest = front(laneIndex);
+        if (laneIndex == LANE_TELEMETRY)
+        {
+            // Demote rather than drop; the backlog drops its own oldest if full
+            OutboundMessage* demoted = pushBack(LANE_BACKLOG, oldest.size);
+            if (demoted != NULL) memcpy(demoted, &oldest, oldest.size);
+        }
+        else
+        {
+            lanes[laneIndex].dropped++;
+            LOG_WARN("Outbound: %s lane full, dropped oldest", laneConfig[laneIndex].name);
+        }
+        popFront(laneIndex);
+    }
+    return message;
+}
+
+/**
+ * Fill a message reserved by pushBack()
+ */
+static void fill(OutboundMessage* message, OutboundKind kind, const char* payload, size_t length, const char* props)
+{
+    message->length = (uint16_t)length;
+    message->kind = (uint8_t)kind;
+    message->attempts = 0;
+    memcpy(payloadOf(*message), payload, length);
+    payloadOf(*message)[length] = '\0';
+    strcpy(propsOf(*message), props);
+}
+
+bool outboundEnqueue(OutboundLane lane, OutboundKind kind, const char* payload, const char* props)
+{
+    init();
+    size_t length = strlen(payload);
+    if (props && strlen(props) >= OUTBOUND_PROPS_MAX)
+    {
+        LOG_ERROR("Outbound: properties too large for %s lane", laneConfig[lane].name);
+        return false;
+    }
+
+    if (props == NULL) props = "";
+    OutboundMessage* message = pushBack(lane, messageSize(length, strlen(props)));
+    if (message == NULL)
+    {
+        LOG_ERROR("Outbound: message too large for %s lane", laneConfig[lane].name);
+        return false;
+    }
+    fill(message, kind, payload, length, props);
+    return true;
+}
+
+static bool sendMessage(OutboundMessage& message)
+{
+    const char* payload = payloadOf(message);
+    const char* props = propsOf(message);
+    if (message.kind == OUTBOUND_REPORTED)
+    {
+        return azureIoTUpdateReportedProperties(payload);
+    }
+
+    TRACE_BEGIN(PUBLISH);
+    bool sent = azureIoTSendTelemetry(payload, props[0] ? props : NULL);
+    TRACE_END(PUBLISH, sent ? message.length : 0);
+    return sent;
+}
+
+int outboundService(bool connected)
+{
+    init();
+    for (int i = 0; i < LANE_COUNT; i++)
+    {
+        refill(i);
+    }
+    if (!connected) return 0;
+
+    int sent = 0;
+    while (sent < OUTBOUND_BURST)
+    {
+        // Highest priority lane with a message and a token
+        int laneIndex = -1;
+        for (int i = 0; i < LANE_COUNT; i++)
+        {
+            if (lanes[i].count > 0 && lanes[i].tokens >= TOKEN_COST)
+            {
+                laneIndex = i;
+                break;
+            }
+        }
+        if (laneIndex < 0) break;
+
+        Lane& lane = lanes[laneIndex];
+        OutboundMessage& message = front(laneIndex);
+        if (!sendMessage(message))
+        {
+            if (++message.attempts >= OUTBOUND_MAX_ATTEMPTS)
+            {
+                LOG_WARN("Outbound: dropping %s message after %d attempts",
+                    laneConfig[laneIndex].name, message.attempts);
+                lane.dropped++;
+                popFront(laneIndex);
+            }
+            break;  // retry on a later pass
+        }
+
+        lane.tokens -= TOKEN_COST;
+        popFront(laneIndex);
+        watchdogCheckIn(WDT_PUBLISHER);
+        sent++;
+    }
+    return sent;
+}
+
+int outboundDepth(OutboundLane lane)
+{
+    init();
+    return lanes[lane].count;
+}
+
+bool outboundIdle()
+{
+    init();
+    for (int i = 0; i < LANE_COUNT; i++)
+    {
+        if (lanes[i].count > 0) return false;
+    }
+    return true;
+}
+
+unsigned long outboundDropped(OutboundLane lane)
+{
+    return lanes[lane].dropped;
+}
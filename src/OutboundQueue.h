@@ -0,0 +1,109 @@
+/*
+ * Outbound message queue with priority lanes
+ *
+ * Everything the device sends goes through one of four lanes, drained
+ * strictly in priority order, with two exceptions that publish directly:
+ * the latency probes (LatencyProbe.h), which are timed from the publish
+ * and so must not wait in a queue, and the trace upload (Trace.h), whose
+ * parts are together larger than any lane and only sent on request. The
+ * lanes:
+ *
+ *   LANE_ALERT      edge alerts
+ *   LANE_CONTROL    command responses and twin (reported property) acks
+ *   LANE_TELEMETRY  regular telemetry, newest samples
+ *   LANE_BACKLOG    older telemetry pushed out of LANE_TELEMETRY while the
+ *                   hub was unreachable, replayed last
+ *
+ * Each lane has a token-bucket rate limit so a burst in one lane (e.g.
+ * backlog replay after a reconnect) cannot monopolize the connection or
+ * trip IoT Hub throttling. Messages wait in RAM while disconnected, each
+ * lane in a byte ring of its own size (OUTBOUND_*_BYTES).
+ */
+
+#ifndef OUTBOUND_QUEUE_H
+#define OUTBOUND_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes of RAM per lane. Messages take their own size (plus about 12
+// bytes), so a lane holds many short alerts or a few large reports; when
+// a new message does not fit, the oldest make room for it.
+#ifndef OUTBOUND_ALERT_BYTES
+#define OUTBOUND_ALERT_BYTES 1024
+#endif
+
+#ifndef OUTBOUND_CONTROL_BYTES
+#define OUTBOUND_CONTROL_BYTES 2048
+#endif
+
+#ifndef OUTBOUND_TELEMETRY_BYTES
+#define OUTBOUND_TELEMETRY_BYTES 2048
+#endif
+
+#ifndef OUTBOUND_BACKLOG_BYTES
+#define OUTBOUND_BACKLOG_BYTES 4096
+#endif
+
+// Longest property string, NUL included: the system properties plus a
+// flag for every active rule (checked in Rules.h). Only its actual length
+// is stored in a lane.
+#ifndef OUTBOUND_PROPS_MAX
+#define OUTBOUND_PROPS_MAX 448
+#endif
+
+// Messages sent per outboundService() call at most
+#ifndef OUTBOUND_BURST
+#define OUTBOUND_BURST 4
+#endif
+
+// Send attempts before a message is dropped
+#ifndef OUTBOUND_MAX_ATTEMPTS
+#define OUTBOUND_MAX_ATTEMPTS 3
+#endif
+
+enum OutboundLane
+{
+    LANE_ALERT,
+    LANE_CONTROL,
+    LANE_TELEMETRY,
+    LANE_BACKLOG,
+    LANE_COUNT
+};
+
+enum OutboundKind
+{
+    OUTBOUND_TELEMETRY,     // telemetry, props URL-encoded (see MessageProperties.h)
+    OUTBOUND_REPORTED,      // azureIoTUpdateReportedProperties(payload)
+};
+
+/**
+ * Queue a message. A full LANE_TELEMETRY moves its oldest message to
+ * LANE_BACKLOG; any other full lane drops its oldest message.
+ * Returns false if the message is larger than the lane.
+ */
+bool outboundEnqueue(OutboundLane lane, OutboundKind kind, const char* payload, const char* props = NULL);
+
+/**
+ * Send queued messages, highest priority lane first, within each lane's
+ * rate limit. Call from loop(); does nothing while disconnected.
+ * Returns the number of messages accepted by the hub.
+ */
+int outboundService(bool connected);
+
+/**
+ * Messages waiting in a lane
+ */
+int outboundDepth(OutboundLane lane);
+
+/**
+ * No message waiting in any lane
+ */
+bool outboundIdle();
+
+/**
+ * Messages dropped from a lane (overflow or repeated send failure)
+ */
+unsigned long outboundDropped(OutboundLane lane);
+
+#endif // OUTBOUND_QUEUE_H
@@ -0,0 +1,37 @@
+/*
+ * Code placement for the performance builds
+ *
+ * Functions tagged HOT_PATH run for every byte on the receive path. In the
+ * *_perf environments (PERF_PLACEMENT=1) they go to .data_hot_path. The
+ * linker script's *(.data*) collects that into .data, which the startup
+ * code copies to SRAM, so they execute without flash wait states or ART
+ * cache misses. GCC also optimizes them harder. Calls
+ * between flash and SRAM are too far for a BL and go through linker
+ * veneers, so tag only self-contained loops and the helpers they call:
+ * not entry points that return straight away, and not code that spends its
+ * time in library calls such as snprintf(), which stay in flash.
+ *
+ * Functions tagged COLD_PATH run once or rarely (setup, banners, the
+ * connect report, diagnostics). GCC optimizes them for size, moves them to
+ * .text.unlikely away from the hot code, and treats branches to them as
+ * unlikely.
+ *
+ * Both are empty in the default builds.
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#ifndef PERF_PLACEMENT
+#define PERF_PLACEMENT 0
+#endif
+
+#if PERF_PLACEMENT
+#define HOT_PATH __attribute__((hot, section(".data_hot_path")))
+#define COLD_PATH __attribute__((cold))
+#else
+#define HOT_PATH
+#define COLD_PATH
+#endif
+
+#endif // PLACEMENT_H
@@ -0,0 +1,38 @@
+/*
+ * IoT Plug and Play conventions
+ */
+
+#include <Arduino.h>
+
+#include "PnP.h"
+
+bool pnpActive()
+{
+    return PNP_ENABLED != 0;
+}
+
+/**
+ * "name":value, inside "component":{"__t":"c",...} for a component
+ */
+static int wrap(char* buffer, size_t size, const char* component, const char* name, const char* value)
+{
+    int n = component != NULL && pnpActive()
+        ? snprintf(buffer, size, "\"%s\":{\"__t\":\"c\",\"%s\":%s}", component, name, value)
+        : snprintf(buffer, size, "\"%s\":%s", name, value);
+    return n >= 0 && (size_t)n < size ? n : -1;
+}
+
+int pnpWritableAck(char* buffer, size_t size, const char* component, const char* name,
+    const char* valueJson, int status, int version, const char* description)
+{
+    if (!pnpActive())
+    {
+        return wrap(buffer, size, component, name, valueJson);
+    }
+
+    char ack[128];
+    int n = snprintf(ack, sizeof(ack), "{\"value\":%s,\"ac\":%d,\"av\":%d,\"ad\":\"%s\"}",
+        valueJson, status, version, description);
+    if (n < 0 || (size_t)n >= sizeof(ack)) return -1;
+    return wrap(buffer, size, component, name, ack);
+}
@@ -0,0 +1,48 @@
+/*
+ * IoT Plug and Play conventions
+ *
+ * Built with -DPNP_ENABLED=1, the payloads follow the model in
+ * TELEMETRY_MODEL_ID (tools/telemetry_schema.py dtdl), so a backend that
+ * has the device mapped to it ingests them typed instead of guessing at
+ * generic JSON:
+ *
+ *   telemetry   one message per component, named by $.sub:
+ *               $.sub=environmental  {"temperature":25.30,"humidity":45.20,...}
+ *   acks        writable properties are acknowledged with status and version,
+ *               inside a "__t":"c" marked object for a component:
+ *               {"alertsOnly":{"value":true,"ac":200,"av":7,"ad":"applied"}}
+ *
+ * Otherwise the ack is the plain form used before ("name":value), so
+ * callers do not need to care which applies.
+ *
+ * The framework has no way to send the model ID (model-id in the MQTT
+ * username, "modelId" in the DPS registration), so the hub does not learn
+ * it from the device: assign the model to the device in IoT Central or
+ * IoT Explorer.
+ */
+
+#ifndef PNP_H
+#define PNP_H
+
+#include <stddef.h>
+
+// Build with -DPNP_ENABLED=1 to send payloads in the model's form
+#ifndef PNP_ENABLED
+#define PNP_ENABLED 0
+#endif
+
+/**
+ * Whether payloads follow the model
+ */
+bool pnpActive();
+
+/**
+ * Reported member acknowledging a writable property of the root interface
+ * (component NULL) or of a component. valueJson is already JSON, status an
+ * HTTP-style code (200 applied, 400 rejected), version the desired $version
+ * it answers. Returns the length written, or -1 if it does not fit.
+ */
+int pnpWritableAck(char* buffer, size_t size, const char* component, const char* name,
+    const char* valueJson, int status, int version, const char* description);
+
+#endif // PNP_H
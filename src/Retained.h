@@ -0,0 +1,34 @@
+/*
+ * Retained RAM helpers
+ *
+ * Variables tagged RETAINED are placed in the .noinit section, which the
+ * startup code neither zeroes nor initializes. Their contents survive soft
+ * resets (NVIC_SystemReset, watchdog, reset button) but are garbage after a
+ * power-on, so every retained block carries a magic number and checksum and
+ * must be validated before use.
+ */
+
+#ifndef RETAINED_H
+#define RETAINED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RETAINED __attribute__((section(".noinit")))
+
+/**
+ * FNV-1a checksum over a retained block (exclude the checksum field itself)
+ */
+static inline uint32_t retainedChecksum(const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#endif // RETAINED_H
@@ -0,0 +1,285 @@
+/*
+ * Edge rules engine
+ */
+
+#include <Arduino.h>
+#include <ctype.h>
+
+#include "JsonLite.h"
+#include "Log.h"
+#include "Rules.h"
+#include "Telemetry.h"
+
+enum RuleOp
+{
+    RULE_OP_GT,
+    RULE_OP_LT,
+    RULE_OP_RATE_GT,
+    RULE_OP_RATE_LT,
+};
+
+struct Rule
+{
+    // Compiled from JSON
+    char id[RULE_ID_MAX];
+    uint8_t sensor;                 // telemetry channel
+    uint8_t op;
+    uint16_t holdSeconds;
+    float threshold;
+    float hysteresis;
+
+    // Evaluation state
+    bool active;
+    bool hasPrevious;
+    bool pending;                   // condition met, waiting out "for"
+    unsigned long conditionSince;
+    unsigned long previousMillis;
+    float previousValue;
+};
+
+static Rule rules[RULES_MAX];
+static int ruleCount = 0;
+
+// Active rules a commit removed or changed; their "cleared" events go out
+// with the next evaluation
+static Rule retired[RULES_MAX];
+static int retiredCount = 0;
+
+/**
+ * Compile one rule object; returns false if it is malformed
+ */
+static bool compileRule(const char* json, Rule* rule)
+{
+    memset(rule, 0, sizeof(*rule));
+
+    char sensor[24];
+    char op[8];
+    if (!jsonGetString(json, "id", rule->id, sizeof(rule->id))
+        || !jsonGetString(json, "sensor", sensor, sizeof(sensor))
+        || !jsonGetString(json, "op", op, sizeof(op))
+        || !jsonGetNumber(json, "value", &rule->threshold))
+    {
+        return false;
+    }
+
+    // The id becomes a message property name, so keep it URL-safe
+    for (const char* c = rule->id; *c; c++)
+    {
+        if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-') return false;
+    }
+
+    int channel = telemetryChannelFind(sensor);
+    if (channel < 0) return false;
+    rule->sensor = (uint8_t)channel;
+
+    if (strcmp(op, ">") == 0) rule->op = RULE_OP_GT;
+    else if (strcmp(op, "<") == 0) rule->op = RULE_OP_LT;
+    else if (strcmp(op, "rate>") == 0) rule->op = RULE_OP_RATE_GT;
+    else if (strcmp(op, "rate<") == 0) rule->op = RULE_OP_RATE_LT;
+    else return false;
+
+    int holdSeconds = 0;
+    jsonGetNumber(json, "hysteresis", &rule->hysteresis);
+    jsonGetInt(json, "for", &holdSeconds);
+    if (rule->hysteresis < 0 || holdSeconds < 0 || holdSeconds > 0xFFFF) return false;
+    rule->holdSeconds = (uint16_t)holdSeconds;
+    return true;
+}
+
+// Table being built; replaces the active one on commit
+static Rule pending[RULES_MAX];
+static int pendingCount = 0;
+static bool pendingValid = false;
+
+void rulesBuildBegin()
+{
+    pendingCount = 0;
+    pendingValid = true;
+}
+
+bool rulesBuildAdd(const char* ruleJson)
+{
+    if (!pendingValid) return false;
+    if (ruleJson == NULL || pendingCount == RULES_MAX)
+    {
+        LOG_WARN("Rules: too many rules or rule too long (max %d)", RULES_MAX);
+        pendingValid = false;
+        return false;
+    }
+    if (!compileRule(ruleJson, &pending[pendingCount]))
+    {
+        LOG_WARN("Rules: invalid rule %d: %s", pendingCount, ruleJson);
+        pendingValid = false;
+        return false;
+    }
+    pendingCount++;
+    return true;
+}
+
+static bool sameDefinition(const Rule& a, const Rule& b)
+{
+    return strcmp(a.id, b.id) == 0 && a.sensor == b.sensor && a.op == b.op
+        && a.holdSeconds == b.holdSeconds && a.threshold == b.threshold && a.hysteresis == b.hysteresis;
+}
+
+bool rulesBuildCommit()
+{
+    if (!pendingValid) return false;
+    pendingValid = false;
+
+    // The twin is delivered again on every connection: a rule that did not
+    // change keeps its state, so it is neither raised again nor left
+    // without its "cleared"
+    int kept = 0;
+    retiredCount = 0;
+    for (int i = 0; i < ruleCount; i++)
+    {
+        int match = -1;
+        for (int j = 0; j < pendingCount && match < 0; j++)
+        {
+            if (sameDefinition(rules[i], pending[j])) match = j;
+        }
+        if (match >= 0)
+        {
+            Rule& rule = pending[match];
+            rule.active = rules[i].active;
+            rule.hasPrevious = rules[i].hasPrevious;
+            rule.pending = rules[i].pending;
+            rule.conditionSince = rules[i].conditionSince;
+            rule.previousMillis = rules[i].previousMillis;
+            rule.previousValue = rules[i].previousValue;
+            kept++;
+        }
+        else if (rules[i].active)
+        {
+            retired[retiredCount++] = rules[i];
+        }
+    }
+    memcpy(rules, pending, sizeof(Rule) * pendingCount);
+    ruleCount = pendingCount;
+    LOG_INFO("Rules: %d loaded, %d unchanged", ruleCount, kept);
+    return true;
+}
+
+bool rulesLoad(const char* rulesJson)
+{
+    const char* end;
+    const char* element = rulesJson;
+    if (*element != '[') return false;
+
+    rulesBuildBegin();
+    while ((element = jsonArrayNext(element, &end)) != NULL)
+    {
+        char ruleJson[RULE_JSON_MAX];
+        size_t len = end - element;
+        bool fits = len < sizeof(ruleJson);
+        if (fits)
+        {
+            memcpy(ruleJson, element, len);
+            ruleJson[len] = '\0';
+        }
+        if (!rulesBuildAdd(fits ? ruleJson : NULL)) return false;
+        element = end;
+    }
+    return rulesBuildCommit();
+}
+
+void rulesLoadDefaults()
+{
+    rulesLoad("[{\"id\":\"temperatureAlert\",\"sensor\":\"temperature\",\"op\":\">\",\"value\":30}]");
+}
+
+int rulesEvaluate(const SensorSample& sample, RuleEvent* events, int maxEvents)
+{
+    int eventCount = 0;
+    for (int i = 0; i < retiredCount && eventCount < maxEvents; i++)
+    {
+        RuleEvent& event = events[eventCount++];
+        event.id = retired[i].id;
+        event.sensor = telemetryChannelName(retired[i].sensor);
+        event.value = telemetryChannelValue(sample, retired[i].sensor);
+        event.threshold = retired[i].threshold;
+        event.raised = false;
+    }
+    retiredCount = 0;
+
+    for (int i = 0; i < ruleCount; i++)
+    {
+        Rule& rule = rules[i];
+        // A sensor not read this time (disabled or a slower rate) has nothing new
+        if (!telemetryChannelFresh(sample, rule.sensor)) continue;
+        float value = telemetryChannelValue(sample, rule.sensor);
+
+        if (rule.op == RULE_OP_RATE_GT || rule.op == RULE_OP_RATE_LT)
+        {
+            float previous = rule.previousValue;
+            unsigned long elapsed = sample.millis - rule.previousMillis;
+            bool hadPrevious = rule.hasPrevious;
+            rule.previousValue = value;
+            rule.previousMillis = sample.millis;
+            rule.hasPrevious = true;
+            if (!hadPrevious || elapsed == 0) continue;
+            value = (value - previous) * 1000.0f / elapsed;
+        }
+
+        bool greater = rule.op == RULE_OP_GT || rule.op == RULE_OP_RATE_GT;
+        bool raise = greater ? value > rule.threshold : value < rule.threshold;
+        bool clear = greater ? value <= rule.threshold - rule.hysteresis
+                             : value >= rule.threshold + rule.hysteresis;
+
+        bool transition = false;
+        if (!rule.active)
+        {
+            if (!raise)
+            {
+                rule.pending = false;
+                continue;
+            }
+            if (!rule.pending)
+            {
+                rule.pending = true;
+                rule.conditionSince = sample.millis;
+            }
+            if (sample.millis - rule.conditionSince >= (unsigned long)rule.holdSeconds * 1000)
+            {
+                rule.active = true;
+                rule.pending = false;
+                transition = true;
+            }
+        }
+        else if (clear)
+        {
+            rule.active = false;
+            transition = true;
+        }
+
+        if (transition && eventCount < maxEvents)
+        {
+            RuleEvent& event = events[eventCount++];
+            event.id = rule.id;
+            event.sensor = telemetryChannelName(rule.sensor);
+            event.value = value;
+            event.threshold = rule.threshold;
+            event.raised = rule.active;
+        }
+    }
+    return eventCount;
+}
+
+bool rulesActiveProperties(MessageProperties* props)
+{
+    for (int i = 0; i < ruleCount; i++)
+    {
+        if (rules[i].active && !messagePropertiesAdd(props, rules[i].id, "true"))
+        {
+            LOG_ERROR("Rules: no room for the %s property", rules[i].id);
+            return false;
+        }
+    }
+    return true;
+}
+
+int rulesCount()
+{
+    return ruleCount;
+}
@@ -0,0 +1,103 @@
+/*
+ * Edge rules engine
+ *
+ * Alert rules arrive as the "rules" desired property and are compiled into
+ * a fixed table (sensor index, operator, thresholds) that is evaluated
+ * against every sample in bounded time - at most RULES_MAX rules, O(1) work
+ * each, no allocation.
+ *
+ *   "rules": [
+ *     {"id":"hot",  "sensor":"temperature", "op":">", "value":30, "hysteresis":1, "for":10},
+ *     {"id":"rise", "sensor":"temperature", "op":"rate>", "value":0.5},
+ *     {"id":"bump", "sensor":"accelerometer.z", "op":"<", "value":500}
+ *   ]
+ *
+ * op:         ">" / "<" compare the reading; "rate>" / "rate<" compare its
+ *             change per second since the previous sample
+ * hysteresis: the rule clears only once the value is this far back across
+ *             the threshold (default 0)
+ * for:        seconds the condition must hold before the rule fires
+ *             (default 0)
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <stddef.h>
+
+#include "MessageProperties.h"
+#include "SensorSample.h"
+
+#ifndef RULES_MAX
+#define RULES_MAX 16
+#endif
+
+#define RULE_ID_MAX 16
+
+// Most transitions one rulesEvaluate() can report: every rule, plus the
+// "cleared" of every active rule a reload removed
+#define RULES_EVENTS_MAX (2 * RULES_MAX)
+
+// Longest JSON text of a single rule object
+#define RULE_JSON_MAX 192
+
+// Longest rulesActiveProperties() output: "&<id>=true" for every rule
+// (ids are URL-safe, so not expanded by encoding)
+#define RULES_PROPS_MAX (RULES_MAX * (RULE_ID_MAX + 5))
+
+// The system properties of a telemetry message ($.ct, $.ce, $.mid, $.sub)
+// take under 112 bytes; the rule flags must fit after them
+#if OUTBOUND_PROPS_MAX < 112 + RULES_PROPS_MAX
+#error "OUTBOUND_PROPS_MAX too small for the active rule properties"
+#endif
+
+struct RuleEvent
+{
+    const char* id;
+    const char* sensor;
+    float value;            // reading (or rate) that caused the transition
+    float threshold;
+    bool raised;            // true: rule fired, false: rule cleared
+};
+
+/**
+ * Compile a JSON array of rules, replacing the current table. On any error
+ * the current table is kept and false is returned.
+ */
+bool rulesLoad(const char* rulesJson);
+
+/**
+ * Build a table one rule at a time, e.g. while a large twin is parsed
+ * incrementally. The active table is only replaced by a commit after every
+ * rule was accepted; a NULL ruleJson (too long to capture) fails the build.
+ * Rules whose id and definition did not change keep their state (active,
+ * hold and rate timers); an active rule that was removed or changed is
+ * reported cleared by the next rulesEvaluate().
+ */
+void rulesBuildBegin();
+bool rulesBuildAdd(const char* ruleJson);
+bool rulesBuildCommit();
+
+/**
+ * Built-in rule used until rules are delivered: temperatureAlert, temperature > 30
+ */
+void rulesLoadDefaults();
+
+/**
+ * Evaluate all rules against a sample. Writes up to maxEvents transitions
+ * into events and returns how many were written.
+ */
+int rulesEvaluate(const SensorSample& sample, RuleEvent* events, int maxEvents);
+
+/**
+ * Add a property for each active rule, e.g. hot=true&rise=true.
+ * Returns false (and logs) if one did not fit in props.
+ */
+bool rulesActiveProperties(MessageProperties* props);
+
+/**
+ * Number of rules in the table
+ */
+int rulesCount();
+
+#endif // RULES_H
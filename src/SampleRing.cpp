@@ -0,0 +1,113 @@
+/*
+ * Shared ring of sensor samples
+ */
+
+#include <Arduino.h>
+
+#include "Log.h"
+#include "SampleRing.h"
+
+#if SAMPLE_RING_CAPACITY & (SAMPLE_RING_CAPACITY - 1)
+#error "SAMPLE_RING_CAPACITY must be a power of two"
+#endif
+
+struct SampleSlot
+{
+    SensorSample sample;
+} __attribute__((aligned(SAMPLE_RING_ALIGN)));
+
+struct SampleCursor
+{
+    uint32_t read;          // samples released, counting from the first ever written
+    uint32_t maxLag;
+    uint32_t overruns;
+};
+
+#define SAMPLE_CONSUMER_NAME(id, name) #name,
+static const char* const consumerNames[SAMPLE_CONSUMER_COUNT] = {
+    SAMPLE_CONSUMER_LIST(SAMPLE_CONSUMER_NAME)
+};
+#undef SAMPLE_CONSUMER_NAME
+
+static SampleSlot ring[SAMPLE_RING_CAPACITY];
+static SampleCursor cursors[SAMPLE_CONSUMER_COUNT];
+static uint32_t written = 0;    // samples committed
+
+static SampleSlot& slotOf(uint32_t index)
+{
+    return ring[index & (SAMPLE_RING_CAPACITY - 1)];
+}
+
+SensorSample* sampleRingBegin()
+{
+    // The slot taken holds sample written - CAPACITY: whoever has not read
+    // it yet loses it
+    for (int c = 0; c < SAMPLE_CONSUMER_COUNT; c++)
+    {
+        SampleCursor& cursor = cursors[c];
+        if (written - cursor.read < SAMPLE_RING_CAPACITY) continue;
+        cursor.read++;
+        if (cursor.overruns++ == 0)
+        {
+            LOG_WARN("Samples: %s fell %d behind, dropping its oldest", consumerNames[c], SAMPLE_RING_CAPACITY);
+        }
+    }
+    return &slotOf(written).sample;
+}
+
+void sampleRingCommit()
+{
+    written++;
+    for (int c = 0; c < SAMPLE_CONSUMER_COUNT; c++)
+    {
+        uint32_t lag = written - cursors[c].read;
+        if (lag > cursors[c].maxLag) cursors[c].maxLag = lag;
+    }
+}
+
+const SensorSample* sampleRingPeek(SampleConsumer consumer)
+{
+    const SampleCursor& cursor = cursors[consumer];
+    return cursor.read != written ? &slotOf(cursor.read).sample : NULL;
+}
+
+const SensorSample* sampleRingLatest(SampleConsumer consumer)
+{
+    SampleCursor& cursor = cursors[consumer];
+    if (cursor.read == written) return NULL;
+    cursor.read = written - 1;
+    return &slotOf(cursor.read).sample;
+}
+
+void sampleRingRelease(SampleConsumer consumer)
+{
+    SampleCursor& cursor = cursors[consumer];
+    if (cursor.read != written) cursor.read++;
+}
+
+uint32_t sampleRingLag(SampleConsumer consumer)
+{
+    return written - cursors[consumer].read;
+}
+
+bool sampleRingReportJson(char* buffer, size_t size)
+{
+    int slowest = 0;
+    for (int c = 1; c < SAMPLE_CONSUMER_COUNT; c++)
+    {
+        if (sampleRingLag((SampleConsumer)c) > sampleRingLag((SampleConsumer)slowest)) slowest = c;
+    }
+    int n = snprintf(buffer, size, "{\"capacity\":%d,\"written\":%lu,\"slowest\":\"%s\",\"consumers\":{",
+        SAMPLE_RING_CAPACITY, (unsigned long)written, consumerNames[slowest]);
+    if (n < 0 || (size_t)n >= size) return false;
+    size_t length = n;
+    for (int c = 0; c < SAMPLE_CONSUMER_COUNT; c++)
+    {
+        n = snprintf(buffer + length, size - length, "%s\"%s\":{\"lag\":%lu,\"maxLag\":%lu,\"overruns\":%lu}",
+            c ? "," : "", consumerNames[c], (unsigned long)sampleRingLag((SampleConsumer)c),
+            (unsigned long)cursors[c].maxLag, (unsigned long)cursors[c].overruns);
+        if (n < 0 || (size_t)n >= size - length) return false;
+        length += n;
+    }
+    return length + 2 < size && snprintf(buffer + length, size - length, "}}") == 2;
+}
@@ -0,0 +1,98 @@
+/*
+ * Shared ring of sensor samples
+ *
+ * The sampler writes each SensorSample once into a fixed ring. Every
+ * consumer (SAMPLE_CONSUMER_LIST) has its own read cursor and reads the
+ * samples in place, at its own pace:
+ *
+ *   const SensorSample* sample;
+ *   while ((sample = sampleRingPeek(SAMPLE_CONSUMER_RULES)) != NULL)
+ *   {
+ *       ...
+ *       sampleRingRelease(SAMPLE_CONSUMER_RULES);
+ *   }
+ *
+ * Memory stays at SAMPLE_RING_CAPACITY samples however many consumers
+ * there are. The sampler never waits: a consumer that falls a whole ring
+ * behind loses its oldest sample (counted as an overrun). Each consumer's
+ * lag, its highest lag so far and the slowest consumer go into the
+ * "samples" report.
+ *
+ * Single-threaded: written and read from loop(). A peeked sample stays
+ * valid until the next sampleRingBegin().
+ */
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SensorSample.h"
+
+// Samples held; a power of two
+#ifndef SAMPLE_RING_CAPACITY
+#define SAMPLE_RING_CAPACITY 8
+#endif
+
+// Slot alignment. The Cortex-M4 has no data cache, so word alignment; use
+// the cache line size (32) on a core with one
+#ifndef SAMPLE_RING_ALIGN
+#define SAMPLE_RING_ALIGN 4
+#endif
+
+// Readers of the ring, each with its own cursor. Add a consumer here.
+#define SAMPLE_CONSUMER_LIST(X) \
+    X(PUBLISHER, publisher)     \
+    X(RULES, rules)             \
+    X(DISPLAY, display)
+
+#define SAMPLE_CONSUMER_ENUM(id, name) SAMPLE_CONSUMER_##id,
+enum SampleConsumer
+{
+    SAMPLE_CONSUMER_LIST(SAMPLE_CONSUMER_ENUM)
+    SAMPLE_CONSUMER_COUNT
+};
+#undef SAMPLE_CONSUMER_ENUM
+
+/**
+ * Slot for the next sample, to fill in place; consumers that would lose
+ * their oldest unread sample to it are moved past it. Not visible to
+ * consumers until sampleRingCommit().
+ */
+SensorSample* sampleRingBegin();
+
+/**
+ * Publish the sample filled since sampleRingBegin()
+ */
+void sampleRingCommit();
+
+/**
+ * Oldest sample the consumer has not released, or NULL if it is up to date
+ */
+const SensorSample* sampleRingPeek(SampleConsumer consumer);
+
+/**
+ * Newest sample, skipping (without counting them as overruns) any older
+ * unread ones; NULL if the consumer is up to date. For consumers that only
+ * show the current state. Release it as usual.
+ */
+const SensorSample* sampleRingLatest(SampleConsumer consumer);
+
+/**
+ * Done with the sample returned by sampleRingPeek() or sampleRingLatest()
+ */
+void sampleRingRelease(SampleConsumer consumer);
+
+/**
+ * Samples written but not yet released by the consumer
+ */
+uint32_t sampleRingLag(SampleConsumer consumer);
+
+/**
+ * {"capacity":8,"written":1234,"slowest":"publisher","consumers":{
+ *  "publisher":{"lag":2,"maxLag":5,"overruns":0},"rules":{"lag":0,"maxLag":1,"overruns":0},...}}
+ */
+bool sampleRingReportJson(char* buffer, size_t size);
+
+#endif // SAMPLE_RING_H
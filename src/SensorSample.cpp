@@ -0,0 +1,179 @@
+/*
+ * Sensor sample
+ */
+
+#include <Arduino.h>
+#include "SensorManager.h"
+
+#include "JsonLite.h"
+#include "Log.h"
+#include "Retained.h"
+#include "SensorSample.h"
+#include "Telemetry.h"
+
+#define SENSOR_RATES_MAGIC 0x53524154   // "SRAT"
+
+struct SensorRates
+{
+    uint32_t magic;
+    int32_t rate[TELEMETRY_FIELD_COUNT];    // SENSOR_RATE_OFF, SENSOR_RATE_EVERY_SAMPLE or seconds
+    uint32_t checksum;
+};
+
+static RETAINED SensorRates rates;
+
+static SensorSample last;                               // latest reading of every field
+static unsigned long lastRead[TELEMETRY_FIELD_COUNT];
+
+static uint32_t ratesChecksum()
+{
+    return retainedChecksum(&rates, offsetof(SensorRates, checksum));
+}
+
+static void ratesCommit()
+{
+    rates.magic = SENSOR_RATES_MAGIC;
+    rates.checksum = ratesChecksum();
+}
+
+static void logRate(int field)
+{
+    long rate = rates.rate[field];
+    if (rate == SENSOR_RATE_OFF)
+    {
+        LOG_INFO("Sensors: %s disabled", telemetryFieldName(field));
+    }
+    else if (rate == SENSOR_RATE_EVERY_SAMPLE)
+    {
+        LOG_INFO("Sensors: %s every sample", telemetryFieldName(field));
+    }
+    else
+    {
+        LOG_INFO("Sensors: %s every %ld s", telemetryFieldName(field), rate);
+    }
+}
+
+void sensorSampleInit()
+{
+    if (rates.magic != SENSOR_RATES_MAGIC || rates.checksum != ratesChecksum())
+    {
+        memset(&rates, 0, sizeof(rates));   // every sample
+        for (int i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+        {
+            char value[16];
+            long rate;
+            if (!jsonGetRaw(SENSOR_DEFAULTS, telemetryFieldName(i), value, sizeof(value))) continue;
+            if (sensorSampleParseRate(value, &rate))
+            {
+                rates.rate[i] = rate;
+            }
+            else
+            {
+                LOG_WARN("Sensors: bad default for %s: %s", telemetryFieldName(i), value);
+            }
+        }
+        ratesCommit();
+    }
+
+    for (int i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        if (rates.rate[i] != SENSOR_RATE_EVERY_SAMPLE) logRate(i);
+    }
+}
+
+static void readField(int field)
+{
+    // Every TELEMETRY_FIELD_LIST entry needs its SensorManager call here
+    switch (field)
+    {
+    case TELEMETRY_FIELD_temperature:
+        last.temperature = Sensors.getTemperature();
+        break;
+    case TELEMETRY_FIELD_humidity:
+        last.humidity = Sensors.getHumidity();
+        break;
+    case TELEMETRY_FIELD_pressure:
+        last.pressure = Sensors.getPressure();
+        break;
+    case TELEMETRY_FIELD_accelerometer:
+        Sensors.getAccelerometer(last.accelerometer[0], last.accelerometer[1], last.accelerometer[2]);
+        break;
+    case TELEMETRY_FIELD_gyroscope:
+        Sensors.getGyroscope(last.gyroscope[0], last.gyroscope[1], last.gyroscope[2]);
+        break;
+    case TELEMETRY_FIELD_magnetometer:
+        Sensors.getMagnetometer(last.magnetometer[0], last.magnetometer[1], last.magnetometer[2]);
+        break;
+    }
+}
+
+void sensorSampleRead(SensorSample* sample)
+{
+    unsigned long now = millis();
+    last.millis = now;
+    last.fresh = 0;
+    for (int i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        long rate = rates.rate[i];
+        if (rate == SENSOR_RATE_OFF) continue;
+        if ((last.valid & TELEMETRY_FIELD_BIT(i)) && rate > 0 && now - lastRead[i] < (unsigned long)rate * 1000) continue;
+        readField(i);
+        lastRead[i] = now;
+        last.fresh |= TELEMETRY_FIELD_BIT(i);
+        last.valid |= TELEMETRY_FIELD_BIT(i);
+    }
+    *sample = last;
+}
+
+bool sensorSampleParseRate(const char* value, long* rate)
+{
+    if (strcmp(value, "true") == 0)
+    {
+        *rate = SENSOR_RATE_EVERY_SAMPLE;
+        return true;
+    }
+    if (strcmp(value, "false") == 0)
+    {
+        *rate = SENSOR_RATE_OFF;
+        return true;
+    }
+    char* end;
+    long seconds = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || seconds < 0) return false;
+    *rate = seconds == 0 ? SENSOR_RATE_OFF : seconds;
+    return true;
+}
+
+void sensorSampleSetRate(int field, long rate)
+{
+    if (field < 0 || field >= TELEMETRY_FIELD_COUNT || rates.rate[field] == rate) return;
+
+    rates.rate[field] = rate;
+    ratesCommit();
+    if (rate == SENSOR_RATE_OFF)
+    {
+        last.valid &= ~TELEMETRY_FIELD_BIT(field);  // off the display too
+    }
+    logRate(field);
+}
+
+bool sensorSampleRatesJson(char* buffer, size_t size)
+{
+    size_t length = 0;
+    for (int i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        char value[12];
+        if (rates.rate[i] > 0)
+        {
+            snprintf(value, sizeof(value), "%ld", (long)rates.rate[i]);
+        }
+        else
+        {
+            strcpy(value, rates.rate[i] == SENSOR_RATE_OFF ? "false" : "true");
+        }
+        int n = snprintf(buffer + length, size - length, "%s\"%s\":%s", i ? "," : "{", telemetryFieldName(i), value);
+        if (n < 0 || (size_t)n >= size - length) return false;
+        length += n;
+    }
+    return length + 1 < size && snprintf(buffer + length, size - length, "}") == 1;
+}
@@ -0,0 +1,87 @@
+/*
+ * Sensor sample
+ *
+ * One reading of the onboard sensors, taken once per telemetry interval so
+ * the display, rules engine and payload all work from the same values.
+ * Members sent as telemetry are described in TELEMETRY_FIELD_LIST
+ * (Telemetry.h), which checks at compile time that the two agree.
+ *
+ * Each field has a rate: read with every sample, read at most once per
+ * N seconds, or disabled. Fields that are not due are not read at all (no
+ * I2C transfer) and are left out of the payload. SensorManager owns the
+ * sensor drivers, so a disabled sensor is not powered down. Rates come
+ * from SENSOR_DEFAULTS and the "sensors" desired property, which use the
+ * same form:
+ *
+ *   {"temperature":true,"pressure":false,"gyroscope":60}
+ *
+ *   true       every sample
+ *   N          at most every N seconds (rounded up to telemetry intervals)
+ *   false, 0   disabled
+ *
+ * Fields not named keep their rate. The rates are kept across soft resets.
+ */
+
+#ifndef SENSOR_SAMPLE_H
+#define SENSOR_SAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Rates applied at power-on, e.g. -DSENSOR_DEFAULTS=\"{\\\"gyroscope\\\":false}\"
+#ifndef SENSOR_DEFAULTS
+#define SENSOR_DEFAULTS "{}"
+#endif
+
+#define SENSOR_RATE_OFF -1          // disabled
+#define SENSOR_RATE_EVERY_SAMPLE 0
+
+// Largest sensorSampleRatesJson(), NUL included: every field at a rate of
+// ten digits. Expands TELEMETRY_FIELD_LIST, so needs Telemetry.h.
+#define SENSOR_RATE_JSON_OF(name, ...) + sizeof(#name) + 13
+#define SENSOR_RATES_JSON_SIZE (2 TELEMETRY_FIELD_LIST(SENSOR_RATE_JSON_OF))
+
+struct SensorSample
+{
+    unsigned long millis;       // when the sample was taken
+    uint16_t fresh;             // fields read for this sample, bit per TELEMETRY_FIELD_LIST entry
+    uint16_t valid;             // fields holding a reading, possibly from an earlier sample
+    float temperature;          // C
+    float humidity;             // %RH
+    float pressure;             // hPa
+    int accelerometer[3];       // mg
+    int gyroscope[3];           // mdps
+    int magnetometer[3];        // mGauss
+};
+
+/**
+ * Restore the rates kept across a soft reset, or apply SENSOR_DEFAULTS
+ */
+void sensorSampleInit();
+
+/**
+ * Read the sensors that are due via SensorManager. Fields that are not
+ * due keep their previous reading.
+ */
+void sensorSampleRead(SensorSample* sample);
+
+/**
+ * Rate from a setting value ("true", "false" or seconds); false if it is
+ * none of those
+ */
+bool sensorSampleParseRate(const char* value, long* rate);
+
+/**
+ * Set the rate of a TELEMETRY_FIELD_LIST entry (SENSOR_RATE_OFF,
+ * SENSOR_RATE_EVERY_SAMPLE or seconds)
+ */
+void sensorSampleSetRate(int field, long rate);
+
+/**
+ * Rates as a reported property value, in the form the settings take:
+ * {"temperature":true,...,"gyroscope":60}. Always fits
+ * SENSOR_RATES_JSON_SIZE.
+ */
+bool sensorSampleRatesJson(char* buffer, size_t size);
+
+#endif // SENSOR_SAMPLE_H
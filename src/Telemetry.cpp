@@ -0,0 +1,252 @@
+/*
+ * Telemetry schema
+ */
+
+#include <Arduino.h>
+#include <math.h>
+#include <type_traits>
+
+#include "Telemetry.h"
+
+enum TelemetryType
+{
+    TELEMETRY_FLOAT,
+    TELEMETRY_INT,
+};
+
+struct TelemetryField
+{
+    const char* name;
+    uint16_t offset;        // of the member in SensorSample
+    uint8_t component;
+    uint8_t type;
+    uint8_t components;
+    uint8_t wireSize;       // bytes per component in the binary payload
+    uint16_t scale;
+    const char* unit;
+    const char* label;
+};
+
+#define TELEMETRY_FIELD_ENTRY(name, component, type, components, wire, scale, unit, semanticType, dtdlUnit, label) \
+    { #name, offsetof(SensorSample, name), TELEMETRY_COMPONENT_##component, TELEMETRY_##type, components, TELEMETRY_WIRE_SIZE_##wire, scale, unit, label },
+static const TelemetryField fields[] = {
+    TELEMETRY_FIELD_LIST(TELEMETRY_FIELD_ENTRY)
+};
+#undef TELEMETRY_FIELD_ENTRY
+
+static_assert(TELEMETRY_FIELD_COUNT <= 16, "SensorSample field masks are 16 bits");
+
+// Each member must have the type and component count the list gives it
+#define TELEMETRY_MEMBER_FLOAT float
+#define TELEMETRY_MEMBER_INT int
+#define TELEMETRY_FIELD_CHECK(name, component, memberType, components, wire, scale, unit, semanticType, dtdlUnit, label) \
+    static_assert(std::is_same<std::remove_extent<decltype(SensorSample::name)>::type, TELEMETRY_MEMBER_##memberType>::value \
+        && sizeof(SensorSample::name) == (components) * sizeof(TELEMETRY_MEMBER_##memberType), \
+        "SensorSample::" #name " does not match TELEMETRY_FIELD_LIST");
+TELEMETRY_FIELD_LIST(TELEMETRY_FIELD_CHECK)
+#undef TELEMETRY_FIELD_CHECK
+
+#define TELEMETRY_NAMES_1(name) #name,
+#define TELEMETRY_NAMES_3(name) #name ".x", #name ".y", #name ".z",
+#define TELEMETRY_CHANNEL_NAMES(name, component, type, components, wire, scale, unit, semanticType, dtdlUnit, label) \
+    TELEMETRY_NAMES_##components(name)
+static const char* const channelNames[TELEMETRY_CHANNEL_COUNT] = {
+    TELEMETRY_FIELD_LIST(TELEMETRY_CHANNEL_NAMES)
+};
+#undef TELEMETRY_CHANNEL_NAMES
+
+#define TELEMETRY_COMPONENT_NAME(name, displayName, interfaceId) #name,
+static const char* const componentNames[TELEMETRY_COMPONENT_COUNT] = {
+    TELEMETRY_COMPONENT_LIST(TELEMETRY_COMPONENT_NAME)
+};
+#undef TELEMETRY_COMPONENT_NAME
+
+static const char axisNames[] = "xyz";
+
+static float componentValue(const SensorSample& sample, const TelemetryField& field, int component)
+{
+    const uint8_t* member = (const uint8_t*)&sample + field.offset;
+    if (field.type == TELEMETRY_FLOAT)
+    {
+        float value;
+        memcpy(&value, member + component * sizeof(float), sizeof(value));
+        return value;
+    }
+    int value;
+    memcpy(&value, member + component * sizeof(int), sizeof(value));
+    return (float)value;
+}
+
+/**
+ * reading * scale, rounded and clamped to the wire size. The JSON is
+ * formatted from the same value, so both payloads carry identical data.
+ */
+static int32_t scaledValue(const SensorSample& sample, const TelemetryField& field, int component)
+{
+    float scaled = componentValue(sample, field, component) * field.scale;
+    float limit = field.wireSize == 2 ? 32767.0f : 2147483520.0f;
+    if (!(scaled > -limit)) return (int32_t)-limit;     // also NaN
+    if (scaled > limit) return (int32_t)limit;
+    return (int32_t)lroundf(scaled);
+}
+
+static int formatFixed(char* out, size_t size, int32_t scaled, uint16_t scale)
+{
+    if (scale <= 1) return snprintf(out, size, "%ld", (long)scaled);
+    int decimals = scale >= 1000 ? 3 : (scale >= 100 ? 2 : 1);
+    unsigned long magnitude = scaled < 0 ? 0UL - (unsigned long)scaled : (unsigned long)scaled;
+    return snprintf(out, size, "%s%lu.%0*lu", scaled < 0 ? "-" : "", magnitude / scale, decimals, magnitude % scale);
+}
+
+static bool advance(int written, size_t size, size_t* length)
+{
+    if (written < 0 || (size_t)written >= size - *length) return false;
+    *length += written;
+    return true;
+}
+
+int telemetryJsonFields(const SensorSample& sample, char* buffer, size_t size, int component)
+{
+    size_t length = 0;
+    buffer[0] = '\0';
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        const TelemetryField& field = fields[i];
+        if (component >= 0 && field.component != component) continue;
+        if (!(sample.fresh & TELEMETRY_FIELD_BIT(i))) continue;
+        bool vector = field.components > 1;
+        if (!advance(snprintf(buffer + length, size - length, "%s\"%s\":%s", length ? "," : "", field.name, vector ? "{" : ""),
+            size, &length)) return -1;
+        for (int c = 0; c < field.components; c++)
+        {
+            if (vector && !advance(snprintf(buffer + length, size - length, "%s\"%c\":", c ? "," : "", axisNames[c]),
+                size, &length)) return -1;
+            if (!advance(formatFixed(buffer + length, size - length, scaledValue(sample, field, c), field.scale),
+                size, &length)) return -1;
+        }
+        if (vector && !advance(snprintf(buffer + length, size - length, "}"), size, &length)) return -1;
+    }
+    return (int)length;
+}
+
+static uint8_t* putLittleEndian(uint8_t* out, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        *out++ = (uint8_t)(value >> (8 * i));
+    }
+    return out;
+}
+
+size_t telemetryToBinary(const SensorSample& sample, uint32_t messageId, uint32_t timestamp,
+    uint8_t* buffer, size_t size)
+{
+    if (size < TELEMETRY_BINARY_SIZE) return 0;
+    uint8_t* out = buffer;
+    uint16_t present = sample.fresh & TELEMETRY_FIELDS_ALL;
+    *out++ = TELEMETRY_BINARY_VERSION;
+    out = putLittleEndian(out, telemetrySchemaId(), 2);
+    out = putLittleEndian(out, present, 2);
+    out = putLittleEndian(out, messageId, 4);
+    out = putLittleEndian(out, timestamp, 4);
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        if (!(present & TELEMETRY_FIELD_BIT(i))) continue;
+        for (int c = 0; c < fields[i].components; c++)
+        {
+            out = putLittleEndian(out, (uint32_t)scaledValue(sample, fields[i], c), fields[i].wireSize);
+        }
+    }
+    return out - buffer;
+}
+
+uint16_t telemetrySchemaId()
+{
+    static uint16_t id = 0;
+    static bool computed = false;
+    if (computed) return id;
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        char entry[48];
+        int n = snprintf(entry, sizeof(entry), "%s:%s:%d:%d:%d;", fields[i].name,
+            fields[i].type == TELEMETRY_FLOAT ? "FLOAT" : "INT",
+            fields[i].components, fields[i].wireSize, fields[i].scale);
+        for (int j = 0; j < n && j < (int)sizeof(entry) - 1; j++)
+        {
+            hash ^= (uint8_t)entry[j];
+            hash *= 16777619u;
+        }
+    }
+    id = (uint16_t)((hash >> 16) ^ (hash & 0xFFFF));
+    computed = true;
+    return id;
+}
+
+const char* telemetryComponentName(int component)
+{
+    return component >= 0 && component < TELEMETRY_COMPONENT_COUNT ? componentNames[component] : "";
+}
+
+int telemetryDisplayLines(const SensorSample& sample, char lines[][32], int maxLines)
+{
+    int count = 0;
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT && count < maxLines; i++)
+    {
+        const TelemetryField& field = fields[i];
+        if (field.label[0] == '\0' || field.components != 1) continue;
+        if (!(sample.valid & TELEMETRY_FIELD_BIT(i))) continue;
+        snprintf(lines[count++], sizeof(lines[0]), field.type == TELEMETRY_FLOAT ? "%s: %.1f %s" : "%s: %.0f %s",
+            field.label, componentValue(sample, field, 0), field.unit);
+    }
+    return count;
+}
+
+int telemetryFieldFind(const char* name)
+{
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        if (strcmp(name, fields[i].name) == 0) return i;
+    }
+    return -1;
+}
+
+const char* telemetryFieldName(int field)
+{
+    return field >= 0 && field < TELEMETRY_FIELD_COUNT ? fields[field].name : "";
+}
+
+int telemetryChannelFind(const char* name)
+{
+    for (int i = 0; i < TELEMETRY_CHANNEL_COUNT; i++)
+    {
+        if (strcmp(name, channelNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char* telemetryChannelName(int channel)
+{
+    return channel >= 0 && channel < TELEMETRY_CHANNEL_COUNT ? channelNames[channel] : "";
+}
+
+float telemetryChannelValue(const SensorSample& sample, int channel)
+{
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        if (channel < fields[i].components) return componentValue(sample, fields[i], channel);
+        channel -= fields[i].components;
+    }
+    return 0.0f;
+}
+
+bool telemetryChannelFresh(const SensorSample& sample, int channel)
+{
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+    {
+        if (channel < fields[i].components) return (sample.fresh & TELEMETRY_FIELD_BIT(i)) != 0;
+        channel -= fields[i].components;
+    }
+    return false;
+}
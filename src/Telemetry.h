@@ -0,0 +1,162 @@
+/*
+ * Telemetry schema
+ *
+ * Every sensor field of a SensorSample is described once, in
+ * TELEMETRY_FIELD_LIST, and belongs to one of the Plug and Play components
+ * in TELEMETRY_COMPONENT_LIST. The JSON payload, the binary payload, the OLED
+ * lines and the sensor names rules refer to are generated from it, and
+ * tools/telemetry_schema.py reads the same list to write the Plug and Play
+ * (DTDL) model and decode binary payloads. Adding a sensor is one line
+ * here plus its SensorSample member.
+ *
+ * Only the fields read for a sample (SensorSample::fresh) are sent, so a
+ * sensor that is disabled or sampled less often than the telemetry interval
+ * costs nothing in the messages that do not carry it.
+ *
+ * Binary payload (little endian). Telemetry goes out as JSON, since
+ * azureIoTSendTelemetry() only takes a C string; the binary form is for
+ * gateways and storage that re-encode it, and telemetry_schema.py decodes it:
+ *   uint8  version (TELEMETRY_BINARY_VERSION)
+ *   uint16 schema id (telemetrySchemaId(), a hash of the field list)
+ *   uint16 fields present, bit n for entry n of the list
+ *   uint32 messageId
+ *   uint32 timestamp (Unix seconds)
+ *   then each present field in list order, each component x/y/z in turn,
+ *   as a signed integer of the field's wire size: round(reading * scale)
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SensorSample.h"
+
+#define TELEMETRY_BINARY_VERSION 2
+
+// Plug and Play model of the device: a root interface with one component
+// per sensor group. Bump the version whenever a list below changes.
+#define TELEMETRY_MODEL_ID "dtmi:mxchip:az3166:IoTHubDemo;1"
+
+// X(name, displayName, interfaceId)
+#define TELEMETRY_COMPONENT_LIST(X) \
+    X(environmental, "Environmental sensors", "dtmi:mxchip:az3166:Environmental;1") \
+    X(motion,        "Motion sensors",        "dtmi:mxchip:az3166:Motion;1")
+
+#define TELEMETRY_COMPONENT_ENUM(name, displayName, interfaceId) TELEMETRY_COMPONENT_##name,
+enum TelemetryComponent
+{
+    TELEMETRY_COMPONENT_LIST(TELEMETRY_COMPONENT_ENUM)
+    TELEMETRY_COMPONENT_COUNT
+};
+#undef TELEMETRY_COMPONENT_ENUM
+
+// Longest component name, for buffers that embed one (e.g. per-component message ids)
+#define TELEMETRY_COMPONENT_NAME_MEMBER(name, displayName, interfaceId) char name[sizeof(#name)];
+union TelemetryComponentNames
+{
+    TELEMETRY_COMPONENT_LIST(TELEMETRY_COMPONENT_NAME_MEMBER)
+};
+#undef TELEMETRY_COMPONENT_NAME_MEMBER
+#define TELEMETRY_COMPONENT_NAME_MAX (sizeof(TelemetryComponentNames) - 1)
+
+// X(name, component, type, components, wire, scale, unit, semanticType, dtdlUnit, label)
+//   name          SensorSample member, JSON field and DTDL telemetry name
+//   component     entry of TELEMETRY_COMPONENT_LIST the field is sent under
+//   type          FLOAT or INT, the member type
+//   components    1, or 3 for an x/y/z vector (a JSON object)
+//   wire          I16 or I32, the binary encoding
+//   scale         1, 10, 100 or 1000: binary value = reading * scale, and
+//                 decimals in the JSON
+//   unit          shown on the display and in the model description
+//   semanticType  DTDL semantic type and unit, "" for none
+//   label         OLED label, "" to leave the field off the display
+// tools/telemetry_schema.py parses this list, so keep one field per line.
+#define TELEMETRY_FIELD_LIST(X) \
+    X(temperature,   environmental, FLOAT, 1, I16, 100, "C",      "Temperature",      "degreeCelsius", "Temp")     \
+    X(humidity,      environmental, FLOAT, 1, I16, 100, "%",      "RelativeHumidity", "percent",       "Humidity") \
+    X(pressure,      environmental, FLOAT, 1, I32, 100, "hPa",    "Pressure",         "millibar",      "Press")    \
+    X(accelerometer, motion,        INT,   3, I16, 1,   "mg",     "",                 "",              "")         \
+    X(gyroscope,     motion,        INT,   3, I32, 1,   "mdps",   "",                 "",              "")         \
+    X(magnetometer,  motion,        INT,   3, I32, 1,   "mGauss", "",                 "",              "")
+
+#define TELEMETRY_WIRE_SIZE_I16 2
+#define TELEMETRY_WIRE_SIZE_I32 4
+
+// Field index in list order, e.g. TELEMETRY_FIELD_temperature
+#define TELEMETRY_FIELD_ENUM(name, component, type, components, wire, scale, unit, semanticType, dtdlUnit, label) \
+    TELEMETRY_FIELD_##name,
+enum TelemetryFieldIndex
+{
+    TELEMETRY_FIELD_LIST(TELEMETRY_FIELD_ENUM)
+    TELEMETRY_FIELD_COUNT
+};
+#undef TELEMETRY_FIELD_ENUM
+
+#define TELEMETRY_FIELD_BIT(field) ((uint16_t)(1u << (field)))
+#define TELEMETRY_FIELDS_ALL ((uint16_t)((1u << TELEMETRY_FIELD_COUNT) - 1))
+
+#define TELEMETRY_CHANNELS_OF(name, component, type, components, wire, scale, unit, semanticType, dtdlUnit, label) + (components)
+#define TELEMETRY_BYTES_OF(name, component, type, components, wire, scale, unit, semanticType, dtdlUnit, label) \
+    + (components) * TELEMETRY_WIRE_SIZE_##wire
+
+// Scalar values in a sample: one per component ("accelerometer.x", ...)
+#define TELEMETRY_CHANNEL_COUNT (0 TELEMETRY_FIELD_LIST(TELEMETRY_CHANNELS_OF))
+
+#define TELEMETRY_BINARY_HEADER_SIZE 13
+// Largest binary payload, with every field present
+#define TELEMETRY_BINARY_SIZE (TELEMETRY_BINARY_HEADER_SIZE TELEMETRY_FIELD_LIST(TELEMETRY_BYTES_OF))
+
+/**
+ * Fresh sensor fields as JSON members, without braces:
+ * "temperature":25.30,...,"magnetometer":{"x":300,"y":-100,"z":500}
+ * Only the fields of one component if component >= 0.
+ * Returns the length (0 if no field is fresh), or -1 if the buffer is too
+ * small.
+ */
+int telemetryJsonFields(const SensorSample& sample, char* buffer, size_t size, int component = -1);
+
+/**
+ * Component name as used for $.sub and in the model, e.g. "environmental"
+ */
+const char* telemetryComponentName(int component);
+
+/**
+ * Binary payload of the fresh fields; returns its length, or 0 if size is
+ * smaller than TELEMETRY_BINARY_SIZE
+ */
+size_t telemetryToBinary(const SensorSample& sample, uint32_t messageId, uint32_t timestamp,
+    uint8_t* buffer, size_t size);
+
+/**
+ * 16-bit FNV-1a fold over "name:type:components:wire:scale;" for every
+ * field, so a decoder can tell which list a binary payload was built from
+ */
+uint16_t telemetrySchemaId();
+
+/**
+ * Display lines for the labelled fields that hold a reading, e.g.
+ * "Temp: 25.3 C". Returns the number of lines written.
+ */
+int telemetryDisplayLines(const SensorSample& sample, char lines[][32], int maxLines);
+
+/**
+ * Field index for "temperature", "accelerometer", ... or -1
+ */
+int telemetryFieldFind(const char* name);
+const char* telemetryFieldName(int field);
+
+/**
+ * Channel index for "temperature", "accelerometer.x", ... or -1
+ */
+int telemetryChannelFind(const char* name);
+const char* telemetryChannelName(int channel);
+float telemetryChannelValue(const SensorSample& sample, int channel);
+
+/**
+ * Whether the channel's sensor was read for this sample
+ */
+bool telemetryChannelFresh(const SensorSample& sample, int channel);
+
+#endif // TELEMETRY_H
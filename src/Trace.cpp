@@ -0,0 +1,152 @@
+/*
+ * Binary trace log
+ *
+ * Wire format shared by the serial dump and the diagnostics upload: each
+ * record is 8 bytes little endian - uint32 timestamp (us), uint8 event,
+ * uint8 phase, uint16 arg - oldest first.
+ */
+
+#include <Arduino.h>
+#include "AzureIoTHub.h"
+#include "mbed.h"
+
+#include "Log.h"
+#include "MessageProperties.h"
+#include "Placement.h"
+#include "Trace.h"
+
+#define TRACE_WIRE_SIZE         8
+#define TRACE_DUMP_PER_LINE     12      // 96 bytes -> 192 hex chars per log line
+#define TRACE_UPLOAD_PER_PART   64      // 512 bytes -> 684 base64 chars per message
+
+static TraceRecord ring[TRACE_CAPACITY];
+static volatile uint32_t written = 0;   // total records ever written
+
+void traceRecord(uint8_t event, uint8_t phase, uint16_t arg)
+{
+    core_util_critical_section_enter();
+    TraceRecord& record = ring[written % TRACE_CAPACITY];
+    record.timestamp = micros();
+    record.event = event;
+    record.phase = phase;
+    record.arg = arg;
+    written++;
+    core_util_critical_section_exit();
+}
+
+size_t traceCount()
+{
+    return written < TRACE_CAPACITY ? written : TRACE_CAPACITY;
+}
+
+size_t traceRead(TraceRecord* out, size_t first, size_t max)
+{
+    core_util_critical_section_enter();
+    size_t count = traceCount();
+    uint32_t oldest = written - count;
+    size_t n = 0;
+    for (size_t i = first; i < count && n < max; i++)
+    {
+        out[n++] = ring[(oldest + i) % TRACE_CAPACITY];
+    }
+    core_util_critical_section_exit();
+    return n;
+}
+
+/**
+ * Serialize records to the little-endian wire format
+ */
+static size_t encodeRecords(const TraceRecord* records, size_t count, uint8_t* out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t* p = out + i * TRACE_WIRE_SIZE;
+        uint32_t ts = records[i].timestamp;
+        p[0] = ts & 0xFF;
+        p[1] = (ts >> 8) & 0xFF;
+        p[2] = (ts >> 16) & 0xFF;
+        p[3] = (ts >> 24) & 0xFF;
+        p[4] = records[i].event;
+        p[5] = records[i].phase;
+        p[6] = records[i].arg & 0xFF;
+        p[7] = records[i].arg >> 8;
+    }
+    return count * TRACE_WIRE_SIZE;
+}
+
+static size_t base64Encode(const uint8_t* data, size_t len, char* out)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < len; i += 3)
+    {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < len) v |= data[i + 1] << 8;
+        if (i + 2 < len) v |= data[i + 2];
+        out[o++] = alphabet[(v >> 18) & 0x3F];
+        out[o++] = alphabet[(v >> 12) & 0x3F];
+        out[o++] = i + 1 < len ? alphabet[(v >> 6) & 0x3F] : '=';
+        out[o++] = i + 2 < len ? alphabet[v & 0x3F] : '=';
+    }
+    out[o] = '\0';
+    return o;
+}
+
+COLD_PATH void traceDumpSerial()
+{
+    TraceRecord records[TRACE_DUMP_PER_LINE];
+    uint8_t wire[TRACE_DUMP_PER_LINE * TRACE_WIRE_SIZE];
+    char hex[sizeof(wire) * 2 + 1];
+
+    // The whole dump is larger than the log ring: wait for each line to be
+    // written before queuing the next, or lines are dropped
+    size_t count = traceCount();
+    LOG_INFO("TRACE BEGIN %u", (unsigned)count);
+    logFlush();
+    for (size_t first = 0; first < count; first += TRACE_DUMP_PER_LINE)
+    {
+        size_t n = traceRead(records, first, TRACE_DUMP_PER_LINE);
+        size_t len = encodeRecords(records, n, wire);
+        for (size_t i = 0; i < len; i++)
+        {
+            snprintf(hex + i * 2, 3, "%02x", wire[i]);
+        }
+        LOG_INFO("TRACE %s", hex);
+        logFlush();
+    }
+    LOG_INFO("TRACE END");
+}
+
+COLD_PATH bool traceUpload()
+{
+    TraceRecord records[TRACE_UPLOAD_PER_PART];
+    uint8_t wire[TRACE_UPLOAD_PER_PART * TRACE_WIRE_SIZE];
+    char encoded[(sizeof(wire) + 2) / 3 * 4 + 1];
+    char payload[sizeof(encoded) + 96];
+
+    MessageProperties props;
+    messagePropertiesInitJson(&props);
+    if (!messagePropertiesAdd(&props, "messageType", "diagnostics"))
+    {
+        LOG_ERROR("Trace upload: no room for the message properties");
+        return false;
+    }
+
+    size_t count = traceCount();
+    size_t parts = (count + TRACE_UPLOAD_PER_PART - 1) / TRACE_UPLOAD_PER_PART;
+    for (size_t part = 0; part < parts; part++)
+    {
+        size_t n = traceRead(records, part * TRACE_UPLOAD_PER_PART, TRACE_UPLOAD_PER_PART);
+        base64Encode(wire, encodeRecords(records, n, wire), encoded);
+        snprintf(payload, sizeof(payload),
+            "{\"deviceId\":\"%s\",\"trace\":{\"part\":%u,\"parts\":%u,\"records\":\"%s\"}}",
+            azureIoTGetDeviceId(), (unsigned)part, (unsigned)parts, encoded);
+        if (!azureIoTSendTelemetry(payload, props.encoded))
+        {
+            LOG_WARN("Trace upload failed at part %u/%u", (unsigned)part + 1, (unsigned)parts);
+            return false;
+        }
+    }
+    LOG_INFO("Trace uploaded: %u events in %u parts", (unsigned)count, (unsigned)parts);
+    return true;
+}
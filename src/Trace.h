@@ -0,0 +1,109 @@
+/*
+ * Binary trace log
+ *
+ * Hot paths record tokenized events (event id, phase, 16-bit argument,
+ * microsecond timestamp) into a fixed RAM ring; nothing is formatted on the
+ * device. The ring can be dumped to serial (press 't' in the serial monitor)
+ * or uploaded as a diagnostics message (C2D "dumpTrace"), and
+ * tools/trace_decode.py turns either into a Chrome trace / Perfetto timeline.
+ *
+ * Build with -DTRACE_ENABLED=0 to compile all TRACE_* macros out.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Events kept in the ring (8 bytes each); oldest are overwritten
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY 256
+#endif
+
+// Event ids. tools/trace_decode.py reads this list, so only append.
+#define TRACE_EVENT_LIST(X) \
+    X(BOOT)                 \
+    X(WIFI_JOIN)            \
+    X(DNS_RESOLVE)          \
+    X(IOT_INIT)             \
+    X(CONNECT)              \
+    X(MQTT_LOOP)            \
+    X(SENSOR_READ)          \
+    X(PUBLISH)              \
+    X(RECEIVE_C2D)          \
+    X(RECEIVE_DESIRED)      \
+    X(RECEIVE_TWIN)         \
+    X(DISCONNECT)           \
+    X(FAILOVER)             \
+    X(PING)                 /* unused */ \
+    X(PROBE_ECHO)
+
+#define TRACE_EVENT_ENUM(name) TRACE_##name,
+enum TraceEvent
+{
+    TRACE_EVENT_LIST(TRACE_EVENT_ENUM)
+    TRACE_EVENT_COUNT
+};
+#undef TRACE_EVENT_ENUM
+
+enum TracePhase
+{
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i',
+};
+
+struct TraceRecord
+{
+    uint32_t timestamp;     // micros()
+    uint8_t event;          // TraceEvent
+    uint8_t phase;          // TracePhase
+    uint16_t arg;           // event specific (length, result, ...)
+};
+
+#if TRACE_ENABLED
+#define TRACE_BEGIN(event)          traceRecord(TRACE_##event, TRACE_PHASE_BEGIN, 0)
+#define TRACE_END(event, arg)       traceRecord(TRACE_##event, TRACE_PHASE_END, (arg))
+#define TRACE_INSTANT(event, arg)   traceRecord(TRACE_##event, TRACE_PHASE_INSTANT, (arg))
+#else
+#define TRACE_BEGIN(event)          do {} while (0)
+#define TRACE_END(event, arg)       do {} while (0)
+#define TRACE_INSTANT(event, arg)   do {} while (0)
+#endif
+
+/**
+ * Append one event; use the TRACE_* macros instead of calling this directly
+ */
+void traceRecord(uint8_t event, uint8_t phase, uint16_t arg);
+
+/**
+ * Copy up to max records, oldest first, starting at index first of the
+ * current contents. Returns the number copied.
+ */
+size_t traceRead(TraceRecord* out, size_t first, size_t max);
+
+/**
+ * Number of records currently held
+ */
+size_t traceCount();
+
+/**
+ * Write the ring to the log as "TRACE <hex>" lines for trace_decode.py
+ */
+void traceDumpSerial();
+
+/**
+ * Upload the ring as diagnostics telemetry (messageType=diagnostics), in
+ * parts of 64 records, base64 encoded, each part its own message numbered
+ * "part" of "parts". Published directly, not through the
+ * outbound lanes. Stops and returns false at the first part that fails to
+ * send.
+ */
+bool traceUpload();
+
+#endif // TRACE_H
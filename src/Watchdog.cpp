@@ -0,0 +1,183 @@
+/*
+ * Watchdog supervisor
+ *
+ * IWDG runs from the ~32 kHz LSI with a /256 prescaler: one reload count is
+ * 8 ms, so the 12-bit reload register covers up to ~32.7 s.
+ */
+
+#include <Arduino.h>
+#include "mbed.h"
+
+#include "Log.h"
+#include "Retained.h"
+#include "Watchdog.h"
+
+#define WDT_RECORD_MAGIC    0x57445431  // "WDT1"
+#define WDT_NO_SUBSYSTEM    0xFF
+
+#define IWDG_KEY_RELOAD     0xAAAA
+#define IWDG_KEY_ENABLE     0xCCCC
+#define IWDG_KEY_ACCESS     0x5555
+#define IWDG_PRESCALER_256  6
+#define IWDG_MS_PER_COUNT   8
+
+static const char* const subsystemNames[WDT_SUBSYSTEM_COUNT] = {
+    "mqtt",
+    "sampler",
+    "publisher",
+};
+
+// Survives the reset so the next boot can report it
+struct WatchdogRecord
+{
+    uint32_t magic;
+    uint8_t expired;        // subsystem that missed its deadline, or WDT_NO_SUBSYSTEM
+    uint8_t lastCheckIn;    // last subsystem seen alive (for hardware watchdog resets)
+    uint32_t uptime;        // seconds at the time of the reset
+    uint32_t resetCount;    // supervised + hardware watchdog resets since power-on
+    uint32_t checksum;
+};
+
+static RETAINED WatchdogRecord record;
+static WatchdogRecord previous;
+static const char* resetReason = "unknown";
+
+static unsigned long deadline[WDT_SUBSYSTEM_COUNT];
+static unsigned long lastCheckIn[WDT_SUBSYSTEM_COUNT];
+
+static uint32_t recordChecksum()
+{
+    return retainedChecksum(&record, offsetof(WatchdogRecord, checksum));
+}
+
+static void recordCommit()
+{
+    record.magic = WDT_RECORD_MAGIC;
+    record.uptime = millis() / 1000;
+    record.checksum = recordChecksum();
+}
+
+/**
+ * Decode and clear the RCC reset flags
+ */
+static const char* readResetFlags(bool supervised)
+{
+    uint32_t csr = RCC->CSR;
+    RCC->CSR |= RCC_CSR_RMVF;
+
+    if (csr & RCC_CSR_LPWRRSTF) return "low-power";
+    if (csr & (RCC_CSR_IWDGRSTF | RCC_CSR_WWDGRSTF)) return "watchdog";
+    if (csr & RCC_CSR_SFTRSTF) return supervised ? "supervisor" : "software";
+    if (csr & RCC_CSR_PORRSTF) return "power-on";
+    if (csr & RCC_CSR_BORRSTF) return "brown-out";
+    if (csr & RCC_CSR_PINRSTF) return "pin";
+    return "unknown";
+}
+
+void watchdogInit()
+{
+    bool valid = record.magic == WDT_RECORD_MAGIC && record.checksum == recordChecksum();
+    if (!valid)
+    {
+        memset(&record, 0, sizeof(record));
+        record.expired = WDT_NO_SUBSYSTEM;
+        record.lastCheckIn = WDT_NO_SUBSYSTEM;
+    }
+    previous = record;
+    resetReason = readResetFlags(valid && record.expired != WDT_NO_SUBSYSTEM);
+    if (strcmp(resetReason, "watchdog") == 0)
+    {
+        record.resetCount++;
+        previous.resetCount = record.resetCount;
+    }
+
+    // Start a fresh record for this run
+    record.expired = WDT_NO_SUBSYSTEM;
+    record.lastCheckIn = WDT_NO_SUBSYSTEM;
+    recordCommit();
+
+    // Start the IWDG; it cannot be stopped again until the next reset
+    uint32_t reload = WDT_HW_TIMEOUT_MS / IWDG_MS_PER_COUNT;
+    if (reload > 0xFFF) reload = 0xFFF;
+    IWDG->KR = IWDG_KEY_ENABLE;
+    IWDG->KR = IWDG_KEY_ACCESS;
+    IWDG->PR = IWDG_PRESCALER_256;
+    IWDG->RLR = reload;
+    while (IWDG->SR != 0)
+    {
+        // Wait for the prescaler/reload update to reach the LSI domain
+    }
+    IWDG->KR = IWDG_KEY_RELOAD;
+
+    LOG_INFO("Reset reason: %s", resetReason);
+    if (previous.expired != WDT_NO_SUBSYSTEM && previous.expired < WDT_SUBSYSTEM_COUNT)
+    {
+        LOG_WARN("  Supervisor reset: %s missed its deadline after %lu s uptime",
+            subsystemNames[previous.expired], (unsigned long)previous.uptime);
+    }
+}
+
+void watchdogArm(WatchdogSubsystem subsystem, unsigned long deadlineMs)
+{
+    deadline[subsystem] = deadlineMs;
+    lastCheckIn[subsystem] = millis();
+}
+
+void watchdogCheckIn(WatchdogSubsystem subsystem)
+{
+    lastCheckIn[subsystem] = millis();
+    record.lastCheckIn = subsystem;
+}
+
+void watchdogService()
+{
+    unsigned long now = millis();
+    for (int i = 0; i < WDT_SUBSYSTEM_COUNT; i++)
+    {
+        if (deadline[i] == 0 || now - lastCheckIn[i] < deadline[i])
+        {
+            continue;
+        }
+
+        LOG_ERROR("Watchdog: %s missed its %lu ms deadline, resetting",
+            subsystemNames[i], deadline[i]);
+        record.expired = (uint8_t)i;
+        record.resetCount++;
+        recordCommit();
+        logFlush();
+        NVIC_SystemReset();
+    }
+
+    recordCommit();
+    watchdogKick();
+}
+
+void watchdogKick()
+{
+    IWDG->KR = IWDG_KEY_RELOAD;
+}
+
+const char* watchdogResetReason()
+{
+    return resetReason;
+}
+
+bool watchdogResetReportJson(char* buffer, size_t size)
+{
+    const char* subsystem = NULL;
+    if (previous.expired < WDT_SUBSYSTEM_COUNT)
+    {
+        subsystem = subsystemNames[previous.expired];
+    }
+    else if (strcmp(resetReason, "watchdog") == 0 && previous.lastCheckIn < WDT_SUBSYSTEM_COUNT)
+    {
+        subsystem = subsystemNames[previous.lastCheckIn];
+    }
+
+    int n = snprintf(buffer, size,
+        "{\"reason\":\"%s\",\"subsystem\":%s%s%s,\"uptime\":%lu,\"count\":%lu}",
+        resetReason,
+        subsystem ? "\"" : "", subsystem ? subsystem : "null", subsystem ? "\"" : "",
+        (unsigned long)previous.uptime, (unsigned long)previous.resetCount);
+    return n > 0 && (size_t)n < size;
+}
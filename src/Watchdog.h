@@ -0,0 +1,88 @@
+/*
+ * Watchdog supervisor
+ *
+ * Two layers:
+ * - The STM32 independent watchdog (IWDG) resets the board if loop() or a
+ *   blocking call (TLS write, connect) stops returning for
+ *   WDT_HW_TIMEOUT_MS.
+ * - Each armed subsystem (MQTT loop, sampler, publisher) must check in
+ *   within its own deadline. watchdogService() only feeds the IWDG while all
+ *   of them are healthy, and resets the board when one misses its deadline,
+ *   so "running but not making progress" is recovered too.
+ *
+ * The cause of every supervised reset is kept in retained RAM and combined
+ * with the RCC reset flags on the next boot, so the device can report why it
+ * restarted.
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stddef.h>
+
+// Hardware watchdog timeout (ms); the IWDG maximum is about 32 s
+#ifndef WDT_HW_TIMEOUT_MS
+#define WDT_HW_TIMEOUT_MS 30000
+#endif
+
+// Supervisor: longest WiFi join, registration or hub connect (ms); main.cpp
+// pauses it while waiting in WIFI_DOWN or BACKOFF
+#ifndef WDT_MQTT_DEADLINE_MS
+#define WDT_MQTT_DEADLINE_MS 300000
+#endif
+
+// Supervisor: telemetry intervals the sampler/publisher may miss in a row
+#ifndef WDT_MISSED_INTERVALS
+#define WDT_MISSED_INTERVALS 5
+#endif
+
+enum WatchdogSubsystem
+{
+    WDT_MQTT,           // azureIoTLoop() returned with the hub connected
+    WDT_SAMPLER,        // sensors were read
+    WDT_PUBLISHER,      // a message was accepted by the hub, or a sample needed none with nothing queued
+    WDT_SUBSYSTEM_COUNT
+};
+
+/**
+ * Capture the reset reason and start the hardware watchdog. Call first
+ * thing in setup().
+ */
+void watchdogInit();
+
+/**
+ * Start supervising a subsystem with the given deadline (0 disarms it).
+ * Arming counts as a check-in.
+ */
+void watchdogArm(WatchdogSubsystem subsystem, unsigned long deadlineMs);
+
+/**
+ * Record that a subsystem made progress
+ */
+void watchdogCheckIn(WatchdogSubsystem subsystem);
+
+/**
+ * Feed the hardware watchdog if every armed subsystem is within its
+ * deadline, otherwise record the culprit and reset. Call from loop().
+ */
+void watchdogService();
+
+/**
+ * Feed the hardware watchdog unconditionally; for long blocking steps in
+ * setup() before the subsystems are armed
+ */
+void watchdogKick();
+
+/**
+ * Why the previous run ended: "power-on", "pin", "software", "watchdog",
+ * "supervisor", "brown-out", "low-power" or "unknown"
+ */
+const char* watchdogResetReason();
+
+/**
+ * Previous reset as a JSON object for reported properties, e.g.
+ * {"reason":"supervisor","subsystem":"mqtt","uptime":3600,"count":2}
+ */
+bool watchdogResetReportJson(char* buffer, size_t size);
+
+#endif // WATCHDOG_H
@@ -0,0 +1,271 @@
+/*
+ * WiFi fast-join cache
+ *
+ * Fast path: micoWlanStartAdv() with the cached BSSID/channel (no scan) and,
+ * while the lease is fresh, the cached address with DHCP disabled.
+ * Full path: WiFi.begin() with the EEPROM credentials (micoWlanStart() with
+ * the static address when WIFI_STATIC_IP is set, as WiFi.begin() always
+ * uses DHCP), then snapshot the link and IP status into the cache for next
+ * time.
+ */
+
+#include <Arduino.h>
+#include "AZ3166WiFi.h"
+#include "DeviceConfig.h"
+#include "mico_wlan.h"
+
+#include "Log.h"
+#include "Retained.h"
+#include "WiFiFastJoin.h"
+
+#define WIFI_CACHE_MAGIC    0x57464A31  // "WFJ1"
+
+// Any wall-clock time before this means NTP has not run since power-on
+#define WIFI_MIN_VALID_TIME 1577836800  // 2020-01-01
+
+struct WiFiJoinCache
+{
+    uint32_t magic;
+    char ssid[33];
+    uint32_t passwordHash;
+    uint8_t bssid[6];
+    uint8_t channel;
+    char ip[16];
+    char netmask[16];
+    char gateway[16];
+    char dns[16];
+    uint32_t leaseTime;     // time(NULL) when the lease was obtained, 0 if unknown
+    uint32_t checksum;
+};
+
+static RETAINED WiFiJoinCache joinCache;
+static bool lastJoinFast = false;
+
+static uint32_t cacheChecksum()
+{
+    return retainedChecksum(&joinCache, offsetof(WiFiJoinCache, checksum));
+}
+
+static uint32_t passwordHash()
+{
+    const char* password = DeviceConfig_GetWifiPassword();
+    return retainedChecksum(password, strlen(password));
+}
+
+/**
+ * True if the cache matches the currently configured network
+ */
+static bool cacheValid()
+{
+    return joinCache.magic == WIFI_CACHE_MAGIC
+        && joinCache.checksum == cacheChecksum()
+        && strcmp(joinCache.ssid, DeviceConfig_GetWifiSsid()) == 0
+        && joinCache.passwordHash == passwordHash()
+        && joinCache.channel != 0;
+}
+
+/**
+ * True if the cached DHCP lease can be reused without asking DHCP
+ */
+static bool leaseFresh()
+{
+    time_t now = time(NULL);
+    if (joinCache.leaseTime == 0 || joinCache.ip[0] == '\0' || now < WIFI_MIN_VALID_TIME)
+    {
+        return false;
+    }
+    return (uint32_t)now - joinCache.leaseTime < WIFI_LEASE_REUSE_SECONDS;
+}
+
+/**
+ * Snapshot the current link and IP status into the cache
+ */
+static void saveCache(bool newLease)
+{
+    LinkStatusTypeDef link;
+    IPStatusTypedef ipStatus;
+    if (micoWlanGetLinkStatus(&link) != kNoErr || !link.is_connected)
+    {
+        return;
+    }
+    if (micoWlanGetIPStatus(&ipStatus, Station) != kNoErr)
+    {
+        return;
+    }
+
+    bool sameLease = cacheValid() && strcmp(joinCache.ip, ipStatus.ip) == 0;
+    uint32_t leaseTime = sameLease && !newLease ? joinCache.leaseTime : 0;
+    if (leaseTime == 0 && time(NULL) >= WIFI_MIN_VALID_TIME)
+    {
+        leaseTime = (uint32_t)time(NULL);
+    }
+
+    memset(&joinCache, 0, sizeof(joinCache));
+    joinCache.magic = WIFI_CACHE_MAGIC;
+    strncpy(joinCache.ssid, DeviceConfig_GetWifiSsid(), sizeof(joinCache.ssid) - 1);
+    joinCache.passwordHash = passwordHash();
+    memcpy(joinCache.bssid, link.bssid, sizeof(joinCache.bssid));
+    joinCache.channel = (uint8_t)link.channel;
+    strncpy(joinCache.ip, ipStatus.ip, sizeof(joinCache.ip) - 1);
+    strncpy(joinCache.netmask, ipStatus.mask, sizeof(joinCache.netmask) - 1);
+    strncpy(joinCache.gateway, ipStatus.gate, sizeof(joinCache.gateway) - 1);
+    strncpy(joinCache.dns, ipStatus.dns, sizeof(joinCache.dns) - 1);
+    joinCache.leaseTime = leaseTime;
+    joinCache.checksum = cacheChecksum();
+}
+
+/**
+ * Wait for the station to come up with an address
+ */
+static bool waitForStation(unsigned long timeoutMs)
+{
+    unsigned long start = millis();
+    while (millis() - start < timeoutMs)
+    {
+        LinkStatusTypeDef link;
+        IPStatusTypedef ipStatus;
+        if (micoWlanGetLinkStatus(&link) == kNoErr && link.is_connected
+            && micoWlanGetIPStatus(&ipStatus, Station) == kNoErr
+            && strcmp(ipStatus.ip, "0.0.0.0") != 0 && ipStatus.ip[0] != '\0')
+        {
+            return true;
+        }
+        delay(50);
+    }
+    return false;
+}
+
+#if defined(WIFI_STATIC_IP)
+/**
+ * Fill in the configured static address, DHCP off
+ */
+static void setStaticAddress(char* ip, char* netmask, char* gateway, char* dns, char* dhcpMode)
+{
+    strncpy(ip, WIFI_STATIC_IP, 15);
+    strncpy(netmask, WIFI_STATIC_NETMASK, 15);
+    strncpy(gateway, WIFI_STATIC_GATEWAY, 15);
+    strncpy(dns, WIFI_STATIC_DNS, 15);
+    *dhcpMode = DHCP_Disable;
+}
+
+/**
+ * Scan for the configured network and join it with the static address
+ */
+static bool staticJoin()
+{
+    network_InitTypeDef_st params;
+    memset(&params, 0, sizeof(params));
+
+    params.wifi_mode = Station;
+    strncpy(params.wifi_ssid, DeviceConfig_GetWifiSsid(), sizeof(params.wifi_ssid) - 1);
+    strncpy(params.wifi_key, DeviceConfig_GetWifiPassword(), sizeof(params.wifi_key) - 1);
+    setStaticAddress(params.local_ip_addr, params.net_mask, params.gateway_ip_addr,
+        params.dnsServer_ip_addr, &params.dhcpMode);
+    params.wifi_retry_interval = 100;
+
+    if (micoWlanStart(&params) != kNoErr)
+    {
+        return false;
+    }
+    if (!waitForStation(WIFI_FULL_JOIN_TIMEOUT_MS))
+    {
+        micoWlanSuspendStation();
+        return false;
+    }
+    return true;
+}
+#endif
+
+/**
+ * Join using the cached BSSID/channel and, if possible, a known address
+ */
+static bool fastJoin()
+{
+    network_InitTypeDef_adv_st params;
+    memset(&params, 0, sizeof(params));
+
+    strncpy(params.ap_info.ssid, joinCache.ssid, sizeof(params.ap_info.ssid));
+    memcpy(params.ap_info.bssid, joinCache.bssid, sizeof(params.ap_info.bssid));
+    params.ap_info.channel = joinCache.channel;
+    params.ap_info.security = SECURITY_TYPE_AUTO;
+
+    const char* password = DeviceConfig_GetWifiPassword();
+    strncpy(params.key, password, sizeof(params.key));
+    params.key_len = (int)strlen(password);
+    params.wifi_retry_interval = 100;
+
+#if defined(WIFI_STATIC_IP)
+    setStaticAddress(params.local_ip_addr, params.net_mask, params.gateway_ip_addr,
+        params.dnsServer_ip_addr, &params.dhcpMode);
+#else
+    if (leaseFresh())
+    {
+        strncpy(params.local_ip_addr, joinCache.ip, sizeof(params.local_ip_addr) - 1);
+        strncpy(params.net_mask, joinCache.netmask, sizeof(params.net_mask) - 1);
+        strncpy(params.gateway_ip_addr, joinCache.gateway, sizeof(params.gateway_ip_addr) - 1);
+        strncpy(params.dnsServer_ip_addr, joinCache.dns, sizeof(params.dnsServer_ip_addr) - 1);
+        params.dhcpMode = DHCP_Disable;
+    }
+    else
+    {
+        params.dhcpMode = DHCP_Client;
+    }
+#endif
+
+    if (micoWlanStartAdv(&params) != kNoErr)
+    {
+        return false;
+    }
+    if (!waitForStation(WIFI_FAST_JOIN_TIMEOUT_MS))
+    {
+        micoWlanSuspendStation();
+        return false;
+    }
+
+    // A DHCP join gets a new lease; a reused lease keeps its original time
+    saveCache(params.dhcpMode == DHCP_Client);
+    return true;
+}
+
+bool wifiFastJoin()
+{
+    lastJoinFast = false;
+
+    if (cacheValid())
+    {
+        LOG_INFO("WiFi fast join: channel %d, lease %s",
+            joinCache.channel, leaseFresh() ? "cached" : "DHCP");
+        if (fastJoin())
+        {
+            lastJoinFast = true;
+            return true;
+        }
+        LOG_WARN("WiFi fast join failed, falling back to full join");
+        wifiFastJoinInvalidate();
+    }
+
+#if defined(WIFI_STATIC_IP)
+    if (!staticJoin())
+    {
+        return false;
+    }
+#else
+    // WiFi.begin() with no parameters reads credentials from EEPROM
+    if (WiFi.begin() != WL_CONNECTED)
+    {
+        return false;
+    }
+#endif
+    saveCache(true);
+    return true;
+}
+
+bool wifiFastJoinWasFast()
+{
+    return lastJoinFast;
+}
+
+void wifiFastJoinInvalidate()
+{
+    memset(&joinCache, 0, sizeof(joinCache));
+}
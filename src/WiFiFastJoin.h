@@ -0,0 +1,50 @@
+/*
+ * WiFi fast-join cache
+ *
+ * Remembers the BSSID, channel and DHCP lease of the last successful join in
+ * retained RAM. The next join (soft reset or reconnect) goes straight to that
+ * access point on that channel, skipping the scan, and reuses the lease while
+ * it is still fresh so DHCP is skipped too. Any failure falls back to the
+ * normal WiFi.begin() path and refreshes the cache.
+ *
+ * A static IP can be configured at build time instead of DHCP; both the
+ * fast and the full join use it:
+ *   -DWIFI_STATIC_IP=\"192.168.1.50\" -DWIFI_STATIC_NETMASK=\"255.255.255.0\"
+ *   -DWIFI_STATIC_GATEWAY=\"192.168.1.1\" -DWIFI_STATIC_DNS=\"192.168.1.1\"
+ */
+
+#ifndef WIFI_FAST_JOIN_H
+#define WIFI_FAST_JOIN_H
+
+// How long a cached DHCP lease is reused before asking DHCP again (seconds)
+#ifndef WIFI_LEASE_REUSE_SECONDS
+#define WIFI_LEASE_REUSE_SECONDS 3600
+#endif
+
+// How long to wait for a fast join before falling back to a full join (ms)
+#ifndef WIFI_FAST_JOIN_TIMEOUT_MS
+#define WIFI_FAST_JOIN_TIMEOUT_MS 5000
+#endif
+
+// How long to wait for a full join with a static IP (ms)
+#ifndef WIFI_FULL_JOIN_TIMEOUT_MS
+#define WIFI_FULL_JOIN_TIMEOUT_MS 20000
+#endif
+
+/**
+ * Join the configured network, using the cache when it is valid.
+ * Returns true when the station is up with an IP address.
+ */
+bool wifiFastJoin();
+
+/**
+ * True if the last successful wifiFastJoin() used the cached parameters
+ */
+bool wifiFastJoinWasFast();
+
+/**
+ * Drop the cached join parameters (e.g. after credentials change)
+ */
+void wifiFastJoinInvalidate();
+
+#endif // WIFI_FAST_JOIN_H
@@ -13,6 +13,7 @@
  */
 
 #include <Arduino.h>
+#include <stdarg.h>
 #include "AZ3166WiFi.h"
 #include "OledDisplay.h"
 #include "SensorManager.h"
@@ -21,15 +22,57 @@
 // Azure IoT library (framework)
 #include "AzureIoTHub.h"
 #include "DeviceConfig.h"
+#include "PubSubClient.h"
+
+#include "Bench.h"
+#include "BootProfiler.h"
+#include "Connection.h"
+#include "Failover.h"
+#include "JsonStream.h"
+#include "LatencyProbe.h"
+#include "Log.h"
+#include "MessageProperties.h"
+#include "OtaUpdate.h"
+#include "OutboundQueue.h"
+#include "Placement.h"
+#include "PnP.h"
+#include "Rules.h"
+#include "SampleRing.h"
+#include "SensorSample.h"
+#include "Telemetry.h"
+#include "Trace.h"
+#include "Watchdog.h"
+#include "WiFiFastJoin.h"
 
 // Azure LED pin (directly next to the WiFi LED on the board)
 #define LED_AZURE   LED_BUILTIN
 
 // ===== APPLICATION STATE =====
-static bool hasWifi = false;
-static bool hasMqtt = false;
+static bool startupReported = false;
 static int messageCount = 0;
 static unsigned long lastTelemetryTime = 0;
+static bool traceUploadPending = false;
+static bool alertsOnly = false;     // publish only rule transitions, not periodic telemetry
+
+// Desired properties are parsed incrementally from the callback's payload
+// string, with a callback per value instead of a copy of the document
+static JsonStream desiredParser;
+
+struct DesiredUpdate
+{
+    bool rules;             // a "rules" array was seen and built
+    bool alertsOnlySet;
+    bool alertsOnly;
+    bool firmware;          // a "firmware" object was captured
+    int version;            // "$version" of the patch, for Plug and Play acks
+    uint16_t sensorsSet;    // "sensors" entries seen, bit per telemetry field
+    long sensorRates[TELEMETRY_FIELD_COUNT];
+    bool latencyProbeSet;
+    unsigned long latencyProbeInterval;
+    unsigned long latencyProbeCount;
+};
+static DesiredUpdate desiredUpdate;
+static char desiredFirmware[JSON_STREAM_CAPTURE_MAX];
 static RGB_LED rgbLed;
 
 /**
@@ -48,6 +91,8 @@ void updateDisplay(const char* line1, const char* line2 = NULL, const char* line
  */
 void updateLEDs()
 {
+    bool hasWifi = connectionHasWifi();
+    bool hasMqtt = connectionIsConnected();
     digitalWrite(LED_AZURE, hasMqtt ? HIGH : LOW);
     digitalWrite(LED_USER, (hasWifi && hasMqtt) ? HIGH : LOW);
     
@@ -59,174 +104,636 @@ void updateLEDs()
         rgbLed.turnOff();
 }
 
+/**
+ * Supervise the sampler and publisher only while connected; the MQTT
+ * deadline covers time spent disconnected
+ */
+void armTelemetryWatchdog(bool connected)
+{
+    unsigned long deadlineMs = connected
+        ? (unsigned long)DeviceConfig_GetSendInterval() * 1000 * WDT_MISSED_INTERVALS
+        : 0;
+    watchdogArm(WDT_SAMPLER, deadlineMs);
+    watchdogArm(WDT_PUBLISHER, deadlineMs);
+}
+
 // ===== APPLICATION CALLBACKS =====
 
 // Called when a C2D message is received
 void onC2DMessage(const char* topic, const char* payload, unsigned int length)
 {
-    Serial.println("App: C2D message received!");
-    Serial.print("  Content: ");
-    Serial.println(payload);
+    TRACE_INSTANT(RECEIVE_C2D, length);
+    if (latencyProbeEcho(payload))
+    {
+        return;
+    }
+    LOG_INFO("App: C2D message received!");
+    LOG_INFO("  Content: %s", payload);
     
     updateDisplay("C2D Message:", payload);
     
+    // Upload the binary trace ring from loop(), outside the MQTT callback
+    if (strcmp(payload, "dumpTrace") == 0)
+    {
+        traceUploadPending = true;
+        return;
+    }
+    
     // TODO: Add your C2D message handling here
     // Example: Parse JSON commands, trigger actions, etc.
 }
 
+// Patches carry settings at the top level, the full twin under "desired"
+static bool isDesiredPath(const char* path, const char* name)
+{
+    if (strncmp(path, "desired.", 8) == 0) path += 8;
+    return strcmp(path, name) == 0;
+}
+
+// Member name for paths inside the named desired object ("sensors.pressure")
+static const char* desiredMember(const char* path, const char* name)
+{
+    if (strncmp(path, "desired.", 8) == 0) path += 8;
+    size_t length = strlen(name);
+    return strncmp(path, name, length) == 0 && path[length] == '.' ? path + length + 1 : NULL;
+}
+
+static bool onDesiredBegin(JsonStream*, const char* path, bool isArray)
+{
+    if (isArray && isDesiredPath(path, "rules"))
+    {
+        rulesBuildBegin();
+        desiredUpdate.rules = true;
+    }
+    // Rule objects are captured whole and compiled one at a time; the
+    // firmware request is captured whole and started once the twin is valid
+    return !isArray && (isDesiredPath(path, "rules[]") || isDesiredPath(path, "firmware"));
+}
+
+static void onDesiredCaptured(JsonStream*, const char* path, const char* json)
+{
+    if (isDesiredPath(path, "rules[]"))
+    {
+        rulesBuildAdd(json);
+    }
+    else if (json != NULL && isDesiredPath(path, "firmware"))
+    {
+        strcpy(desiredFirmware, json);
+        desiredUpdate.firmware = true;
+    }
+}
+
+static void onDesiredValue(JsonStream*, const char* path, const char* value, bool isString)
+{
+    if (isDesiredPath(path, "rules[]"))
+    {
+        rulesBuildAdd(value);   // not an object: rejected
+    }
+    else if (!isString && isDesiredPath(path, "alertsOnly"))
+    {
+        desiredUpdate.alertsOnlySet = true;
+        desiredUpdate.alertsOnly = strcmp(value, "true") == 0;
+    }
+    else if (!isString && isDesiredPath(path, "$version"))
+    {
+        desiredUpdate.version = atoi(value);
+    }
+    else if (!isString && desiredMember(path, "sensors") != NULL)
+    {
+        const char* sensor = desiredMember(path, "sensors");
+        int field = telemetryFieldFind(sensor);
+        long rate;
+        if (field < 0 || !sensorSampleParseRate(value, &rate))
+        {
+            LOG_WARN("Ignoring sensors.%s: %s", sensor, value);
+            return;
+        }
+        desiredUpdate.sensorsSet |= TELEMETRY_FIELD_BIT(field);
+        desiredUpdate.sensorRates[field] = rate;
+    }
+    else if (!isString && desiredMember(path, "latencyProbe") != NULL)
+    {
+        const char* member = desiredMember(path, "latencyProbe");
+        desiredUpdate.latencyProbeSet = true;
+        if (strcmp(member, "intervalMs") == 0) desiredUpdate.latencyProbeInterval = strtoul(value, NULL, 10);
+        else if (strcmp(member, "count") == 0) desiredUpdate.latencyProbeCount = strtoul(value, NULL, 10);
+    }
+}
+
+/**
+ * Append a member to the acknowledgement. One that does not fit is left
+ * out (and logged), so the members already in stay a valid object.
+ */
+static bool ackAppend(char* ack, size_t size, int* length, const char* name, const char* format, ...)
+{
+    size_t start = *length;
+    if (start > 0 && start + 1 < size) ack[start++] = ',';
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(ack + start, size - start, format, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= size - start)
+    {
+        ack[*length] = '\0';
+        LOG_ERROR("Twin: no room to acknowledge %s", name);
+        return false;
+    }
+    *length = start + n;
+    return true;
+}
+
+/**
+ * Apply the settings this app understands from a desired properties patch
+ * or full twin and acknowledge them in the reported properties
+ */
+void applyDesiredProperties(const char* payload)
+{
+    memset(&desiredUpdate, 0, sizeof(desiredUpdate));
+    jsonStreamReset(&desiredParser);
+    jsonStreamFeedString(&desiredParser, payload);
+    if (!jsonStreamDone(&desiredParser))
+    {
+        // A twin larger than the MQTT packet buffer arrives cut short
+        LOG_WARN("Desired properties malformed or truncated (%u bytes, MQTT_MAX_PACKET_SIZE %d), ignored",
+            (unsigned)strlen(payload), MQTT_MAX_PACKET_SIZE);
+        return;
+    }
+    
+    char ack[256 + SENSOR_RATES_JSON_SIZE];
+    int ackLen = 0;
+    
+    if (desiredUpdate.rules)
+    {
+        bool loaded = rulesBuildCommit();
+        ackAppend(ack, sizeof(ack), &ackLen, "rules", "\"rules\":{\"count\":%d,\"accepted\":%s}",
+            rulesCount(), loaded ? "true" : "false");
+    }
+    
+    if (desiredUpdate.alertsOnlySet)
+    {
+        alertsOnly = desiredUpdate.alertsOnly;
+        // Modeled as a writable property, so acknowledged the PnP way
+        char member[160];
+        if (pnpWritableAck(member, sizeof(member), NULL, "alertsOnly",
+            alertsOnly ? "true" : "false", 200, desiredUpdate.version, "applied") < 0)
+        {
+            LOG_ERROR("Twin: no room to acknowledge %s", "alertsOnly");
+        }
+        else
+        {
+            ackAppend(ack, sizeof(ack), &ackLen, "alertsOnly", "%s", member);
+        }
+    }
+    
+    if (desiredUpdate.sensorsSet)
+    {
+        for (int i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+        {
+            if (desiredUpdate.sensorsSet & TELEMETRY_FIELD_BIT(i)) sensorSampleSetRate(i, desiredUpdate.sensorRates[i]);
+        }
+        char rates[SENSOR_RATES_JSON_SIZE];
+        if (!sensorSampleRatesJson(rates, sizeof(rates)))
+        {
+            LOG_ERROR("Twin: no room to acknowledge %s", "sensors");
+        }
+        else
+        {
+            ackAppend(ack, sizeof(ack), &ackLen, "sensors", "\"sensors\":%s", rates);
+        }
+    }
+    
+    if (desiredUpdate.latencyProbeSet)
+    {
+        latencyProbeStart(desiredUpdate.latencyProbeInterval, desiredUpdate.latencyProbeCount);
+        char settings[64];
+        if (latencyProbeSettingsJson(settings, sizeof(settings)))
+        {
+            ackAppend(ack, sizeof(ack), &ackLen, "latencyProbe", "\"latencyProbe\":%s", settings);
+        }
+    }
+    
+    // Progress is reported by the updater itself
+    if (desiredUpdate.firmware)
+    {
+        otaRequest(desiredFirmware);
+    }
+    
+    if (ackLen > 0)
+    {
+        char reported[sizeof(ack) + 2];
+        snprintf(reported, sizeof(reported), "{%s}", ack);
+        outboundEnqueue(LANE_CONTROL, OUTBOUND_REPORTED, reported);
+    }
+}
+
 // Called when desired properties are updated
 void onDesiredProperties(const char* payload, int version)
 {
-    Serial.println("App: Desired properties updated!");
-    Serial.print("  Version: ");
-    Serial.println(version);
-    Serial.print("  Payload: ");
-    Serial.println(payload);
+    TRACE_INSTANT(RECEIVE_DESIRED, strlen(payload));
+    LOG_INFO("App: Desired properties updated!");
+    LOG_INFO("  Version: %d", version);
+    LOG_INFO("  Payload: %s", payload);
     
     char versionStr[16];
     snprintf(versionStr, sizeof(versionStr), "%d", version);
     updateDisplay("Twin Update!", "Version:", versionStr);
     
-    // TODO: Parse JSON and apply property changes
-    // Example: Update telemetry interval, LED state, etc.
-    
-    // Acknowledge by reporting back the same values
-    // This confirms the device received and applied the changes
-    // Example: azureIoTUpdateReportedProperties("{\"ledState\":true}");
+    // Apply and acknowledge by reporting back the applied values
+    applyDesiredProperties(payload);
 }
 
 // Called when full twin is received
 void onTwinReceived(const char* payload)
 {
-    Serial.println("App: Full Device Twin received!");
-    Serial.println(payload);
+    TRACE_INSTANT(RECEIVE_TWIN, strlen(payload));
+    LOG_INFO("App: Full Device Twin received!");
+    LOG_INFO("%s", payload);
     
     updateDisplay("Twin Received", "See Serial");
     
-    // TODO: Parse the twin JSON to get initial state
-    // The twin contains both "desired" and "reported" sections
+    // Initial state comes from the "desired" section
+    applyDesiredProperties(payload);
 }
 
-// ===== WIFI INITIALIZATION =====
-void initWiFi()
+// ===== SEND TELEMETRY =====
+
+/**
+ * Read the due sensors into the sample ring. Runs whether or not the hub
+ * is connected; the consumers below pick the sample up.
+ */
+void sampleSensors()
 {
-    updateDisplay("Connecting WiFi");
-    
-    Serial.println("Connecting to WiFi (credentials from EEPROM)...");
+    TRACE_BEGIN(SENSOR_READ);
+    SensorSample* sample = sampleRingBegin();
+    sensorSampleRead(sample);
+    sampleRingCommit();
+    TRACE_END(SENSOR_READ, sample->fresh != 0);
+    watchdogCheckIn(WDT_SAMPLER);
+}
+
+/**
+ * Time the sample was taken, for consumers that read it later
+ */
+static time_t sampleTime(const SensorSample& sample)
+{
+    return time(NULL) - (time_t)((millis() - sample.millis) / 1000);
+}
+
+// ISO 8601
+static void sampleTimestamp(const SensorSample& sample, char* buffer, size_t size)
+{
+    time_t taken = sampleTime(sample);
+    strftime(buffer, size, "%Y-%m-%dT%H:%M:%SZ", gmtime(&taken));
+}
+
+/**
+ * Rule transitions go out as their own messages in the alert lane
+ */
+void evaluateRules()
+{
+    const SensorSample* sample;
+    while ((sample = sampleRingPeek(SAMPLE_CONSUMER_RULES)) != NULL)
+    {
+        char timestamp[25];
+        sampleTimestamp(*sample, timestamp, sizeof(timestamp));
+        RuleEvent events[RULES_EVENTS_MAX];
+        int eventCount = rulesEvaluate(*sample, events, RULES_EVENTS_MAX);
+        for (int i = 0; i < eventCount; i++)
+        {
+            char alertJson[192];
+            snprintf(alertJson, sizeof(alertJson),
+                "{\"deviceId\":\"%s\",\"timestamp\":\"%s\",\"alert\":\"%s\",\"state\":\"%s\",\"sensor\":\"%s\",\"value\":%.2f,\"threshold\":%.2f}",
+                azureIoTGetDeviceId(), timestamp, events[i].id, events[i].raised ? "raised" : "cleared",
+                events[i].sensor, events[i].value, events[i].threshold);
+            MessageProperties alertProps;
+            messagePropertiesInitJson(&alertProps);
+            if (!messagePropertiesAdd(&alertProps, "alert", events[i].id)
+                || !messagePropertiesAdd(&alertProps, "alertState", events[i].raised ? "raised" : "cleared"))
+            {
+                LOG_ERROR("Alert %s: properties do not fit", events[i].id);
+            }
+            LOG_INFO("Alert %s %s (%s = %.2f)", events[i].id,
+                events[i].raised ? "raised" : "cleared", events[i].sensor, events[i].value);
+            outboundEnqueue(LANE_ALERT, OUTBOUND_TELEMETRY, alertJson, alertProps.encoded);
+        }
+        sampleRingRelease(SAMPLE_CONSUMER_RULES);
+    }
+}
+
+/**
+ * Show the key values of the newest sample
+ */
+void refreshDisplay()
+{
+    const SensorSample* sample = sampleRingLatest(SAMPLE_CONSUMER_DISPLAY);
+    if (sample == NULL)
+    {
+        return;
+    }
+    // Same samples as the periodic messages
+    if (!alertsOnly && sample->fresh != 0)
+    {
+        char lines[3][32];
+        int lineCount = telemetryDisplayLines(*sample, lines, 3);
+        updateDisplay(lines[0], lineCount > 1 ? lines[1] : NULL, lineCount > 2 ? lines[2] : NULL);
+    }
+    sampleRingRelease(SAMPLE_CONSUMER_DISPLAY);
+}
+
+/**
+ * Queue the telemetry message(s) for one sample; the outbound queue holds
+ * them until the hub is connected
+ */
+static void publishSample(const SensorSample& sample)
+{
+    messageCount++;
     
-    // WiFi.begin() with no parameters reads credentials from EEPROM
-    if (WiFi.begin() == WL_CONNECTED)
+    // Active rules are also tagged on the telemetry (e.g. temperatureAlert=true)
+    MessageProperties props;
+    char messageId[20];
+    snprintf(messageId, sizeof(messageId), "%08lx-%d", (unsigned long)messageBootNonce(), messageCount);
+    bool queued;
+    if (pnpActive())
     {
-        hasWifi = true;
-        IPAddress ip = WiFi.localIP();
-        
-        Serial.print("WiFi connected! IP: ");
-        Serial.println(ip);
-        
-        updateDisplay("WiFi Connected", ip.get_address());
+        // One message per component, named by $.sub, carrying only the
+        // fields the model declares for it
+        queued = true;
+        for (int c = 0; c < TELEMETRY_COMPONENT_COUNT; c++)
+        {
+            char payload[320];
+            payload[0] = '{';
+            int fieldsLen = telemetryJsonFields(sample, payload + 1, sizeof(payload) - 2, c);
+            if (fieldsLen == 0) continue;   // none of its sensors read this time
+            if (fieldsLen < 0)
+            {
+                LOG_ERROR("Telemetry #%d does not fit the payload buffer", messageCount);
+                return;
+            }
+            strcpy(payload + 1 + fieldsLen, "}");
+            char componentId[sizeof(messageId) + 1 + TELEMETRY_COMPONENT_NAME_MAX];
+            int idLen = snprintf(componentId, sizeof(componentId), "%s-%s", messageId, telemetryComponentName(c));
+            messagePropertiesInitJson(&props);
+            if (idLen < 0 || idLen >= (int)sizeof(componentId)
+                || !messagePropertiesSetMessageId(&props, componentId)
+                || !messagePropertiesSetComponent(&props, telemetryComponentName(c))
+                || !rulesActiveProperties(&props))
+            {
+                LOG_ERROR("Telemetry #%d %s: properties do not fit", messageCount, telemetryComponentName(c));
+            }
+            LOG_INFO("Queueing telemetry #%d %s (%d bytes)", messageCount, telemetryComponentName(c), fieldsLen + 2);
+            LOG_DEBUG("  %s", payload);
+            queued = outboundEnqueue(LANE_TELEMETRY, OUTBOUND_TELEMETRY, payload, props.encoded) && queued;
+        }
     }
     else
     {
-        hasWifi = false;
-        Serial.println("WiFi connection failed!");
-        Serial.println("Use the serial CLI to configure:");
-        Serial.println("  set_wifi <ssid> <password>");
-        updateDisplay("WiFi Failed!", "Use serial CLI");
+        // messageId/deviceId/timestamp, then the sensor fields generated
+        // from the telemetry schema (Telemetry.h)
+        char timestamp[25];
+        sampleTimestamp(sample, timestamp, sizeof(timestamp));
+        char payload[700];
+        int headerLen = snprintf(payload, sizeof(payload),
+            "{\"messageId\":%d,\"deviceId\":\"%s\",\"timestamp\":\"%s\",",
+            messageCount, azureIoTGetDeviceId(), timestamp);
+        int fieldsLen = telemetryJsonFields(sample, payload + headerLen, sizeof(payload) - headerLen - 1);
+        if (fieldsLen < 0)
+        {
+            LOG_ERROR("Telemetry #%d does not fit the payload buffer", messageCount);
+            return;
+        }
+        strcpy(payload + headerLen + fieldsLen, "}");
+        LOG_INFO("Queueing telemetry #%d (%d bytes)", messageCount, headerLen + fieldsLen + 1);
+        LOG_DEBUG("  %s", payload);
+        
+        // JSON body so hub routing can query it
+        messagePropertiesInitJson(&props);
+        if (!messagePropertiesSetMessageId(&props, messageId) || !rulesActiveProperties(&props))
+        {
+            LOG_ERROR("Telemetry #%d: properties do not fit", messageCount);
+        }
+        queued = outboundEnqueue(LANE_TELEMETRY, OUTBOUND_TELEMETRY, payload, props.encoded);
+    }
+    
+    if (!queued)
+    {
+        Screen.print(3, "Queue Failed!");
+    }
+    else if (!connectionIsConnected())
+    {
+        char queuedStr[24];
+        snprintf(queuedStr, sizeof(queuedStr), "Queued: %d",
+            outboundDepth(LANE_TELEMETRY) + outboundDepth(LANE_BACKLOG));
+        Screen.print(3, queuedStr);
     }
 }
 
-// ===== SEND TELEMETRY =====
-void sendTelemetry()
+/**
+ * Periodic telemetry for the samples not yet published
+ */
+void publishTelemetry()
 {
-    if (!hasMqtt)
+    const SensorSample* sample;
+    while ((sample = sampleRingPeek(SAMPLE_CONSUMER_PUBLISHER)) != NULL)
     {
-        return;
+        // Nothing due (slow or disabled sensors): no periodic message
+        if (!alertsOnly && sample->fresh != 0)
+        {
+            publishSample(*sample);
+        }
+        else if (outboundIdle())
+        {
+            // Nothing to send and nothing stuck: as good as a message accepted
+            watchdogCheckIn(WDT_PUBLISHER);
+        }
+        sampleRingRelease(SAMPLE_CONSUMER_PUBLISHER);
     }
-    
-    // Build payload: sensor JSON with messageId/deviceId/timestamp prepended
-    messageCount++;
-    char sensorJson[512];
-    if (!Sensors.toJson(sensorJson, sizeof(sensorJson))) return;
+}
 
-    // Get ISO 8601 timestamp
-    char timestamp[25];
-    time_t now = time(NULL);
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+// ===== CONNECTION =====
 
-    // Build final payload with messageId, deviceId, timestamp, and all sensor data
-    char payload[700];
-    snprintf(payload, sizeof(payload),
-        "{\"messageId\":%d,\"deviceId\":\"%s\",\"timestamp\":\"%s\",%s",
-        messageCount, azureIoTGetDeviceId(), timestamp, sensorJson + 1);
-    
-    Serial.print("Sending telemetry: ");
-    Serial.println(payload);
-    
-    // Update display with key values
-    float temp = Sensors.getTemperature();
-    float hum = Sensors.getHumidity();
-    float press = Sensors.getPressure();
-    
-    char tempStr[32];
-    char humidStr[32];
-    char pressStr[32];
-    snprintf(tempStr, sizeof(tempStr), "Temp: %.1f C", temp);
-    snprintf(humidStr, sizeof(humidStr), "Humidity: %.1f%%", hum);
-    snprintf(pressStr, sizeof(pressStr), "Press: %.1f hPa", press);
+/**
+ * Report the device's initial state, once per boot
+ */
+COLD_PATH void reportStartup()
+{
+    char bootJson[128];
+    if (!bootProfileToJson(bootJson, sizeof(bootJson)))
+    {
+        strcpy(bootJson, "{}");
+    }
+    char resetJson[128];
+    if (!watchdogResetReportJson(resetJson, sizeof(resetJson)))
+    {
+        strcpy(resetJson, "{}");
+    }
+    char firmwareJson[192];
+    if (!otaReportJson(firmwareJson, sizeof(firmwareJson)))
+    {
+        strcpy(firmwareJson, "{}");
+    }
+    char sensorsJson[SENSOR_RATES_JSON_SIZE];
+    if (!sensorSampleRatesJson(sensorsJson, sizeof(sensorsJson)))
+    {
+        strcpy(sensorsJson, "{}");
+    }
+    char failoverJson[192];
+    if (!failoverReportJson(failoverJson, sizeof(failoverJson)))
+    {
+        strcpy(failoverJson, "{}");
+    }
+    char reportedJson[960];
+    snprintf(reportedJson, sizeof(reportedJson),
+        "{\"firmwareVersion\":\"%s\",\"telemetryInterval\":%d,\"deviceStarted\":true,\"bootProfile\":%s,\"lastReset\":%s,\"firmware\":%s,\"sensors\":%s,\"failover\":%s}",
+        FIRMWARE_VERSION, DeviceConfig_GetSendInterval(), bootJson, resetJson, firmwareJson, sensorsJson, failoverJson);
+    outboundEnqueue(LANE_CONTROL, OUTBOUND_REPORTED, reportedJson);
+}
+
+/**
+ * A hub connection came up, at boot or after a reconnect
+ */
+COLD_PATH void onConnected()
+{
+    watchdogCheckIn(WDT_MQTT);
+    armTelemetryWatchdog(true);
     
-    updateDisplay(tempStr, humidStr, pressStr);
+    if (!startupReported)
+    {
+        startupReported = true;
+        LOG_INFO("========================================");
+        LOG_INFO("  Setup complete!");
+        LOG_INFO("  - D2C: Telemetry every %d sec", DeviceConfig_GetSendInterval());
+        LOG_INFO("  - C2D: Listening for messages");
+        LOG_INFO("  - Twin: Enabled");
+        LOG_INFO("========================================");
+        bootProfilePrint();
+        LOG_INFO("Azure CLI commands:");
+        LOG_INFO("  C2D: az iot device c2d-message send --hub-name YOUR_HUB --device-id YOUR_DEVICE --data \"Hello!\"");
+        LOG_INFO("  Twin: az iot hub device-twin update --hub-name YOUR_HUB --device-id YOUR_DEVICE --desired '{\"prop\":true}'");
+        reportStartup();
+    }
+    updateDisplay("Ready!", "Sending data...");
     
-    // Build message properties (optional)
-    const char* props = (temp > 30) ? "temperatureAlert=true" : NULL;
+    // The full twin on every connection: desired changes made while
+    // offline are not pushed again
+    azureIoTRequestTwin();
     
-    // Send telemetry
-    if (azureIoTSendTelemetry(payload, props))
+    char connectionJson[256];
+    // How far behind the sample consumers got
+    char samplesJson[256];
+    if (!sampleRingReportJson(samplesJson, sizeof(samplesJson)))
     {
-        Screen.print(3, "Sent OK");
+        strcpy(samplesJson, "{}");
     }
-    else
+    if (connectionReportJson(connectionJson, sizeof(connectionJson)))
     {
-        Screen.print(3, "Send Failed!");
+        char reported[sizeof(connectionJson) + sizeof(samplesJson) + 32];
+        snprintf(reported, sizeof(reported), "{\"connection\":%s,\"samples\":%s}",
+            connectionJson, samplesJson);
+        outboundEnqueue(LANE_CONTROL, OUTBOUND_REPORTED, reported);
+    }
+}
+
+/**
+ * Follow the connection state machine: LEDs, display and the work tied
+ * to the hub connection
+ */
+COLD_PATH void onConnectionChange(ConnectionState from, ConnectionState to)
+{
+    if (from == CONN_CONNECTED)
+    {
+        armTelemetryWatchdog(false);
+    }
+    
+    // The hub deadline bounds each join, registration and connect; waiting
+    // for WiFi or a retry is not a stall, so it pauses there
+    watchdogArm(WDT_MQTT, to == CONN_WIFI_DOWN || to == CONN_BACKOFF ? 0 : WDT_MQTT_DEADLINE_MS);
+    updateLEDs();
+    
+    switch (to)
+    {
+    case CONN_WIFI_JOINING:
+        updateDisplay("Connecting WiFi");
+        break;
+    case CONN_WIFI_DOWN:
+        if (from == CONN_WIFI_JOINING)
+        {
+            updateDisplay("WiFi Failed!", "Use serial CLI");
+        }
+        break;
+    case CONN_PROVISIONING:
+        if (from == CONN_WIFI_JOINING)
+        {
+            updateDisplay("WiFi Connected", WiFi.localIP().get_address());
+        }
+        Screen.print(2, "Init IoT Hub...");
+        break;
+    case CONN_CONNECTING:
+        if (from == CONN_PROVISIONING)
+        {
+            // Hub hostname is known after init (parsed or assigned by DPS)
+            failoverProvisioned();
+            azureIoTSetC2DCallback(onC2DMessage);
+            azureIoTSetDesiredPropertiesCallback(onDesiredProperties);
+            azureIoTSetTwinReceivedCallback(onTwinReceived);
+        }
+        Screen.print(2, "Connecting...");
+        break;
+    case CONN_CONNECTED:
+        onConnected();
+        break;
+    case CONN_BACKOFF:
+        Screen.print(2, from == CONN_PROVISIONING ? "IoT Init Failed!" :
+            from == CONN_CONNECTING ? "Connect Failed!" : connectionStateText(to));
+        break;
+    default:
+        break;
     }
 }
 
 // ===== SETUP =====
-void setup()
+COLD_PATH void setup()
 {
     Serial.begin(115200);
+    logInit();
+    TRACE_INSTANT(BOOT, 0);
+    
+    // Hardware watchdog from here on. The MQTT deadline resets a device
+    // stuck joining, registering or connecting; it is paused while WiFi is
+    // down and in backoff, so the device keeps retrying through an outage
+    watchdogInit();
+    watchdogArm(WDT_MQTT, WDT_MQTT_DEADLINE_MS);
+    otaInit();
     delay(1000);
     
-    Serial.println();
-    Serial.println("========================================");
-    Serial.println("  Azure IoT Hub Demo - MXChip AZ3166");
-    Serial.println("========================================");
-    Serial.println();
-    Serial.printf("Profile:          %s\n", DeviceConfig_GetProfileName());
-    Serial.printf("WiFi SSID:        %s\n", DeviceConfig_GetWifiSsid());
-    Serial.printf("WiFi password len:%d\n", (int)strlen(DeviceConfig_GetWifiPassword()));
+    LOG_INFO("========================================");
+    LOG_INFO("  Azure IoT Hub Demo - MXChip AZ3166");
+    LOG_INFO("========================================");
+    LOG_INFO("Firmware:         %s", FIRMWARE_VERSION);
+    LOG_INFO("Profile:          %s", DeviceConfig_GetProfileName());
+    LOG_INFO("WiFi SSID:        %s", DeviceConfig_GetWifiSsid());
+    LOG_INFO("WiFi password len:%d", (int)strlen(DeviceConfig_GetWifiPassword()));
 #if CONNECTION_PROFILE == PROFILE_IOTHUB_SAS
-    Serial.printf("Connection str len:%d\n", (int)strlen(DeviceConfig_GetConnectionString()));
+    LOG_INFO("Connection str len:%d", (int)strlen(DeviceConfig_GetConnectionString()));
 #endif
 #if CONNECTION_PROFILE == PROFILE_IOTHUB_CERT
-    Serial.printf("CA cert len:      %d\n", (int)strlen(DeviceConfig_GetCACert()));
-    Serial.printf("Client cert len:  %d\n", (int)strlen(DeviceConfig_GetClientCert()));
-    Serial.printf("Client key len:   %d\n", (int)strlen(DeviceConfig_GetClientKey()));
+    LOG_INFO("CA cert len:      %d", (int)strlen(DeviceConfig_GetCACert()));
+    LOG_INFO("Client cert len:  %d", (int)strlen(DeviceConfig_GetClientCert()));
+    LOG_INFO("Client key len:   %d", (int)strlen(DeviceConfig_GetClientKey()));
 #endif
 #if CONNECTION_PROFILE == PROFILE_DPS_SAS || CONNECTION_PROFILE == PROFILE_DPS_SAS_GROUP
-    Serial.printf("DPS endpoint:     %s\n", DeviceConfig_GetDpsEndpoint());
-    Serial.printf("Scope ID:         %s\n", DeviceConfig_GetScopeId());
-    Serial.printf("Registration ID:  %s\n", DeviceConfig_GetRegistrationId());
-    Serial.printf("Symmetric key len:%d\n", (int)strlen(DeviceConfig_GetSymmetricKey()));
+    LOG_INFO("DPS endpoint:     %s", DeviceConfig_GetDpsEndpoint());
+    LOG_INFO("Scope ID:         %s", DeviceConfig_GetScopeId());
+    LOG_INFO("Registration ID:  %s", DeviceConfig_GetRegistrationId());
+    LOG_INFO("Symmetric key len:%d", (int)strlen(DeviceConfig_GetSymmetricKey()));
 #endif
 #if CONNECTION_PROFILE == PROFILE_DPS_CERT
-    Serial.printf("DPS endpoint:     %s\n", DeviceConfig_GetDpsEndpoint());
-    Serial.printf("Scope ID:         %s\n", DeviceConfig_GetScopeId());
-    Serial.printf("CA cert len:      %d\n", (int)strlen(DeviceConfig_GetCACert()));
-    Serial.printf("Client cert len:  %d\n", (int)strlen(DeviceConfig_GetClientCert()));
-    Serial.printf("Client key len:   %d\n", (int)strlen(DeviceConfig_GetClientKey()));
+    LOG_INFO("DPS endpoint:     %s", DeviceConfig_GetDpsEndpoint());
+    LOG_INFO("Scope ID:         %s", DeviceConfig_GetScopeId());
+    LOG_INFO("CA cert len:      %d", (int)strlen(DeviceConfig_GetCACert()));
+    LOG_INFO("Client cert len:  %d", (int)strlen(DeviceConfig_GetClientCert()));
+    LOG_INFO("Client key len:   %d", (int)strlen(DeviceConfig_GetClientKey()));
 #endif
-    Serial.printf("Send interval:    %d s\n", DeviceConfig_GetSendInterval());
-    Serial.println();
+    LOG_INFO("Send interval:    %d s", DeviceConfig_GetSendInterval());
     
     // Initialize OLED
     Screen.init();
@@ -236,73 +743,21 @@ void setup()
     pinMode(LED_AZURE, OUTPUT);
     digitalWrite(LED_AZURE, LOW);
     
-    // Initialize WiFi (credentials from EEPROM)
-    initWiFi();
-    if (!hasWifi)
-    {
-        Serial.println("Setup failed: No WiFi");
-        return;
-    }
-    delay(1000);
-    
-    // SensorManager is auto-initialized by the framework
-    Serial.println("Sensors ready (via SensorManager)");
+    // SensorManager is auto-initialized by the framework; sensorSampleInit
+    // applies the per-sensor rates and powers down disabled ones
+    sensorSampleInit();
+    LOG_INFO("Sensors ready (via SensorManager)");
     
-    // Initialize Azure IoT
-    Screen.print(2, "Init IoT Hub...");
-    if (!azureIoTInit())
-    {
-        Serial.println("Setup failed: IoT init failed");
-        Screen.print(2, "IoT Init Failed!");
-        return;
-    }
-    
-    // Register callbacks
-    azureIoTSetC2DCallback(onC2DMessage);
-    azureIoTSetDesiredPropertiesCallback(onDesiredProperties);
-    azureIoTSetTwinReceivedCallback(onTwinReceived);
-    
-    // Connect to IoT Hub
-    Screen.print(2, "Connecting...");
-    if (!azureIoTConnect())
-    {
-        Serial.println("Setup failed: IoT connection failed");
-        Screen.print(2, "Connect Failed!");
-        hasMqtt = false;
-        updateLEDs();
-        return;
-    }
+    // Built-in alert rule until the twin delivers "rules"
+    rulesLoadDefaults();
     
-    hasMqtt = true;
-    updateLEDs();
-    
-    // Setup complete
-    Serial.println();
-    Serial.println("========================================");
-    Serial.println("  Setup complete!");
-    char intervalMsg[48];
-    snprintf(intervalMsg, sizeof(intervalMsg), "  - D2C: Telemetry every %d sec", DeviceConfig_GetSendInterval());
-    Serial.println(intervalMsg);
-    Serial.println("  - C2D: Listening for messages");
-    Serial.println("  - Twin: Enabled");
-    Serial.println("========================================");
-    Serial.println();
-    Serial.println("Azure CLI commands:");
-    Serial.println("  C2D: az iot device c2d-message send --hub-name YOUR_HUB --device-id YOUR_DEVICE --data \"Hello!\"");
-    Serial.println("  Twin: az iot hub device-twin update --hub-name YOUR_HUB --device-id YOUR_DEVICE --desired '{\"prop\":true}'");
-    Serial.println();
-    
-    updateDisplay("Ready!", "Sending data...");
+    desiredParser.onBegin = onDesiredBegin;
+    desiredParser.onValue = onDesiredValue;
+    desiredParser.onCaptured = onDesiredCaptured;
     
-    // Request initial twin
-    azureIoTRequestTwin();
-    
-    // Report initial state
-    char reportedJson[128];
-    snprintf(reportedJson, sizeof(reportedJson),
-        "{\"firmwareVersion\":\"1.0.0\",\"telemetryInterval\":%d,\"deviceStarted\":true}",
-        DeviceConfig_GetSendInterval());
-    azureIoTUpdateReportedProperties(reportedJson);
+    // WiFi, provisioning and the hub connection run as a state machine
+    // from here on; onConnectionChange follows it
+    connectionStart(onConnectionChange);
     
     lastTelemetryTime = millis();
 }
@@ -311,22 +766,95 @@ void setup()
 void loop()
 {
     // Process Azure IoT messages
-    azureIoTLoop();
-    
-    // Update connection status and LEDs
-    hasMqtt = azureIoTIsConnected();
-    updateLEDs();
+    if (connectionIsConnected())
+    {
+        TRACE_BEGIN(MQTT_LOOP);
+        azureIoTLoop();
+        TRACE_END(MQTT_LOOP, 0);
+    }
     
-    // Send telemetry at regular intervals
+    // Detect drops, back off and reconnect
+    connectionLoop();
+    bool hasWifi = connectionHasWifi();
+    bool hasMqtt = connectionIsConnected();
     if (hasMqtt)
     {
-        unsigned long now = millis();
-        if (now - lastTelemetryTime >= (unsigned long)DeviceConfig_GetSendInterval() * 1000)
+        watchdogCheckIn(WDT_MQTT);
+    }
+    
+    // A connect in progress has the network to itself
+    bool connecting = connectionBusy();
+    if (hasWifi && !connecting)
+    {
+        otaLoop();
+    }
+    
+    // Register with DPS again after a sustained outage; a move to another
+    // hub is reported once connected there
+    if (!connecting && failoverLoop(hasWifi, hasMqtt))
+    {
+        char failoverJson[192];
+        if (failoverReportJson(failoverJson, sizeof(failoverJson)))
+        {
+            char reported[sizeof(failoverJson) + 16];
+            snprintf(reported, sizeof(reported), "{\"failover\":%s}", failoverJson);
+            outboundEnqueue(LANE_CONTROL, OUTBOUND_REPORTED, reported);
+        }
+    }
+    
+    // Round-trip probes, when a run was requested through the twin
+    if (latencyProbeLoop(hasMqtt))
+    {
+        char latencyJson[320];
+        if (latencyProbeReportJson(latencyJson, sizeof(latencyJson)))
+        {
+            char reported[sizeof(latencyJson) + 16];
+            snprintf(reported, sizeof(reported), "{\"latency\":%s}", latencyJson);
+            outboundEnqueue(LANE_CONTROL, OUTBOUND_REPORTED, reported);
+        }
+    }
+    
+    // 't' in the serial monitor dumps the trace ring for tools/trace_decode.py,
+    // 'b' runs the telemetry/receive benchmark in BENCH_ENABLED builds (src/Bench.h)
+    while (Serial.available() > 0)
+    {
+        int key = Serial.read();
+        if (key == 't')
+        {
+            traceDumpSerial();
+        }
+        else if (key == 'b')
         {
-            sendTelemetry();
-            lastTelemetryTime = now;
+            benchRun();
         }
     }
+    if (traceUploadPending && hasMqtt)
+    {
+        traceUploadPending = false;
+        traceUpload();
+    }
+    
+    // Sample at regular intervals, connected or not
+    unsigned long now = millis();
+    if (now - lastTelemetryTime >= (unsigned long)DeviceConfig_GetSendInterval() * 1000)
+    {
+        sampleSensors();
+        lastTelemetryTime = now;
+    }
+    
+    // Each consumer reads the sample ring at its own pace
+    evaluateRules();
+    refreshDisplay();
+    publishTelemetry();
+    
+    // Drain the outbound lanes, alerts first
+    if (outboundService(hasMqtt) > 0)
+    {
+        Screen.print(3, "Sent OK");
+    }
+    
+    // Feed the hardware watchdog, or reset if a subsystem has stalled
+    watchdogService();
     
     delay(100);
 }
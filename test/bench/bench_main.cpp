@@ -0,0 +1,324 @@
+/*
+ * Host benchmark of the telemetry serializer, the receive parsers, the
+ * rules engine, the outbound scheduler and the delta patcher
+ *
+ * Each workload runs BENCH_ITERATIONS times inside benchMeasure() on fixed
+ * inputs. tools/native_bench.py runs one workload per process under
+ * Callgrind, collecting only inside benchMeasure(), so setup is not counted
+ * and the instruction counts repeat exactly from run to run:
+ *
+ *   native_bench --list
+ *   native_bench telemetry_json      ->  BENCH telemetry_json 20 251
+ *
+ * (workload, iterations, bytes produced or consumed). Run alone it is only
+ * a smoke test; the numbers come from Callgrind.
+ */
+
+#include <stdarg.h>
+#include <vector>
+
+#include <Arduino.h>
+#include "AzureIoTHub.h"
+
+#include "DeltaPatch.h"
+#include "JsonLite.h"
+#include "JsonStream.h"
+#include "Log.h"
+#include "MessageProperties.h"
+#include "OutboundQueue.h"
+#include "PatchBuilder.h"
+#include "Rules.h"
+#include "Telemetry.h"
+#include "Trace.h"
+#include "Watchdog.h"
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 20
+#endif
+
+// ---- The firmware services the modules call ----
+
+static unsigned long clockMs = 0;
+
+unsigned long millis()
+{
+    return clockMs;
+}
+
+unsigned long micros()
+{
+    return clockMs * 1000;
+}
+
+void logWrite(int, const char*, ...)
+{
+}
+
+void traceRecord(uint8_t, uint8_t, uint16_t)
+{
+}
+
+void watchdogCheckIn(WatchdogSubsystem)
+{
+}
+
+static size_t published = 0;
+
+bool azureIoTSendTelemetry(const char* payload, const char*)
+{
+    published += strlen(payload);
+    return true;
+}
+
+bool azureIoTUpdateReportedProperties(const char* json)
+{
+    published += strlen(json);
+    return true;
+}
+
+// ---- Inputs, as in src/Bench.cpp ----
+
+// Every field fresh: the largest payloads the device builds
+static const SensorSample benchSample =
+{
+    123456, 0xFFFF, 0xFFFF,
+    25.31f, 48.72f, 1013.25f,
+    { 12, -998, 31 },
+    { 1250, -3500, 70 },
+    { 300, -105, 512 },
+};
+
+// A full twin as delivered after a connect, settings the app parses included
+static const char benchTwin[] =
+    "{\"desired\":{\"alertsOnly\":false,"
+    "\"sensors\":{\"temperature\":true,\"humidity\":true,\"pressure\":60,\"accelerometer\":true,"
+    "\"gyroscope\":false,\"magnetometer\":300},"
+    "\"latencyProbe\":{\"intervalMs\":0,\"count\":0},\"$version\":42},"
+    "\"reported\":{\"firmwareVersion\":\"1.0.0\",\"alertsOnly\":{\"value\":false,\"ac\":200,\"av\":41},"
+    "\"connection\":{\"state\":\"connected\",\"connects\":3,\"failures\":1},\"$version\":97}}";
+
+static const char benchRules[] =
+    "[{\"id\":\"hot\",\"sensor\":\"temperature\",\"op\":\">\",\"value\":30,\"hysteresis\":1,\"for\":10},"
+    "{\"id\":\"rise\",\"sensor\":\"temperature\",\"op\":\"rate>\",\"value\":0.5},"
+    "{\"id\":\"damp\",\"sensor\":\"humidity\",\"op\":\">\",\"value\":45},"
+    "{\"id\":\"bump\",\"sensor\":\"accelerometer.z\",\"op\":\"<\",\"value\":500}]";
+
+// ---- Workloads ----
+
+static int benchTelemetryJson()
+{
+    char payload[700];
+    int headerLen = snprintf(payload, sizeof(payload),
+        "{\"messageId\":%d,\"deviceId\":\"%s\",\"timestamp\":\"%s\",", 1234, "bench", "2024-01-01T00:00:00Z");
+    int fieldsLen = telemetryJsonFields(benchSample, payload + headerLen, sizeof(payload) - headerLen - 1);
+    return headerLen + fieldsLen + 1;
+}
+
+static int benchMessageProperties()
+{
+    int total = 0;
+    for (int c = 0; c < TELEMETRY_COMPONENT_COUNT; c++)
+    {
+        MessageProperties props;
+        messagePropertiesInitJson(&props);
+        messagePropertiesSetMessageId(&props, "1234");
+        messagePropertiesSetComponent(&props, telemetryComponentName(c));
+        messagePropertiesAdd(&props, "alert", "temperature > 30");
+        total += strlen(props.encoded);
+    }
+    return total;
+}
+
+static JsonStream twinParser;
+static int twinValues = 0;
+
+static void onTwinValue(JsonStream*, const char*, const char*, bool)
+{
+    twinValues++;
+}
+
+static int benchReceiveTwin()
+{
+    jsonStreamReset(&twinParser);
+    jsonStreamFeedString(&twinParser, benchTwin, sizeof(benchTwin) - 1);
+    return sizeof(benchTwin) - 1;
+}
+
+static int benchJsonLookup()
+{
+    const char* desired = jsonFind(benchTwin, "desired");
+    const char* sensors = jsonFind(desired, "sensors");
+    int value = 0;
+    bool flag = false;
+    char state[16];
+    jsonGetBool(desired, "alertsOnly", &flag);
+    jsonGetInt(sensors, "pressure", &value);
+    jsonGetInt(sensors, "magnetometer", &value);
+    jsonGetInt(jsonFind(desired, "latencyProbe"), "intervalMs", &value);
+    jsonGetInt(desired, "$version", &value);
+    jsonGetString(jsonFind(jsonFind(benchTwin, "reported"), "connection"), "state", state, sizeof(state));
+    return sizeof(benchTwin) - 1;
+}
+
+static int benchRulesEvaluate()
+{
+    // Alternate across the thresholds so rules fire and clear
+    static SensorSample sample = benchSample;
+    sample.millis += 1000;
+    sample.temperature = sample.temperature > 30 ? 25.31f : 31.5f;
+    sample.humidity = sample.humidity > 45 ? 40.0f : 48.72f;
+    RuleEvent events[RULES_MAX];
+    rulesEvaluate(sample, events, RULES_MAX);
+    return sizeof(sample);
+}
+
+static int benchOutbound()
+{
+    // A minute on: every lane has its burst of tokens again
+    clockMs += 60000;
+    char payload[320];
+    int length = telemetryJsonFields(benchSample, payload, sizeof(payload));
+    published = 0;
+    outboundEnqueue(LANE_ALERT, OUTBOUND_TELEMETRY, payload, "alert=hot");
+    outboundEnqueue(LANE_CONTROL, OUTBOUND_REPORTED, "{\"alertsOnly\":{\"value\":false,\"ac\":200,\"av\":41}}");
+    for (int i = 0; i < 4; i++)
+    {
+        outboundEnqueue(LANE_TELEMETRY, OUTBOUND_TELEMETRY, payload, "$.ct=application%2Fjson&$.ce=utf-8");
+    }
+    while (outboundService(true) > 0) {}
+    return length > 0 ? published : 0;
+}
+
+static Bytes oldImage;
+static Bytes newImage;
+static Bytes patchBytes;
+static size_t patchedBytes = 0;
+
+static bool readOld(uint32_t offset, uint8_t* data, size_t length)
+{
+    if (offset + length > oldImage.size()) return false;
+    memcpy(data, &oldImage[offset], length);
+    return true;
+}
+
+static bool writeNew(const uint8_t*, size_t length)
+{
+    patchedBytes += length;
+    return true;
+}
+
+static int benchDeltaPatch()
+{
+    DeltaPatch patch;
+    deltaPatchInit(&patch);
+    patchedBytes = 0;
+    // In the 512-byte chunks the OTA download hands over
+    for (size_t offset = 0; offset < patchBytes.size(); offset += 512)
+    {
+        size_t length = patchBytes.size() - offset < 512 ? patchBytes.size() - offset : 512;
+        deltaPatchFeed(&patch, &patchBytes[offset], length, readOld, writeNew);
+    }
+    deltaPatchFeed(&patch, NULL, 0, readOld, writeNew);
+    return patchedBytes;
+}
+
+// ---- Setup, outside the measurement ----
+
+static void setupReceiveTwin()
+{
+    memset(&twinParser, 0, sizeof(twinParser));
+    twinParser.onValue = onTwinValue;
+}
+
+static void setupRules()
+{
+    rulesLoad(benchRules);
+}
+
+/**
+ * An 8 KiB image with a few bytes changed, a block inserted and data
+ * appended
+ */
+static void setupDeltaPatch()
+{
+    srand(1);
+    oldImage.resize(8192);
+    for (size_t i = 0; i < oldImage.size(); i++)
+    {
+        oldImage[i] = (uint8_t)rand();
+    }
+    newImage.assign(oldImage.begin(), oldImage.begin() + 4096);
+    newImage[10] ^= 0x5A;
+    newImage[500] += 3;
+    for (int i = 0; i < 256; i++)
+    {
+        newImage.push_back((uint8_t)rand());
+    }
+    newImage.insert(newImage.end(), oldImage.begin() + 4096, oldImage.end());
+    newImage[6000] ^= 0x01;
+    for (int i = 0; i < 512; i++)
+    {
+        newImage.push_back((uint8_t)i);
+    }
+
+    PatchBuilder builder(oldImage, newImage);
+    builder.record(4096, 256, 0);
+    builder.record(4096, 512, 0);
+    patchBytes = builder.patch;
+}
+
+struct BenchWorkload
+{
+    const char* name;
+    void (*setup)();
+    int (*run)();
+};
+
+static const BenchWorkload workloads[] =
+{
+    { "telemetry_json", NULL, benchTelemetryJson },
+    { "message_properties", NULL, benchMessageProperties },
+    { "receive_twin", setupReceiveTwin, benchReceiveTwin },
+    { "json_lookup", NULL, benchJsonLookup },
+    { "rules_evaluate", setupRules, benchRulesEvaluate },
+    { "outbound_schedule", NULL, benchOutbound },
+    { "delta_patch", setupDeltaPatch, benchDeltaPatch },
+};
+
+/**
+ * The measured region: Callgrind is told to collect only in here
+ */
+extern "C" __attribute__((noinline)) int benchMeasure(const BenchWorkload* workload)
+{
+    int bytes = 0;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        bytes = workload->run();
+    }
+    return bytes;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s --list | <workload>\n", argv[0]);
+        return 2;
+    }
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+        if (strcmp(argv[1], "--list") == 0)
+        {
+            printf("%s\n", workloads[w].name);
+            continue;
+        }
+        if (strcmp(argv[1], workloads[w].name) != 0) continue;
+        if (workloads[w].setup != NULL) workloads[w].setup();
+        int bytes = benchMeasure(&workloads[w]);
+        printf("BENCH %s %d %d\n", workloads[w].name, BENCH_ITERATIONS, bytes);
+        return bytes > 0 ? 0 : 1;
+    }
+    if (strcmp(argv[1], "--list") == 0) return 0;
+    fprintf(stderr, "unknown workload %s\n", argv[1]);
+    return 2;
+}
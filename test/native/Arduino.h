@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for the Arduino core, for the native tests
+ */
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Defined by the test that needs a clock
+unsigned long millis();
+unsigned long micros();
+
+#endif // ARDUINO_H
@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for the framework's IoT Hub client; the benchmark defines
+ * the calls it makes
+ */
+
+#ifndef AZURE_IOT_HUB_H
+#define AZURE_IOT_HUB_H
+
+bool azureIoTSendTelemetry(const char* payload, const char* properties);
+bool azureIoTUpdateReportedProperties(const char* json);
+
+#endif // AZURE_IOT_HUB_H
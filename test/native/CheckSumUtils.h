@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for the framework's CRC16 (CRC-16/CCITT); the OTA test
+ * defines it
+ */
+
+#ifndef CHECK_SUM_UTILS_H
+#define CHECK_SUM_UTILS_H
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint16_t crc;
+} CRC16_Context;
+
+void CRC16_Init(CRC16_Context* context);
+void CRC16_Update(CRC16_Context* context, const void* data, uint32_t length);
+void CRC16_Final(CRC16_Context* context, uint16_t* result);
+
+#endif // CHECK_SUM_UTILS_H
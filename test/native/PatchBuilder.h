@@ -0,0 +1,97 @@
+/*
+ * Builds "MXD1" delta patches for the native tests, record by record,
+ * the way tools/make_delta.py lays them out
+ */
+
+#ifndef PATCH_BUILDER_H
+#define PATCH_BUILDER_H
+
+#include <stdint.h>
+#include <vector>
+
+typedef std::vector<uint8_t> Bytes;
+
+struct PatchBuilder
+{
+    const Bytes& oldImage;
+    const Bytes& newImage;
+    Bytes patch;
+    uint32_t oldPos;
+    uint32_t newPos;
+
+    PatchBuilder(const Bytes& oldImage, const Bytes& newImage)
+        : oldImage(oldImage), newImage(newImage), oldPos(0), newPos(0)
+    {
+        patch.insert(patch.end(), { 'M', 'X', 'D', '1' });
+        le32((uint32_t)oldImage.size());
+        le32((uint32_t)newImage.size());
+    }
+
+    void le32(uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            patch.push_back((uint8_t)(value >> (8 * i)));
+        }
+    }
+
+    void varint(uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            patch.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        patch.push_back((uint8_t)value);
+    }
+
+    /**
+     * The next diffLength new bytes against the old image at the current
+     * position, then extraLength new bytes as they are, then move the old
+     * position by seek
+     */
+    void record(uint32_t diffLength, uint32_t extraLength, int32_t seek)
+    {
+        varint(diffLength);
+        varint(extraLength);
+        varint(((uint32_t)seek << 1) ^ (uint32_t)(seek >> 31));
+
+        // (zero run, literal count, literals)... with the run first
+        uint32_t i = 0;
+        while (i < diffLength)
+        {
+            uint32_t zeros = 0;
+            while (i + zeros < diffLength && delta(i + zeros) == 0)
+            {
+                zeros++;
+            }
+            varint(zeros);
+            i += zeros;
+            if (i == diffLength) break;
+            uint32_t literals = 0;
+            while (i + literals < diffLength && delta(i + literals) != 0)
+            {
+                literals++;
+            }
+            varint(literals);
+            for (uint32_t j = 0; j < literals; j++)
+            {
+                patch.push_back(delta(i + j));
+            }
+            i += literals;
+        }
+        oldPos += diffLength;
+        newPos += diffLength;
+
+        patch.insert(patch.end(), newImage.begin() + newPos, newImage.begin() + newPos + extraLength);
+        newPos += extraLength;
+        oldPos += seek;
+    }
+
+    uint8_t delta(uint32_t i) const
+    {
+        return (uint8_t)(newImage[newPos + i] - oldImage[oldPos + i]);
+    }
+};
+
+#endif // PATCH_BUILDER_H
@@ -0,0 +1,37 @@
+/*
+ * Host stand-in for the framework's HTTP client; the OTA test serves the
+ * body from memory
+ */
+
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <stddef.h>
+
+enum http_method
+{
+    HTTP_GET,
+};
+
+struct Http_Response
+{
+    int status_code;
+};
+
+typedef void (*HttpBodyCallback)(const char* data, size_t length);
+
+class HTTPClient
+{
+public:
+    HTTPClient(const char* caCert, http_method method, const char* url, HttpBodyCallback onBody);
+    bool set_header(const char* key, const char* value);
+    const Http_Response* send(const void* body = NULL, int bodySize = 0);
+
+private:
+    HttpBodyCallback onBody;
+    char url[128];
+    char range[32];
+    Http_Response response;
+};
+
+#endif // HTTP_CLIENT_H
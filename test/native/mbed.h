@@ -0,0 +1,104 @@
+/*
+ * Host stand-in for the mbed RTOS primitives the firmware uses: threads,
+ * semaphores and critical sections on top of the C++ standard library, so the tests run the
+ * real threading (under ThreadSanitizer in the native_tsan environment)
+ */
+
+#ifndef MBED_H
+#define MBED_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define osWaitForever 0xFFFFFFFFu
+
+enum osPriority
+{
+    osPriorityLow,
+    osPriorityBelowNormal,
+    osPriorityNormal,
+    osPriorityAboveNormal,
+};
+
+class Thread
+{
+public:
+    Thread(osPriority priority = osPriorityNormal, uint32_t stackSize = 0)
+    {
+        (void)priority;
+        (void)stackSize;
+    }
+
+    // The firmware's threads never return: detached, they end with the test
+    int start(void (*task)())
+    {
+        std::thread(task).detach();
+        return 0;
+    }
+};
+
+// Its state outlives the object: the firmware's threads still wait on
+// their semaphores when the test program exits
+class Semaphore
+{
+public:
+    Semaphore(int32_t count = 0) : state(new State()) { state->tokens = count; }
+
+    // Tokens available before this one was taken, 0 on timeout
+    int32_t wait(uint32_t millisec = osWaitForever)
+    {
+        State* s = state;
+        std::unique_lock<std::mutex> lock(s->mutex);
+        if (millisec == osWaitForever)
+        {
+            s->changed.wait(lock, [s] { return s->tokens > 0; });
+        }
+        else if (!s->changed.wait_for(lock, std::chrono::milliseconds(millisec), [s] { return s->tokens > 0; }))
+        {
+            return 0;
+        }
+        return s->tokens--;
+    }
+
+    int release()
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->tokens++;
+        state->changed.notify_one();
+        return 0;
+    }
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        int32_t tokens;
+    };
+    State* state;
+};
+
+// One lock for the whole program, like interrupts off on the device
+inline std::recursive_mutex& criticalSection()
+{
+    static std::recursive_mutex mutex;
+    return mutex;
+}
+
+inline void core_util_critical_section_enter()
+{
+    criticalSection().lock();
+}
+
+inline void core_util_critical_section_exit()
+{
+    criticalSection().unlock();
+}
+
+// Defined by the test that needs it
+void NVIC_SystemReset();
+
+#endif // MBED_H
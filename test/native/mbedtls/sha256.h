@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for mbed TLS's SHA-256; the OTA test defines it
+ */
+
+#ifndef MBEDTLS_SHA256_H
+#define MBEDTLS_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t total[2];
+    uint32_t state[8];
+    unsigned char buffer[64];
+    int is224;
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx);
+void mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224);
+void mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t length);
+void mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32]);
+
+#endif // MBEDTLS_SHA256_H
@@ -0,0 +1,35 @@
+/*
+ * Host stand-in for the MiCO flash and OTA calls; the OTA test keeps the
+ * partitions in RAM
+ */
+
+#ifndef MICO_H
+#define MICO_H
+
+#include <stdint.h>
+
+typedef int OSStatus;
+#define kNoErr 0
+#define kGeneralErr -1
+
+typedef enum
+{
+    MICO_PARTITION_APPLICATION,
+    MICO_PARTITION_OTA_TEMP,
+} mico_partition_t;
+
+typedef struct
+{
+    const char* partition_description;
+    uint32_t partition_start_addr;
+    uint32_t partition_length;
+    uint32_t partition_options;
+} mico_logic_partition_t;
+
+mico_logic_partition_t* MicoFlashGetInfo(mico_partition_t partition);
+OSStatus MicoFlashErase(mico_partition_t partition, uint32_t offset, uint32_t size);
+OSStatus MicoFlashWrite(mico_partition_t partition, volatile uint32_t* offset, const uint8_t* data, uint32_t size);
+OSStatus MicoFlashRead(mico_partition_t partition, volatile uint32_t* offset, uint8_t* data, uint32_t size);
+OSStatus mico_ota_switch_to_new_fw(int size, uint16_t crc);
+
+#endif // MICO_H
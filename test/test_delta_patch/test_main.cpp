@@ -0,0 +1,170 @@
+/*
+ * DeltaPatch: rebuilds the new image from the old one however the patch
+ * arrives, resumes from any copy of its state, and rejects bad patches
+ */
+
+#include <stdlib.h>
+#include <unity.h>
+
+#include "DeltaPatch.h"
+#include "PatchBuilder.h"
+
+static Bytes oldImage;
+static Bytes newImage;
+static Bytes output;
+static DeltaPatch patch;
+static DeltaPatch snapshot;
+static size_t snapshotAt = 0;   // take one at this output length (0: none)
+
+static bool readOld(uint32_t offset, uint8_t* data, size_t length)
+{
+    if (offset + length > oldImage.size()) return false;
+    memcpy(data, &oldImage[offset], length);
+    return true;
+}
+
+static bool writeNew(const uint8_t* data, size_t length)
+{
+    output.insert(output.end(), data, data + length);
+    if (snapshotAt != 0 && output.size() >= snapshotAt)
+    {
+        // As the OTA writer does: the state already accounts for this write
+        memcpy(&snapshot, &patch, sizeof(snapshot));
+        snapshotAt = 0;
+    }
+    return true;
+}
+
+static Bytes randomBytes(size_t length, unsigned seed)
+{
+    srand(seed);
+    Bytes bytes(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        bytes[i] = (uint8_t)rand();
+    }
+    return bytes;
+}
+
+/**
+ * A new image with a few bytes changed, a block inserted, a block dropped
+ * and data appended
+ */
+static Bytes makePatch()
+{
+    oldImage = randomBytes(6000, 1);
+    newImage = oldImage;
+    newImage[10] ^= 0x5A;
+    newImage[11] ^= 0x01;
+    newImage[500] += 3;
+    Bytes inserted = randomBytes(300, 2);
+    newImage.insert(newImage.begin() + 2000, inserted.begin(), inserted.end());
+    newImage.erase(newImage.begin() + 4300, newImage.begin() + 4400);
+    Bytes appended = randomBytes(700, 3);
+    newImage.insert(newImage.end(), appended.begin(), appended.end());
+
+    PatchBuilder builder(oldImage, newImage);
+    builder.record(2000, 300, 0);       // inserted block as extra
+    builder.record(2000, 0, 100);       // skip the dropped block
+    builder.record(1900, 700, 0);       // appended data as extra
+    TEST_ASSERT_EQUAL(newImage.size(), builder.newPos);
+    return builder.patch;
+}
+
+void setUp()
+{
+    deltaPatchInit(&patch);
+    output.clear();
+    snapshotAt = 0;
+}
+
+void tearDown()
+{
+}
+
+void test_whole_patch()
+{
+    Bytes data = makePatch();
+    TEST_ASSERT_TRUE(deltaPatchFeed(&patch, &data[0], data.size(), readOld, writeNew));
+    TEST_ASSERT_TRUE(deltaPatchDone(&patch));
+    TEST_ASSERT_EQUAL(newImage.size(), output.size());
+    TEST_ASSERT_EQUAL_MEMORY(&newImage[0], &output[0], newImage.size());
+    TEST_ASSERT_EQUAL(oldImage.size(), deltaPatchSourceSize(&patch));
+    TEST_ASSERT_EQUAL(newImage.size(), deltaPatchTargetSize(&patch));
+}
+
+void test_one_byte_at_a_time()
+{
+    Bytes data = makePatch();
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        TEST_ASSERT_TRUE(deltaPatchFeed(&patch, &data[i], 1, readOld, writeNew));
+    }
+    TEST_ASSERT_TRUE(deltaPatchDone(&patch));
+    TEST_ASSERT_EQUAL_MEMORY(&newImage[0], &output[0], newImage.size());
+}
+
+void test_sizes_unknown_before_the_header()
+{
+    Bytes data = makePatch();
+    TEST_ASSERT_TRUE(deltaPatchFeed(&patch, &data[0], DELTA_PATCH_HEADER_SIZE - 1, readOld, writeNew));
+    TEST_ASSERT_EQUAL(0, deltaPatchSourceSize(&patch));
+    TEST_ASSERT_EQUAL(0, deltaPatchTargetSize(&patch));
+}
+
+void test_resume_from_any_snapshot()
+{
+    Bytes data = makePatch();
+    for (size_t at = 1; at < newImage.size(); at += 97)
+    {
+        setUp();
+        snapshotAt = at;
+        TEST_ASSERT_TRUE(deltaPatchFeed(&patch, &data[0], data.size(), readOld, writeNew));
+
+        // As after a reset: output up to the snapshot is in flash
+        memcpy(&patch, &snapshot, sizeof(patch));
+        output.resize(patch.written);
+        TEST_ASSERT_TRUE(deltaPatchFeed(&patch, NULL, 0, readOld, writeNew));
+        TEST_ASSERT_TRUE(deltaPatchFeed(&patch, &data[patch.consumed], data.size() - patch.consumed, readOld, writeNew));
+        TEST_ASSERT_TRUE(deltaPatchDone(&patch));
+        TEST_ASSERT_EQUAL(newImage.size(), output.size());
+        TEST_ASSERT_EQUAL_MEMORY(&newImage[0], &output[0], newImage.size());
+    }
+}
+
+void test_bad_magic()
+{
+    Bytes data = makePatch();
+    data[0] = 'X';
+    TEST_ASSERT_FALSE(deltaPatchFeed(&patch, &data[0], data.size(), readOld, writeNew));
+    TEST_ASSERT_EQUAL(0, output.size());
+}
+
+void test_seek_outside_the_source()
+{
+    oldImage = randomBytes(100, 4);
+    newImage = oldImage;
+    PatchBuilder builder(oldImage, newImage);
+    builder.record(50, 0, 1000);
+    TEST_ASSERT_FALSE(deltaPatchFeed(&patch, &builder.patch[0], builder.patch.size(), readOld, writeNew));
+}
+
+void test_trailing_data()
+{
+    Bytes data = makePatch();
+    data.push_back(0);
+    TEST_ASSERT_FALSE(deltaPatchFeed(&patch, &data[0], data.size(), readOld, writeNew));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_whole_patch);
+    RUN_TEST(test_one_byte_at_a_time);
+    RUN_TEST(test_sizes_unknown_before_the_header);
+    RUN_TEST(test_resume_from_any_snapshot);
+    RUN_TEST(test_bad_magic);
+    RUN_TEST(test_seek_outside_the_source);
+    RUN_TEST(test_trailing_data);
+    return UNITY_END();
+}
@@ -0,0 +1,165 @@
+/*
+ * JsonStream: events by path, captures, and the same result however the
+ * document is split across feeds
+ */
+
+#include <string>
+#include <unity.h>
+
+#include "JsonStream.h"
+
+static JsonStream stream;
+static std::string events;
+static const char* capturePath = NULL;
+
+static bool onBegin(JsonStream*, const char* path, bool isArray)
+{
+    events += std::string("B ") + path + (isArray ? " []\n" : " {}\n");
+    return capturePath != NULL && strcmp(path, capturePath) == 0;
+}
+
+static void onEnd(JsonStream*, const char* path)
+{
+    events += std::string("E ") + path + "\n";
+}
+
+static void onValue(JsonStream*, const char* path, const char* value, bool isString)
+{
+    events += std::string("V ") + path + " " + (isString ? "\"" + std::string(value) + "\"" : value) + "\n";
+}
+
+static void onCaptured(JsonStream*, const char* path, const char* json)
+{
+    events += std::string("C ") + path + " " + (json != NULL ? json : "(too large)") + "\n";
+}
+
+void setUp()
+{
+    memset(&stream, 0, sizeof(stream));
+    stream.onBegin = onBegin;
+    stream.onEnd = onEnd;
+    stream.onValue = onValue;
+    stream.onCaptured = onCaptured;
+    jsonStreamReset(&stream);
+    events.clear();
+    capturePath = NULL;
+}
+
+void tearDown()
+{
+}
+
+static const char twin[] =
+    "{\"desired\":{\"alertsOnly\":true,\"interval\":-12.5e1,"
+    "\"rules\":[{\"id\":\"hot\",\"value\":30},{\"id\":\"cold\",\"value\":null}],"
+    "\"name\":\"a\\\"b\\u0041\\u00e9\"},\"reported\":{\"x\":false}}";
+
+static std::string parse(const char* json, size_t split)
+{
+    setUp();
+    capturePath = "desired.rules[]";
+    // A length of 0 means a C string: feed the first part only if there is one
+    size_t length = strlen(json);
+    TEST_ASSERT_TRUE(split == 0 || jsonStreamFeedString(&stream, json, split));
+    TEST_ASSERT_TRUE(jsonStreamFeedString(&stream, json + split, length - split));
+    TEST_ASSERT_TRUE(jsonStreamDone(&stream));
+    return events;
+}
+
+void test_paths_and_values()
+{
+    std::string expected =
+        "B  {}\n"
+        "B desired {}\n"
+        "V desired.alertsOnly true\n"
+        "V desired.interval -12.5e1\n"
+        "B desired.rules []\n"
+        "B desired.rules[] {}\n"
+        "V desired.rules[].id \"hot\"\n"
+        "V desired.rules[].value 30\n"
+        "C desired.rules[] {\"id\":\"hot\",\"value\":30}\n"
+        "E desired.rules[]\n"
+        "B desired.rules[] {}\n"
+        "V desired.rules[].id \"cold\"\n"
+        "V desired.rules[].value null\n"
+        "C desired.rules[] {\"id\":\"cold\",\"value\":null}\n"
+        "E desired.rules[]\n"
+        "E desired.rules\n"
+        "V desired.name \"a\"bA?\"\n"
+        "E desired\n"
+        "B reported {}\n"
+        "V reported.x false\n"
+        "E reported\n"
+        "E \n";
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), parse(twin, 0).c_str());
+}
+
+void test_any_split_gives_the_same_events()
+{
+    std::string whole = parse(twin, 0);
+    for (size_t split = 1; split < sizeof(twin) - 1; split++)
+    {
+        TEST_ASSERT_EQUAL_STRING(whole.c_str(), parse(twin, split).c_str());
+    }
+}
+
+void test_one_character_at_a_time()
+{
+    std::string whole = parse(twin, 0);
+    setUp();
+    capturePath = "desired.rules[]";
+    for (const char* c = twin; *c; c++)
+    {
+        TEST_ASSERT_TRUE(jsonStreamFeed(&stream, *c));
+    }
+    TEST_ASSERT_TRUE(jsonStreamDone(&stream));
+    TEST_ASSERT_EQUAL_STRING(whole.c_str(), events.c_str());
+}
+
+void test_capture_too_large_is_null()
+{
+    std::string json = "{\"rules\":[{\"id\":\"" + std::string(JSON_STREAM_CAPTURE_MAX, 'x') + "\"}],\"after\":1}";
+    capturePath = "rules[]";
+    TEST_ASSERT_TRUE(jsonStreamFeedString(&stream, json.c_str()));
+    TEST_ASSERT_TRUE(events.find("C rules[] (too large)\n") != std::string::npos);
+    TEST_ASSERT_TRUE(events.find("V after 1\n") != std::string::npos);
+}
+
+void test_truncated_document_is_not_done()
+{
+    // A twin cut short, e.g. by the MQTT packet size
+    TEST_ASSERT_TRUE(jsonStreamFeedString(&stream, twin, sizeof(twin) / 2));
+    TEST_ASSERT_FALSE(jsonStreamDone(&stream));
+}
+
+void test_malformed_document_fails()
+{
+    TEST_ASSERT_FALSE(jsonStreamFeedString(&stream, "{\"a\":1,}"));
+    TEST_ASSERT_FALSE(jsonStreamDone(&stream));
+
+    setUp();
+    TEST_ASSERT_FALSE(jsonStreamFeedString(&stream, "{\"a\" 1}"));
+}
+
+void test_reset_starts_a_new_document()
+{
+    TEST_ASSERT_FALSE(jsonStreamFeedString(&stream, "{\"a\":]"));
+    jsonStreamReset(&stream);
+    events.clear();
+    TEST_ASSERT_TRUE(jsonStreamFeedString(&stream, "{\"b\":2}"));
+    TEST_ASSERT_TRUE(jsonStreamDone(&stream));
+    TEST_ASSERT_EQUAL_STRING("B  {}\nV b 2\nE \n", events.c_str());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_paths_and_values);
+    RUN_TEST(test_any_split_gives_the_same_events);
+    RUN_TEST(test_one_character_at_a_time);
+    RUN_TEST(test_capture_too_large_is_null);
+    RUN_TEST(test_truncated_document_is_not_done);
+    RUN_TEST(test_malformed_document_fails);
+    RUN_TEST(test_reset_starts_a_new_document);
+    return UNITY_END();
+}
@@ -0,0 +1,599 @@
+/*
+ * OTA download and double-buffered writer: the image in flash is right
+ * after dropped connections, resets and re-programmed pages, and a patch
+ * for another image is refused before anything is written. Runs the real
+ * download and writer threads against flash and an HTTP server in RAM;
+ * the native_tsan environment runs it under ThreadSanitizer.
+ */
+
+#include <atomic>
+#include <map>
+#include <stdarg.h>
+#include <string>
+#include <unity.h>
+
+#include "PatchBuilder.h"
+
+// The module under test, with its static state reachable from the tests
+#include "../../src/OtaUpdate.cpp"
+
+#define TEMP_PARTITION_SIZE (256 * 1024)
+
+// ===== HOST DOUBLES =====
+
+static Bytes application;                   // running image
+static Bytes otaTemp(TEMP_PARTITION_SIZE, 0xFF);
+static std::map<std::string, Bytes> files; // served, by URL
+static std::atomic<int> requests(0);
+static std::atomic<size_t> dropAfter(0);    // bytes sent before a connection drops (0: never)
+static std::atomic<int> pieceDelayUs(0);    // a slow server
+static int httpStatus = 206;
+static unsigned long now = 0;
+static bool resetRequested = false;
+static uint32_t installedSize = 0;
+static uint16_t installedCrc = 0;
+static char lastReport[256];
+
+unsigned long millis()
+{
+    return now;
+}
+
+void NVIC_SystemReset()
+{
+    resetRequested = true;
+}
+
+void logWrite(int, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+void logFlush()
+{
+}
+
+void watchdogKick()
+{
+}
+
+bool outboundEnqueue(OutboundLane, OutboundKind, const char* payload, const char*)
+{
+    strncpy(lastReport, payload, sizeof(lastReport) - 1);
+    return true;
+}
+
+static mico_logic_partition_t applicationInfo = { "Application", 0, 0, 0 };
+static mico_logic_partition_t otaTempInfo = { "OTA Storage", 0, TEMP_PARTITION_SIZE, 0 };
+
+mico_logic_partition_t* MicoFlashGetInfo(mico_partition_t partition)
+{
+    applicationInfo.partition_length = application.size();
+    return partition == MICO_PARTITION_APPLICATION ? &applicationInfo : &otaTempInfo;
+}
+
+OSStatus MicoFlashErase(mico_partition_t, uint32_t offset, uint32_t size)
+{
+    memset(&otaTemp[offset], 0xFF, size);
+    return kNoErr;
+}
+
+// NOR flash: programming only clears bits
+OSStatus MicoFlashWrite(mico_partition_t, volatile uint32_t* offset, const uint8_t* data, uint32_t size)
+{
+    if (*offset + size > otaTemp.size()) return kGeneralErr;
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    for (uint32_t i = 0; i < size; i++)
+    {
+        otaTemp[*offset + i] &= data[i];
+    }
+    *offset += size;
+    return kNoErr;
+}
+
+OSStatus MicoFlashRead(mico_partition_t partition, volatile uint32_t* offset, uint8_t* data, uint32_t size)
+{
+    const Bytes& flash = partition == MICO_PARTITION_APPLICATION ? application : otaTemp;
+    if (*offset + size > flash.size()) return kGeneralErr;
+    memcpy(data, &flash[*offset], size);
+    *offset += size;
+    return kNoErr;
+}
+
+OSStatus mico_ota_switch_to_new_fw(int size, uint16_t crc)
+{
+    installedSize = size;
+    installedCrc = crc;
+    return kNoErr;
+}
+
+HTTPClient::HTTPClient(const char*, http_method, const char* url, HttpBodyCallback onBody) : onBody(onBody)
+{
+    strncpy(this->url, url, sizeof(this->url) - 1);
+    this->url[sizeof(this->url) - 1] = '\0';
+    range[0] = '\0';
+}
+
+bool HTTPClient::set_header(const char*, const char* value)
+{
+    strncpy(range, value, sizeof(range) - 1);
+    range[sizeof(range) - 1] = '\0';
+    return true;
+}
+
+const Http_Response* HTTPClient::send(const void*, int)
+{
+    requests++;
+    std::map<std::string, Bytes>::const_iterator file = files.find(url);
+    if (file == files.end())
+    {
+        response.status_code = 404;
+        return &response;
+    }
+    const Bytes& served = file->second;
+    unsigned long from = 0;
+    if (sscanf(range, "bytes=%lu-", &from) != 1 || from > served.size())
+    {
+        response.status_code = 416;
+        return &response;
+    }
+    response.status_code = httpStatus;
+    if (httpStatus != 206) return &response;
+
+    size_t length = served.size() - from;
+    size_t drop = dropAfter;
+    if (drop != 0 && drop < length) length = drop;
+    for (size_t sent = 0; sent < length; sent += 700)
+    {
+        size_t n = length - sent < 700 ? length - sent : 700;
+        std::this_thread::sleep_for(std::chrono::microseconds(pieceDelayUs));
+        onBody((const char*)&served[from + sent], n);
+    }
+    return drop != 0 && length < served.size() - from ? NULL : &response;
+}
+
+void CRC16_Init(CRC16_Context* context)
+{
+    context->crc = 0;
+}
+
+void CRC16_Update(CRC16_Context* context, const void* data, uint32_t length)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        context->crc ^= (uint16_t)p[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            context->crc = context->crc & 0x8000 ? (context->crc << 1) ^ 0x1021 : context->crc << 1;
+        }
+    }
+}
+
+void CRC16_Final(CRC16_Context* context, uint16_t* result)
+{
+    *result = context->crc;
+}
+
+// ===== SHA-256 (FIPS 180-4) =====
+
+static const uint32_t shaK[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t ror(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void shaBlock(mbedtls_sha256_context* ctx, const unsigned char* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t v[8];
+    memcpy(v, ctx->state, sizeof(v));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = v[7] + (ror(v[4], 6) ^ ror(v[4], 11) ^ ror(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + shaK[i] + w[i];
+        uint32_t t2 = (ror(v[0], 2) ^ ror(v[0], 13) ^ ror(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        ctx->state[i] += v[i];
+    }
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int)
+{
+    static const uint32_t initial[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->total[0] = ctx->total[1] = 0;
+}
+
+void mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        ctx->buffer[ctx->total[0] % 64] = input[i];
+        if (++ctx->total[0] % 64 == 0) shaBlock(ctx, ctx->buffer);
+    }
+}
+
+void mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32])
+{
+    uint64_t bits = (uint64_t)ctx->total[0] * 8;
+    unsigned char pad = 0x80;
+    mbedtls_sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->total[0] % 64 != 56)
+    {
+        mbedtls_sha256_update(ctx, &pad, 1);
+    }
+    for (int i = 7; i >= 0; i--)
+    {
+        unsigned char b = (unsigned char)(bits >> (8 * i));
+        mbedtls_sha256_update(ctx, &b, 1);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            output[4 * i + j] = (unsigned char)(ctx->state[i] >> (24 - 8 * j));
+        }
+    }
+}
+
+// ===== HELPERS =====
+
+static std::string sha256Hex(const Bytes& data)
+{
+    mbedtls_sha256_context sha;
+    uint8_t digest[32];
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, &data[0], data.size());
+    mbedtls_sha256_finish(&sha, digest);
+    char hex[65];
+    for (int i = 0; i < 32; i++)
+    {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+    return hex;
+}
+
+static Bytes randomBytes(size_t length, unsigned seed)
+{
+    srand(seed);
+    Bytes bytes(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        bytes[i] = (uint8_t)rand();
+    }
+    return bytes;
+}
+
+static std::string fullRequest(const Bytes& image, const char* url = "http://host/full.bin")
+{
+    char json[300];
+    snprintf(json, sizeof(json), "{\"version\":\"2.0.0\",\"url\":\"%s\",\"size\":%u,\"sha256\":\"%s\"}",
+        url, (unsigned)image.size(), sha256Hex(image).c_str());
+    return json;
+}
+
+static std::string deltaRequest(const Bytes& image, const Bytes& source)
+{
+    char json[400];
+    snprintf(json, sizeof(json), "{\"version\":\"2.0.0\",\"url\":\"http://host/delta.mxd\",\"size\":%u,"
+        "\"sha256\":\"%s\",\"from\":\"%s\",\"fromSha256\":\"%s\"}",
+        (unsigned)image.size(), sha256Hex(image).c_str(), FIRMWARE_VERSION, sha256Hex(source).c_str());
+    return json;
+}
+
+/**
+ * Run otaLoop() until the device would reboot, the update fails or a
+ * transfer ends (if stopAfterTransfer), with the clock running fast
+ */
+static void runOta(bool stopAfterTransfer = false)
+{
+    bool started = false;
+    for (int i = 0; i < 100000 && !resetRequested; i++)
+    {
+        otaLoop();
+        if (job.status == OTA_FAILED) return;
+        if (transferRunning) started = true;
+        else if (started && stopAfterTransfer) return;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        now += 100;
+    }
+}
+
+static bool transferIdle()
+{
+    return !transferRunning;
+}
+
+static void expectInstalled(const Bytes& image)
+{
+    TEST_ASSERT_TRUE(resetRequested);
+    TEST_ASSERT_EQUAL(OTA_REBOOTING, job.status);
+    TEST_ASSERT_EQUAL(image.size(), installedSize);
+    TEST_ASSERT_EQUAL_MEMORY(&image[0], &otaTemp[0], image.size());
+
+    CRC16_Context crc;
+    uint16_t expected;
+    CRC16_Init(&crc);
+    CRC16_Update(&crc, &image[0], image.size());
+    CRC16_Final(&crc, &expected);
+    TEST_ASSERT_EQUAL(expected, installedCrc);
+}
+
+/**
+ * As after a soft reset: only the retained resume point is left
+ */
+static void softReset()
+{
+    TEST_ASSERT_TRUE(transferIdle());
+    drainPages(false);
+    memset(&job, 0, sizeof(job));
+    produced = 0;
+    otaInit();
+}
+
+void setUp()
+{
+    // Nothing in flight: every test runs its update to an end
+    drainPages(false);
+    memset(&job, 0, sizeof(job));
+    memset(&saved, 0, sizeof(saved));
+    produced = 0;
+    writerFailed = false;
+    hasPending = false;
+    transferAbort = false;
+    retries = 0;
+    rebootAt = 0;
+
+    application = randomBytes(40000, 10);
+    files.clear();
+    std::fill(otaTemp.begin(), otaTemp.end(), 0xFF);
+    requests = 0;
+    dropAfter = 0;
+    pieceDelayUs = 0;
+    httpStatus = 206;
+    resetRequested = false;
+    installedSize = 0;
+    lastReport[0] = '\0';
+    otaInit();
+}
+
+void tearDown()
+{
+}
+
+// ===== TESTS =====
+
+void test_full_image()
+{
+    Bytes image = randomBytes(50000, 20);
+    files["http://host/full.bin"] = image;
+    TEST_ASSERT_TRUE(otaRequest(fullRequest(image).c_str()));
+    runOta();
+    expectInstalled(image);
+    TEST_ASSERT_EQUAL(1, requests);
+}
+
+void test_full_image_over_dropped_connections()
+{
+    Bytes image = randomBytes(50000, 21);
+    files["http://host/full.bin"] = image;
+    dropAfter = 6000;
+    TEST_ASSERT_TRUE(otaRequest(fullRequest(image).c_str()));
+    runOta();
+    expectInstalled(image);
+    TEST_ASSERT_TRUE(requests > OTA_MAX_RETRIES);
+}
+
+void test_delta_patch()
+{
+    Bytes image = application;
+    image[100] ^= 0xFF;
+    Bytes added = randomBytes(3000, 22);
+    image.insert(image.begin() + 20000, added.begin(), added.end());
+    PatchBuilder builder(application, image);
+    builder.record(20000, 3000, 0);
+    builder.record(20000, 0, 0);
+    files["http://host/delta.mxd"] = builder.patch;
+    dropAfter = 1000;
+
+    TEST_ASSERT_TRUE(otaRequest(deltaRequest(image, application).c_str()));
+    runOta();
+    expectInstalled(image);
+}
+
+void test_delta_patch_for_another_image()
+{
+    Bytes other = randomBytes(application.size(), 23);
+    Bytes image = other;
+    PatchBuilder builder(other, image);
+    builder.record(other.size(), 0, 0);
+    files["http://host/delta.mxd"] = builder.patch;
+
+    TEST_ASSERT_TRUE(otaRequest(deltaRequest(image, other).c_str()));
+    runOta();
+    TEST_ASSERT_EQUAL(OTA_FAILED, job.status);
+    TEST_ASSERT_EQUAL_STRING("patch is for another image", job.error);
+    TEST_ASSERT_EQUAL(0, job.flashOffset);
+    TEST_ASSERT_EQUAL(0xFF, otaTemp[0]);
+}
+
+void test_delta_patch_without_source_hash()
+{
+    TEST_ASSERT_FALSE(otaRequest("{\"version\":\"2.0.0\",\"url\":\"http://host/d.mxd\",\"size\":10,"
+        "\"sha256\":\"0000000000000000000000000000000000000000000000000000000000000000\",\"from\":\"" FIRMWARE_VERSION "\"}"));
+    TEST_ASSERT_EQUAL(OTA_IDLE, job.status);
+}
+
+void test_resume_after_soft_reset()
+{
+    Bytes image = randomBytes(50000, 24);
+    files["http://host/full.bin"] = image;
+    dropAfter = 9000;
+    TEST_ASSERT_TRUE(otaRequest(fullRequest(image).c_str()));
+    runOta(true);
+    TEST_ASSERT_TRUE(saved.flashOffset > 0);
+
+    uint32_t resumeAt = saved.flashOffset;
+    softReset();
+    TEST_ASSERT_EQUAL(OTA_DOWNLOADING, job.status);
+    TEST_ASSERT_EQUAL(resumeAt, produced);
+    dropAfter = 0;
+    runOta();
+    expectInstalled(image);
+}
+
+void test_reset_before_the_resume_point_moved()
+{
+    // Pages programmed after this resume point was saved are programmed
+    // again after the reset, over what is already in flash
+    Bytes image = randomBytes(50000, 25);
+    files["http://host/full.bin"] = image;
+    dropAfter = 8000;
+    TEST_ASSERT_TRUE(otaRequest(fullRequest(image).c_str()));
+    runOta(true);
+    OtaJob early;
+    memcpy(&early, &saved, sizeof(early));
+    runOta(true);
+    TEST_ASSERT_TRUE(saved.flashOffset > early.flashOffset);
+
+    memcpy(&saved, &early, sizeof(saved));
+    softReset();
+    dropAfter = 0;
+    runOta();
+    expectInstalled(image);
+}
+
+void test_flash_programmed_with_other_data()
+{
+    static const uint8_t page[4] = { 0x12, 0x34, 0x56, 0x78 };
+    otaTemp[0] = 0x12;
+    otaTemp[1] = 0x00;
+    TEST_ASSERT_FALSE(programFlash(0, page, sizeof(page)));
+    otaTemp[1] = 0xFF;
+    TEST_ASSERT_TRUE(programFlash(0, page, sizeof(page)));
+    TEST_ASSERT_EQUAL_MEMORY(page, &otaTemp[0], sizeof(page));
+}
+
+void test_failed_update_starts_over_when_requested_again()
+{
+    Bytes image = randomBytes(30000, 26);
+    files["http://host/full.bin"] = image;
+    httpStatus = 404;
+    std::string request = fullRequest(image);
+    TEST_ASSERT_TRUE(otaRequest(request.c_str()));
+    runOta();
+    TEST_ASSERT_EQUAL(OTA_FAILED, job.status);
+    TEST_ASSERT_EQUAL(OTA_MAX_RETRIES, requests);
+
+    httpStatus = 206;
+    TEST_ASSERT_TRUE(otaRequest(request.c_str()));
+    TEST_ASSERT_EQUAL(OTA_DOWNLOADING, job.status);
+    TEST_ASSERT_EQUAL(2, job.attempts);
+    runOta();
+    expectInstalled(image);
+}
+
+void test_attempts_are_limited()
+{
+    Bytes image = randomBytes(30000, 27);
+    files["http://host/full.bin"] = image;
+    httpStatus = 404;
+    std::string request = fullRequest(image);
+    for (int i = 0; i < OTA_MAX_ATTEMPTS; i++)
+    {
+        TEST_ASSERT_TRUE(otaRequest(request.c_str()));
+        runOta();
+        TEST_ASSERT_EQUAL(OTA_FAILED, job.status);
+    }
+    TEST_ASSERT_TRUE(otaRequest(request.c_str()));
+    TEST_ASSERT_EQUAL(OTA_FAILED, job.status);
+
+    // Another URL is another update
+    TEST_ASSERT_TRUE(otaRequest(fullRequest(image, "http://host/full2.bin").c_str()));
+    TEST_ASSERT_EQUAL(OTA_DOWNLOADING, job.status);
+    TEST_ASSERT_EQUAL(1, job.attempts);
+    files["http://host/full2.bin"] = image;
+    httpStatus = 206;
+    runOta();
+    expectInstalled(image);
+}
+
+void test_new_update_replaces_the_running_one()
+{
+    Bytes first = randomBytes(50000, 28);
+    Bytes second = randomBytes(45000, 29);
+    files["http://host/full.bin"] = first;
+    files["http://host/second.bin"] = second;
+    pieceDelayUs = 500;
+    TEST_ASSERT_TRUE(otaRequest(fullRequest(first).c_str()));
+    while (!transferRunning)
+    {
+        otaLoop();
+    }
+
+    // Waits for the running transfer, whose rest is dropped
+    TEST_ASSERT_TRUE(otaRequest(fullRequest(second, "http://host/second.bin").c_str()));
+    TEST_ASSERT_EQUAL_STRING("http://host/full.bin", job.url);
+    pieceDelayUs = 0;
+    runOta();
+    TEST_ASSERT_EQUAL_STRING("http://host/second.bin", job.url);
+    expectInstalled(second);
+}
+
+int main()
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+    UNITY_BEGIN();
+    RUN_TEST(test_full_image);
+    RUN_TEST(test_full_image_over_dropped_connections);
+    RUN_TEST(test_delta_patch);
+    RUN_TEST(test_delta_patch_for_another_image);
+    RUN_TEST(test_delta_patch_without_source_hash);
+    RUN_TEST(test_resume_after_soft_reset);
+    RUN_TEST(test_reset_before_the_resume_point_moved);
+    RUN_TEST(test_flash_programmed_with_other_data);
+    RUN_TEST(test_failed_update_starts_over_when_requested_again);
+    RUN_TEST(test_attempts_are_limited);
+    RUN_TEST(test_new_update_replaces_the_running_one);
+    return UNITY_END();
+}
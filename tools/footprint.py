@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""
+Flash and RAM footprint of a firmware build, checked against a baseline.
+
+Reads the section headers of the linked ELF (no toolchain needed): flash is
+every loaded section with contents (.text, .rodata, the .data image, ...),
+RAM every writable one (.data, .bss, .noinit). CI runs `check` for each
+environment and fails when flash or RAM grew by more than --threshold
+percent over tools/footprint_baseline.json. An environment with no baseline
+only gets a warning in the summary. After an intended increase, or for a
+new environment, fold the reports CI uploads (or local ones) into the
+baseline with `update` and commit it.
+
+Usage:
+    python3 tools/footprint.py check .pio/build/dps_sas/firmware.elf --env dps_sas [--report footprint-dps_sas.json]
+    python3 tools/footprint.py update footprint-*.json
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+BASELINE = os.path.join(os.path.dirname(__file__), "footprint_baseline.json")
+SHF_WRITE, SHF_ALLOC = 0x1, 0x2
+SHT_NOBITS = 8
+
+
+def read_sections(path):
+    """{name: (size, flags, type)} for every allocated section of an ELF file."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF":
+        sys.exit(path + " is not an ELF file")
+    is64, endian = data[4] == 2, "<" if data[5] == 1 else ">"
+    if is64:
+        shoff, = struct.unpack_from(endian + "Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x3A)
+        header = endian + "IIQQQQ"
+    else:
+        shoff, = struct.unpack_from(endian + "I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x2E)
+        header = endian + "IIIIII"
+
+    headers = [struct.unpack_from(header, data, shoff + i * shentsize) for i in range(shnum)]
+    strtab = headers[shstrndx][4]
+    sections = {}
+    for name, kind, flags, _, _, size in headers:
+        if flags & SHF_ALLOC and size:
+            end = data.index(b"\0", strtab + name)
+            sections[data[strtab + name:end].decode()] = (size, flags, kind)
+    return sections
+
+
+def measure(path):
+    sections = read_sections(path)
+    return {
+        "flash": sum(size for size, _, kind in sections.values() if kind != SHT_NOBITS),
+        "ram": sum(size for size, flags, _ in sections.values() if flags & SHF_WRITE),
+        "sections": {name: size for name, (size, _, _) in sorted(sections.items())},
+    }
+
+
+def load_baseline(path):
+    if not os.path.exists(path):
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+def summary(lines):
+    """Also into the GitHub Actions job summary, when running there."""
+    print("\n".join(lines))
+    if os.environ.get("GITHUB_STEP_SUMMARY"):
+        with open(os.environ["GITHUB_STEP_SUMMARY"], "a") as f:
+            f.write("\n".join(lines) + "\n\n")
+
+
+def check(args):
+    current = measure(args.elf)
+    if args.report:
+        with open(args.report, "w") as f:
+            json.dump({args.env: current}, f, indent=2, sort_keys=True)
+
+    base = load_baseline(args.baseline).get(args.env)
+    lines = ["### Footprint: %s" % args.env, "", "| | baseline | current | change |", "|---|---:|---:|---:|"]
+    if base is None:
+        lines += ["| flash | - | %d | |" % current["flash"], "| ram | - | %d | |" % current["ram"], "",
+                  "Warning: no baseline for %s, nothing checked. Add it with `tools/footprint.py update`." % args.env]
+        summary(lines)
+        return 0
+
+    failed = []
+    for key in ("flash", "ram"):
+        delta = current[key] - base[key]
+        percent = 100.0 * delta / base[key] if base[key] else 0.0
+        lines.append("| %s | %d | %d | %+d (%+.2f%%) |" % (key, base[key], current[key], delta, percent))
+        if percent > args.threshold:
+            failed.append(key)
+    # Where it went, largest changes first
+    names = set(base.get("sections", {})) | set(current["sections"])
+    deltas = sorted(((current["sections"].get(n, 0) - base.get("sections", {}).get(n, 0), n) for n in names),
+                    key=lambda d: -abs(d[0]))
+    for delta, name in deltas[:5]:
+        if delta:
+            lines.append("| `%s` | %d | %d | %+d |" % (name, base.get("sections", {}).get(name, 0),
+                                                      current["sections"].get(name, 0), delta))
+    if failed:
+        lines += ["", "**%s grew by more than %.1f%%.** If intended, update tools/footprint_baseline.json."
+                  % (" and ".join(failed), args.threshold)]
+    summary(lines)
+    return 1 if failed else 0
+
+
+def update(args):
+    baseline = load_baseline(args.baseline)
+    for path in args.reports:
+        with open(path) as f:
+            for env, values in json.load(f).items():
+                baseline[env] = values
+                print("%s: flash %d, ram %d" % (env, values["flash"], values["ram"]))
+    with open(args.baseline, "w") as f:
+        json.dump(baseline, f, indent=2, sort_keys=True)
+        f.write("\n")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--baseline", default=BASELINE)
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("check", help="compare a build against the baseline")
+    p.add_argument("elf")
+    p.add_argument("--env", required=True, help="PlatformIO environment the ELF was built for")
+    p.add_argument("--threshold", type=float, default=1.0, help="allowed growth in percent (default 1.0)")
+    p.add_argument("--report", help="write the measurement here, for `update`")
+    p = sub.add_parser("update", help="fold reports into the baseline")
+    p.add_argument("reports", nargs="+")
+    args = parser.parse_args()
+    sys.exit(check(args) if args.command == "check" else update(args))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""
+Echo the device's latency probes (src/LatencyProbe.h) back to it.
+
+The device sends {"probe":{"seq":N,"t":MS}} with the application property
+probe=1 while a run is active (desired property "latencyProbe"). This
+service sends each probe body straight back, and the device reports the
+round-trip histogram under the "latency" reported property.
+
+Against IoT Hub it reads the built-in events endpoint and answers with a
+C2D message:
+    pip install azure-eventhub azure-iot-hub
+    python3 tools/latency_echo.py hub --service "HostName=...;SharedAccessKeyName=service;SharedAccessKey=..." \\
+        --events "Endpoint=sb://...;EntityPath=..."
+
+Against a local MQTT broker standing in for the hub (e.g. mosquitto with
+TLS on port 8883), it subscribes to the device topics and
+publishes the echo on the C2D topic. Nothing but the broker lies on the
+path, so the numbers track the device's own send and receive path and can
+be compared build to build:
+    pip install paho-mqtt
+    python3 tools/latency_echo.py mqtt 192.168.1.10 [--cafile ca.crt]
+"""
+
+import argparse
+import json
+import sys
+import time
+
+
+def is_probe(body):
+    try:
+        return isinstance(json.loads(body).get("probe"), dict)
+    except (ValueError, AttributeError):
+        return False
+
+
+def run_hub(args):
+    from azure.eventhub import EventHubConsumerClient
+    from azure.iot.hub import IoTHubRegistryManager
+
+    registry = IoTHubRegistryManager(args.service)
+    consumer = EventHubConsumerClient.from_connection_string(args.events, consumer_group=args.consumer_group)
+
+    def on_event(partition_context, event):
+        properties = event.properties or {}
+        if properties.get(b"probe") != b"1":
+            return
+        device = event.system_properties.get(b"iothub-connection-device-id", b"").decode()
+        body = event.body_as_str()
+        registry.send_c2d_message(device, body, properties={"probe": "1"})
+        print("%s %s" % (device, body), flush=True)
+
+    with consumer:
+        consumer.receive(on_event=on_event, starting_position="@latest")
+
+
+def run_mqtt(args):
+    import paho.mqtt.client as mqtt
+
+    client = mqtt.Client()
+    if args.cafile:
+        client.tls_set(ca_certs=args.cafile)
+    count = [0, time.time()]
+
+    def on_message(client, userdata, message):
+        # devices/<id>/messages/events/<properties>
+        parts = message.topic.split("/", 4)
+        properties = parts[4].split("&") if len(parts) == 5 else []
+        if "probe=1" not in properties or not is_probe(message.payload):
+            return
+        client.publish("devices/%s/messages/devicebound/probe=1" % parts[1], message.payload)
+        count[0] += 1
+        if time.time() - count[1] >= 10:
+            print("%d probes echoed" % count[0], flush=True)
+            count[1] = time.time()
+
+    client.on_message = on_message
+    client.on_connect = lambda client, userdata, flags, rc: client.subscribe("devices/+/messages/events/#")
+    client.connect(args.broker, args.port)
+    client.loop_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+    hub = sub.add_parser("hub", help="echo through IoT Hub")
+    hub.add_argument("--service", required=True, help="IoT Hub connection string with service permission")
+    hub.add_argument("--events", required=True, help="Event Hub-compatible endpoint connection string")
+    hub.add_argument("--consumer-group", default="$Default")
+    local = sub.add_parser("mqtt", help="echo through a local MQTT broker")
+    local.add_argument("broker")
+    local.add_argument("--port", type=int, default=8883)
+    local.add_argument("--cafile", help="CA of the broker's certificate (TLS)")
+    args = parser.parse_args()
+
+    try:
+        run_hub(args) if args.mode == "hub" else run_mqtt(args)
+    except KeyboardInterrupt:
+        sys.exit(0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+"""
+Make a delta patch between two firmware images for over-the-air updates.
+
+The patch is in the sequential "MXD1" format applied by src/DeltaPatch.cpp:
+bsdiff-style records (approximate matches against the old image as
+byte-wise differences, unmatched bytes as extra data, a seek to the next
+match), with runs of unchanged bytes in the differences stored as a single
+length. The output ends with the values for the "firmware" desired property.
+
+Usage:
+    python3 tools/make_delta.py old.bin new.bin -o update.mxd
+    python3 tools/make_delta.py old.bin new.bin -o update.mxd --url http://192.168.1.10:8000/update.mxd \
+        --from 1.0.0 --version 1.1.0
+"""
+
+import argparse
+import hashlib
+import json
+import struct
+import sys
+
+MAGIC = b"MXD1"
+KEY = 8             # bytes hashed to find match candidates
+INDEX_STEP = 4      # old image positions indexed (every 4th)
+GIVE_UP = 64        # stop extending a match after this many bytes without gain
+
+
+def build_index(old):
+    index = {}
+    for i in range(0, len(old) - KEY + 1, INDEX_STEP):
+        index.setdefault(old[i:i + KEY], i)
+    return index
+
+
+def exact_length(old, o, new, n):
+    limit = min(len(old) - o, len(new) - n)
+    length = 0
+    while length < limit and old[o + length] == new[n + length]:
+        length += 1
+    return length
+
+
+def extend_forward(old, o, new, n):
+    """Length of an approximate match, bsdiff style: maximize 2*matches - length."""
+    limit = min(len(old) - o, len(new) - n)
+    matches = best_score = best_length = 0
+    for i in range(limit):
+        if old[o + i] == new[n + i]:
+            matches += 1
+        if 2 * matches - (i + 1) > best_score:
+            best_score = 2 * matches - (i + 1)
+            best_length = i + 1
+        elif i + 1 - best_length > GIVE_UP:
+            break
+    return best_length
+
+
+def extend_backward(old, o, new, n, floor):
+    """Bytes before (o, n) worth taking into the match, down to new[floor]."""
+    limit = min(o, n - floor)
+    matches = best_score = best_length = 0
+    for i in range(1, limit + 1):
+        if old[o - i] == new[n - i]:
+            matches += 1
+        if 2 * matches - i > best_score:
+            best_score = 2 * matches - i
+            best_length = i
+        elif i - best_length > GIVE_UP:
+            break
+    return best_length
+
+
+def find_runs(old, new):
+    """Non-overlapping (new_start, old_start, length) approximate matches."""
+    index = build_index(old)
+    runs = []
+    covered = 0     # new bytes up to here are already in a run
+    pos = 0
+    while pos + KEY <= len(new):
+        o = index.get(new[pos:pos + KEY])
+        if o is None or exact_length(old, o, new, pos) < KEY:
+            pos += 1
+            continue
+        back = extend_backward(old, o, new, pos, covered)
+        start_new, start_old = pos - back, o - back
+        length = back + extend_forward(old, o, new, pos)
+        runs.append((start_new, start_old, length))
+        covered = pos = start_new + length
+    return runs
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+
+def encode_diff(diff):
+    """(zero run, literal count, literals)... as DeltaPatch expects."""
+    out = bytearray()
+    i = 0
+    while i < len(diff):
+        start = i
+        while i < len(diff) and diff[i] == 0:
+            i += 1
+        out += varint(i - start)
+        if i == len(diff):
+            break
+        start = i
+        while i < len(diff) and diff[i] != 0:
+            i += 1
+        out += varint(i - start) + diff[start:i]
+    return bytes(out)
+
+
+def make_patch(old, new):
+    runs = find_runs(old, new)
+    out = bytearray(MAGIC + struct.pack("<II", len(old), len(new)))
+
+    # Leading record: no diff, the bytes before the first run, seek to it
+    first_new, first_old = (runs[0][0], runs[0][1]) if runs else (len(new), 0)
+    out += varint(0) + varint(first_new) + varint(zigzag(first_old))
+    out += new[:first_new]
+
+    for i, (n, o, length) in enumerate(runs):
+        diff = bytes((new[n + j] - old[o + j]) & 0xFF for j in range(length))
+        next_new, next_old = (runs[i + 1][0], runs[i + 1][1]) if i + 1 < len(runs) else (len(new), o + length)
+        extra = new[n + length:next_new]
+        out += varint(length) + varint(len(extra)) + varint(zigzag(next_old - (o + length)))
+        out += encode_diff(diff) + extra
+    return bytes(out)
+
+
+def apply_patch(old, patch):
+    """Reference applier, used to check a patch before it is published."""
+    def read_varint(pos):
+        value = shift = 0
+        while True:
+            byte = patch[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value, pos
+
+    if patch[:4] != MAGIC:
+        raise ValueError("not an MXD1 patch")
+    _, target_size = struct.unpack_from("<II", patch, 4)
+    pos, old_pos, out = 12, 0, bytearray()
+    while len(out) < target_size:
+        diff_length, pos = read_varint(pos)
+        extra_length, pos = read_varint(pos)
+        seek, pos = read_varint(pos)
+        seek = (seek >> 1) ^ -(seek & 1)
+        left = diff_length
+        while left:
+            zeros, pos = read_varint(pos)
+            out += old[old_pos:old_pos + zeros]
+            old_pos += zeros
+            left -= zeros
+            if not left:
+                break
+            count, pos = read_varint(pos)
+            for b in patch[pos:pos + count]:
+                out.append((old[old_pos] + b) & 0xFF)
+                old_pos += 1
+            pos += count
+            left -= count
+        out += patch[pos:pos + extra_length]
+        pos += extra_length
+        old_pos += seek
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("old", help="image running on the device")
+    parser.add_argument("new", help="image to update to")
+    parser.add_argument("-o", "--output", required=True, help="patch file to write")
+    parser.add_argument("--url", help="where the device will download the patch")
+    parser.add_argument("--from", dest="from_version", help="version string of the old image")
+    parser.add_argument("--version", help="version string of the new image")
+    args = parser.parse_args()
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+
+    patch = make_patch(old, new)
+    if apply_patch(old, patch) != new:
+        sys.exit("internal error: patch does not reproduce the new image")
+    with open(args.output, "wb") as f:
+        f.write(patch)
+
+    print("old %d bytes, new %d bytes, patch %d bytes (%.1f%% of new)"
+          % (len(old), len(new), len(patch), 100.0 * len(patch) / max(len(new), 1)), file=sys.stderr)
+    desired = {
+        "version": args.version or "x.y.z",
+        "url": args.url or "http://HOST:8000/" + args.output.split("/")[-1],
+        "size": len(new),
+        "sha256": hashlib.sha256(new).hexdigest(),
+        # The device checks its running image against this before patching
+        "from": args.from_version or "x.y.z",
+        "fromSha256": hashlib.sha256(old).hexdigest(),
+    }
+    print(json.dumps({"firmware": desired}))
+
+
+if __name__ == "__main__":
+    main()
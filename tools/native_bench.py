@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""
+Host benchmark of the telemetry serializer, the receive parsers, the rules
+engine, the outbound scheduler and the delta patcher, checked against a
+baseline.
+
+`run` builds test/bench/bench_main.cpp and the modules it exercises with the
+host compiler, then runs each workload under Callgrind, counting only the
+instructions executed inside benchMeasure(). The counts repeat exactly for
+the same compiler, so CI fails when a workload got more than --threshold
+percent slower than tools/native_bench_baseline.json. A workload with no
+baseline only gets a warning in the summary. The counts change with the compiler, so the
+baseline is taken on the CI runner: after an intended change, or when the
+runner image moves to a new compiler, fold the report CI uploads into the
+baseline with `update` and commit it.
+
+Usage:
+    python3 tools/native_bench.py run [--report native-bench.json]
+    python3 tools/native_bench.py update native-bench.json
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.join(TOOLS, "..")
+BASELINE = os.path.join(TOOLS, "native_bench_baseline.json")
+SOURCES = ["test/bench/bench_main.cpp", "src/DeltaPatch.cpp", "src/JsonLite.cpp", "src/JsonStream.cpp",
+           "src/MessageProperties.cpp", "src/OutboundQueue.cpp", "src/Rules.cpp", "src/Telemetry.cpp"]
+# As the firmware's default build
+FLAGS = ["-std=gnu++11", "-Os", "-g", "-DFIRMWARE_VERSION=\"1.0.0\"", "-Isrc", "-Itest/native"]
+
+
+def build(cxx, directory):
+    binary = os.path.join(directory, "native_bench")
+    command = [cxx] + FLAGS + ["-o", binary] + SOURCES
+    print(" ".join(command))
+    if subprocess.call(command, cwd=ROOT) != 0:
+        sys.exit("build failed")
+    version = subprocess.check_output([cxx, "--version"], universal_newlines=True).splitlines()[0]
+    return binary, version
+
+
+def measure(binary, name, directory):
+    """{"instructions": n, "bytes": n} per iteration of one workload."""
+    out = os.path.join(directory, "callgrind.%s" % name)
+    output = subprocess.check_output(["valgrind", "--tool=callgrind", "--toggle-collect=benchMeasure",
+                                      "--callgrind-out-file=" + out, binary, name], universal_newlines=True)
+    result = re.search(r"^BENCH %s (\d+) (\d+)$" % name, output, re.M)
+    with open(out) as f:
+        totals = re.search(r"^(?:totals|summary): (\d+)", f.read(), re.M)
+    if not result or not totals:
+        sys.exit("no result for " + name)
+    return {"instructions": int(totals.group(1)) // int(result.group(1)), "bytes": int(result.group(2))}
+
+
+def load_baseline(path):
+    if not os.path.exists(path):
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+def summary(lines):
+    """Also into the GitHub Actions job summary, when running there."""
+    print("\n".join(lines))
+    if os.environ.get("GITHUB_STEP_SUMMARY"):
+        with open(os.environ["GITHUB_STEP_SUMMARY"], "a") as f:
+            f.write("\n".join(lines) + "\n\n")
+
+
+def run(args):
+    with tempfile.TemporaryDirectory() as directory:
+        binary, compiler = build(args.cxx, directory)
+        names = subprocess.check_output([binary, "--list"], universal_newlines=True).split()
+        current = {"compiler": compiler, "workloads": {name: measure(binary, name, directory) for name in names}}
+    if args.report:
+        with open(args.report, "w") as f:
+            json.dump(current, f, indent=2, sort_keys=True)
+
+    baseline = load_baseline(args.baseline)
+    base = baseline.get("workloads", {})
+    lines = ["### Host benchmark (instructions per iteration, %s)" % compiler, "",
+             "| workload | bytes | baseline | current | change |", "|---|---:|---:|---:|---:|"]
+    failed, missing = [], []
+    for name, values in sorted(current["workloads"].items()):
+        if name not in base:
+            lines.append("| %s | %d | - | %d | |" % (name, values["bytes"], values["instructions"]))
+            missing.append(name)
+            continue
+        delta = values["instructions"] - base[name]["instructions"]
+        percent = 100.0 * delta / base[name]["instructions"] if base[name]["instructions"] else 0.0
+        lines.append("| %s | %d | %d | %d | %+d (%+.2f%%) |"
+                     % (name, values["bytes"], base[name]["instructions"], values["instructions"], delta, percent))
+        if percent > args.threshold:
+            failed.append(name)
+    if baseline and baseline.get("compiler") != compiler:
+        lines += ["", "The baseline was taken with %s." % baseline.get("compiler")]
+    if missing:
+        lines += ["", "Warning: no baseline for %s, not checked. Add it with `tools/native_bench.py update`."
+                  % ", ".join(missing)]
+    if failed:
+        lines += ["", "**%s slower by more than %.1f%%.** If intended, update tools/native_bench_baseline.json."
+                  % (", ".join(failed), args.threshold)]
+    summary(lines)
+    return 1 if failed else 0
+
+
+def update(args):
+    with open(args.report) as f:
+        current = json.load(f)
+    for name, w in sorted(current["workloads"].items()):
+        print("%s: %d" % (name, w["instructions"]))
+    with open(args.baseline, "w") as f:
+        json.dump(current, f, indent=2, sort_keys=True)
+        f.write("\n")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--baseline", default=BASELINE)
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("run", help="build and measure every workload")
+    p.add_argument("--cxx", default=os.environ.get("CXX", "g++"), help="host C++ compiler (default g++)")
+    p.add_argument("--threshold", type=float, default=2.0, help="allowed slowdown in percent (default 2.0)")
+    p.add_argument("--report", help="write the results here, for `update`")
+    p = sub.add_parser("update", help="make a report the baseline")
+    p.add_argument("report")
+    args = parser.parse_args()
+    sys.exit({"run": run, "update": update}[args.command](args))
+
+
+if __name__ == "__main__":
+    main()
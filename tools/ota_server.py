@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+Serve firmware images and delta patches to the device over HTTP.
+
+Like `python3 -m http.server`, but honours the Range requests the device
+uses to download in resumable chunks. Meant as a local stand-in for the
+blob storage or web server used in production.
+
+Usage:
+    python3 tools/ota_server.py [--port 8000] [--directory .]
+"""
+
+import argparse
+import functools
+import os
+import re
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+
+class RangeHandler(SimpleHTTPRequestHandler):
+    def send_head(self):
+        self.range_left = None
+        match = re.fullmatch(r"bytes=(\d+)-(\d*)", self.headers.get("Range", ""))
+        path = self.translate_path(self.path)
+        if not match or not os.path.isfile(path):
+            return super().send_head()
+
+        size = os.path.getsize(path)
+        start = int(match.group(1))
+        end = min(int(match.group(2)) if match.group(2) else size - 1, size - 1)
+        if start >= size or start > end:
+            self.send_response(416)
+            self.send_header("Content-Range", "bytes */%d" % size)
+            self.end_headers()
+            return None
+
+        f = open(path, "rb")
+        f.seek(start)
+        self.range_left = end - start + 1
+        self.send_response(206)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, size))
+        self.send_header("Content-Length", str(self.range_left))
+        self.end_headers()
+        return f
+
+    def copyfile(self, source, outputfile):
+        left = self.range_left
+        if left is None:
+            return super().copyfile(source, outputfile)
+        while left > 0:
+            data = source.read(min(left, 64 * 1024))
+            if not data:
+                break
+            outputfile.write(data)
+            left -= len(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--directory", default=os.getcwd())
+    args = parser.parse_args()
+
+    handler = functools.partial(RangeHandler, directory=args.directory)
+    server = ThreadingHTTPServer(("", args.port), handler)
+    print("Serving %s on port %d" % (args.directory, args.port))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,15 @@
+"""
+PlatformIO extra script for the *_perf environments (platformio.ini).
+
+build_src_flags only reach the compiler, for src/. With link-time
+optimization the code is generated at link time, so the link needs -flto
+and the optimization level as well. The framework's objects are not LTO
+objects and link as usual. Also writes a link map, to check where the HOT_PATH and
+COLD_PATH code (src/Placement.h) ended up:
+
+    grep -B1 -A3 data_hot_path .pio/build/dps_sas_perf/firmware.map
+"""
+
+Import("env")
+
+env.Append(LINKFLAGS=["-O2", "-flto", "-Wl,-Map,${BUILD_DIR}/firmware.map"])
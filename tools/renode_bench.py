@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Telemetry and receive path benchmark on the emulated board, checked against
+a baseline.
+
+`run` boots an environment's firmware.bin, built with BENCH_ENABLED=1
+(see --build-dir), on an emulated AZ3166 (Renode, tools/renode/), presses
+'b' on its console and checks the "BENCH" lines the firmware prints
+(src/Bench.h): cycles per iteration of each workload, which under Renode
+are instruction counts of the real Cortex-M4 code. CI fails when a
+workload got slower than tools/bench_baseline.json by more than
+--threshold percent; a workload with no baseline only gets a warning in
+the summary. With --against, a *_perf variant
+is compared instead with its default build, emulated in the same run, so
+the job summary shows both builds measured side by side and the variant
+must not be slower. `check` does the same for a console capture, e.g. one
+taken from a device with 'b' pressed, and --against then names the
+capture of the other build (device cycles include flash wait states, so
+keep them out of the emulator's baseline). After an intended change, fold
+the reports into the baseline with `update`.
+
+Usage:
+    PLATFORMIO_BUILD_FLAGS=-DBENCH_ENABLED=1 PLATFORMIO_BUILD_DIR=.pio/bench pio run -e dps_sas
+    python3 tools/renode_bench.py run --env dps_sas --build-dir .pio/bench [--report bench-dps_sas.json]
+    python3 tools/renode_bench.py run --env dps_sas_perf --build-dir .pio/bench --against dps_sas
+    python3 tools/renode_bench.py check capture.txt --env dps_sas
+    python3 tools/renode_bench.py check perf-capture.txt --env dps_sas_perf --against default-capture.txt
+    python3 tools/renode_bench.py update bench-*.json
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+BASELINE = os.path.join(TOOLS, "bench_baseline.json")
+ROBOT = os.path.join(TOOLS, "renode", "bench.robot")
+BUILD = os.path.join(TOOLS, "..", ".pio", "build")
+
+
+def parse_capture(text):
+    """{workload: {"cycles": n, "bytes": n}} from the console output of a run."""
+    runs = text.split("BENCH BEGIN")
+    if len(runs) < 2:
+        sys.exit("no benchmark output (BENCH BEGIN) in the capture")
+    workloads = {}
+    # The last complete run, if 'b' was pressed more than once
+    for m in re.finditer(r"BENCH (\w+) (\d+) (\d+)\s*$", runs[-1], re.M):
+        workloads[m.group(1)] = {"cycles": int(m.group(2)), "bytes": int(m.group(3))}
+    counter = re.search(r"BENCH END \(([^)]*)\)", runs[-1])
+    if not workloads or not counter:
+        sys.exit("benchmark output incomplete")
+    return {"counter": counter.group(1), "workloads": workloads}
+
+
+def load_baseline(path):
+    if not os.path.exists(path):
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+def summary(lines):
+    """Also into the GitHub Actions job summary, when running there."""
+    print("\n".join(lines))
+    if os.environ.get("GITHUB_STEP_SUMMARY"):
+        with open(os.environ["GITHUB_STEP_SUMMARY"], "a") as f:
+            f.write("\n".join(lines) + "\n\n")
+
+
+def compare(current, against, args):
+    """current against the measurement of the same run, or else the baseline."""
+    if args.report:
+        with open(args.report, "w") as f:
+            json.dump({args.env: current}, f, indent=2, sort_keys=True)
+
+    if against:
+        base = against["workloads"]
+        title, column = "%s against %s" % (args.env, args.against), args.against
+    else:
+        base = load_baseline(args.baseline).get(args.env, {}).get("workloads", {})
+        title, column = args.env, "baseline"
+    lines = ["### Benchmark: %s (cycles per iteration, %s)" % (title, current["counter"]), "",
+             "| workload | bytes | %s | current | change |" % column, "|---|---:|---:|---:|---:|"]
+    failed, missing = [], []
+    for name, values in sorted(current["workloads"].items()):
+        if name not in base:
+            lines.append("| %s | %d | - | %d | |" % (name, values["bytes"], values["cycles"]))
+            missing.append(name)
+            continue
+        delta = values["cycles"] - base[name]["cycles"]
+        percent = 100.0 * delta / base[name]["cycles"] if base[name]["cycles"] else 0.0
+        lines.append("| %s | %d | %d | %d | %+d (%+.2f%%) |"
+                     % (name, values["bytes"], base[name]["cycles"], values["cycles"], delta, percent))
+        if percent > args.threshold:
+            failed.append(name)
+    if missing:
+        lines += ["", "Warning: no %s for %s, not checked.%s" % (column, ", ".join(missing),
+                  "" if against else " Add it with `tools/renode_bench.py update`.")]
+    if failed:
+        lines += ["", "**%s slower by more than %.1f%%.**%s" % (", ".join(failed), args.threshold,
+                  "" if against else " If intended, update tools/bench_baseline.json.")]
+    summary(lines)
+    return 1 if failed else 0
+
+
+def emulate(env, capture, args):
+    build = os.path.join(args.build_dir, env)
+    capture = os.path.abspath(capture)
+    if os.path.exists(capture):
+        os.remove(capture)
+    command = [args.renode_test, ROBOT,
+               "--variable", "BIN:" + os.path.abspath(os.path.join(build, "firmware.bin")),
+               "--variable", "ELF:" + os.path.abspath(os.path.join(build, "firmware.elf")),
+               "--variable", "CAPTURE:" + capture]
+    print(" ".join(command))
+    result = subprocess.call(command)
+    if result != 0:
+        # What the firmware got to before the test gave up
+        if os.path.exists(capture):
+            with open(capture, errors="replace") as f:
+                print("".join(f.readlines()[-40:]))
+        sys.exit("emulation failed (renode-test exit %d)" % result)
+    with open(capture, errors="replace") as f:
+        return parse_capture(f.read())
+
+
+def run(args):
+    against = emulate(args.against, "bench-%s.txt" % args.against, args) if args.against else None
+    return compare(emulate(args.env, args.capture or "bench-%s.txt" % args.env, args), against, args)
+
+
+def check(args):
+    against = None
+    if args.against:
+        with open(args.against, errors="replace") as f:
+            against = parse_capture(f.read())
+    with open(args.capture, errors="replace") as f:
+        return compare(parse_capture(f.read()), against, args)
+
+
+def update(args):
+    baseline = load_baseline(args.baseline)
+    for path in args.reports:
+        with open(path) as f:
+            for env, values in json.load(f).items():
+                baseline[env] = values
+                print("%s: %s" % (env, ", ".join("%s %d" % (name, w["cycles"])
+                                                 for name, w in sorted(values["workloads"].items()))))
+    with open(args.baseline, "w") as f:
+        json.dump(baseline, f, indent=2, sort_keys=True)
+        f.write("\n")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--baseline", default=BASELINE)
+    sub = parser.add_subparsers(dest="command", required=True)
+    for name, help in (("run", "benchmark a build in Renode"), ("check", "check a console capture")):
+        p = sub.add_parser(name, help=help)
+        if name == "run":
+            p.add_argument("--capture", help="console output (default: bench-<env>.txt)")
+            p.add_argument("--renode-test", default="renode-test", help="Renode's test runner")
+            p.add_argument("--build-dir", default=BUILD, help="PlatformIO build directory of the "
+                           "BENCH_ENABLED=1 build (default .pio/build)")
+        else:
+            p.add_argument("capture")
+        p.add_argument("--env", required=True, help="PlatformIO environment of the build")
+        p.add_argument("--against", help="compare with this build instead of the baseline, e.g. the "
+                       "default build of a *_perf variant: its environment for run, its capture for check")
+        p.add_argument("--threshold", type=float, default=2.0, help="allowed slowdown in percent (default 2.0)")
+        p.add_argument("--report", help="write the results here, for `update`")
+    p = sub.add_parser("update", help="fold reports into the baseline")
+    p.add_argument("reports", nargs="+")
+    args = parser.parse_args()
+    sys.exit({"run": run, "check": check, "update": update}[args.command](args))
+
+
+if __name__ == "__main__":
+    main()
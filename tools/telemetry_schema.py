@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Plug and Play model and binary payload decoder for the device's telemetry.
+
+Both are generated from TELEMETRY_COMPONENT_LIST and TELEMETRY_FIELD_LIST in
+src/Telemetry.h, the same tables the firmware builds its JSON and binary
+payloads from, so they stay in sync with the device. The model is a root
+interface (TELEMETRY_MODEL_ID, announced by the device) holding the device
+properties and one component per TELEMETRY_COMPONENT_LIST entry; upload all
+the interfaces in the output to the model repository or IoT Central.
+
+Usage:
+    python3 tools/telemetry_schema.py dtdl -o mxchip.json
+    python3 tools/telemetry_schema.py decode 024f703f00070000...      # hex or base64 bodies
+    python3 tools/telemetry_schema.py decode -f body.bin
+"""
+
+import argparse
+import base64
+import binascii
+import datetime
+import json
+import os
+import re
+import struct
+import sys
+
+TELEMETRY_H = os.path.join(os.path.dirname(__file__), "..", "src", "Telemetry.h")
+WIRE = {"I16": ("h", 2), "I32": ("i", 4)}
+AXES = "xyz"
+
+
+# Properties of the root interface, handled in main.cpp rather than tables
+ROOT_PROPERTIES = [
+    {"@type": "Property", "name": "firmwareVersion", "schema": "string"},
+    {"@type": "Property", "name": "telemetryInterval", "schema": "integer", "description": "ms"},
+    {"@type": "Property", "name": "alertsOnly", "schema": "boolean", "writable": True,
+     "description": "Send only rule transitions, not periodic telemetry"},
+]
+
+
+def load_schema(path):
+    """Components, fields, model id and binary version from Telemetry.h."""
+    with open(path) as f:
+        text = f.read()
+    block = re.search(r"#define TELEMETRY_COMPONENT_LIST\(X\)(.*?)\n\n", text, re.S)
+    if not block:
+        sys.exit("TELEMETRY_COMPONENT_LIST not found in " + path)
+    components = [{"name": m.group(1), "displayName": m.group(2), "id": m.group(3)}
+                  for m in re.finditer(r'X\((\w+),\s*"([^"]*)",\s*"([^"]*)"\)', block.group(1))]
+    block = re.search(r"#define TELEMETRY_FIELD_LIST\(X\)(.*?)\n\n", text, re.S)
+    if not block:
+        sys.exit("TELEMETRY_FIELD_LIST not found in " + path)
+    fields = []
+    for m in re.finditer(r'X\((\w+),\s*(\w+),\s*(\w+),\s*(\d+),\s*(\w+),\s*(\d+),\s*"([^"]*)",\s*"([^"]*)",\s*"([^"]*)",\s*"([^"]*)"\)',
+                         block.group(1)):
+        fields.append({
+            "name": m.group(1), "component": m.group(2), "type": m.group(3), "components": int(m.group(4)),
+            "wire": m.group(5), "scale": int(m.group(6)), "unit": m.group(7), "semanticType": m.group(8),
+            "dtdlUnit": m.group(9),
+        })
+    model_id = re.search(r'#define TELEMETRY_MODEL_ID "([^"]+)"', text).group(1)
+    version = int(re.search(r"#define TELEMETRY_BINARY_VERSION (\d+)", text).group(1))
+    return components, fields, model_id, version
+
+
+def schema_id(fields):
+    """Same hash as telemetrySchemaId() on the device."""
+    h = 2166136261
+    for f in fields:
+        entry = "%s:%s:%d:%d:%d;" % (f["name"], f["type"], f["components"], WIRE[f["wire"]][1], f["scale"])
+        for byte in entry.encode():
+            h = ((h ^ byte) * 16777619) & 0xFFFFFFFF
+    return (h >> 16) ^ (h & 0xFFFF)
+
+
+def telemetry_entry(f):
+    value_schema = "double" if f["type"] == "FLOAT" else "integer"
+    entry = {"@type": "Telemetry", "name": f["name"]}
+    if f["components"] == 1:
+        entry["schema"] = value_schema
+        if f["semanticType"]:
+            entry["@type"] = ["Telemetry", f["semanticType"]]
+            entry["unit"] = f["dtdlUnit"]
+    else:
+        entry["schema"] = {
+            "@type": "Object",
+            "fields": [{"name": a, "schema": value_schema} for a in AXES[:f["components"]]],
+        }
+    if not f["semanticType"]:
+        entry["description"] = f["unit"]
+    return entry
+
+
+def to_dtdl(components, fields, model_id):
+    interfaces = [{
+        "@context": "dtmi:dtdl:context;2",
+        "@id": model_id,
+        "@type": "Interface",
+        "displayName": "MXChip AZ3166 IoT Hub Demo",
+        "contents": ROOT_PROPERTIES + [
+            {"@type": "Component", "name": c["name"], "displayName": c["displayName"], "schema": c["id"]}
+            for c in components
+        ],
+    }]
+    for c in components:
+        interfaces.append({
+            "@context": "dtmi:dtdl:context;2",
+            "@id": c["id"],
+            "@type": "Interface",
+            "displayName": c["displayName"],
+            "contents": [telemetry_entry(f) for f in fields if f["component"] == c["name"]],
+        })
+    return interfaces
+
+
+def decode(body, fields, version):
+    header = struct.Struct("<BHHII")
+    got_version, got_schema, present, message_id, timestamp = header.unpack_from(body, 0)
+    if got_version != version:
+        raise ValueError("binary version %d, expected %d" % (got_version, version))
+    if got_schema != schema_id(fields):
+        raise ValueError("schema %04x, expected %04x: built from a different Telemetry.h" % (got_schema, schema_id(fields)))
+
+    out = {
+        "messageId": message_id,
+        "timestamp": datetime.datetime.fromtimestamp(timestamp, datetime.timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ"),
+    }
+    offset = header.size
+    for index, f in enumerate(fields):
+        if not present & (1 << index):
+            continue    # sensor disabled or not due for this sample
+        code, size = WIRE[f["wire"]]
+        values = []
+        for _ in range(f["components"]):
+            raw = struct.unpack_from("<" + code, body, offset)[0]
+            offset += size
+            values.append(raw / f["scale"] if f["scale"] > 1 else raw)
+        out[f["name"]] = values[0] if f["components"] == 1 else dict(zip(AXES, values))
+    return out
+
+
+def parse_body(text):
+    text = text.strip()
+    if re.fullmatch(r"(?:[0-9a-fA-F]{2})+", text):
+        return bytes.fromhex(text)
+    try:
+        return base64.b64decode(text, validate=True)
+    except binascii.Error:
+        sys.exit("not hex or base64: " + text[:40])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    dtdl = sub.add_parser("dtdl", help="write the DTDL v2 interfaces")
+    dtdl.add_argument("-o", "--output", help="file to write (default stdout)")
+    dec = sub.add_parser("decode", help="decode binary telemetry bodies to JSON")
+    dec.add_argument("bodies", nargs="*", help="hex or base64 message bodies")
+    dec.add_argument("-f", "--file", action="append", default=[], help="raw body file")
+    sub.add_parser("id", help="print the schema id sent in the 'schema' property")
+    args = parser.parse_args()
+
+    components, fields, model_id, version = load_schema(TELEMETRY_H)
+    if args.command == "dtdl":
+        text = json.dumps(to_dtdl(components, fields, model_id), indent=2) + "\n"
+        if args.output:
+            with open(args.output, "w") as f:
+                f.write(text)
+        else:
+            sys.stdout.write(text)
+    elif args.command == "decode":
+        bodies = [parse_body(b) for b in args.bodies]
+        for path in args.file:
+            with open(path, "rb") as f:
+                bodies.append(f.read())
+        for body in bodies:
+            print(json.dumps(decode(body, fields, version)))
+    else:
+        print("%04x" % schema_id(fields))
+
+
+if __name__ == "__main__":
+    main()
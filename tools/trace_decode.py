@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+Decode the device's binary trace log into a Chrome trace / Perfetto timeline.
+
+Input is either a serial monitor capture containing "TRACE <hex>" lines
+(press 't' in the monitor) or the diagnostics messages uploaded after a
+"dumpTrace" C2D message (any text containing their JSON, e.g. the output of
+`az iot hub monitor-events`). Open the result in chrome://tracing or
+https://ui.perfetto.dev.
+
+Usage:
+    python3 tools/trace_decode.py capture.txt -o trace.json
+"""
+
+import argparse
+import base64
+import json
+import os
+import re
+import struct
+import sys
+
+RECORD = struct.Struct("<IBBH")   # timestamp (us), event, phase, arg
+TRACE_H = os.path.join(os.path.dirname(__file__), "..", "src", "Trace.h")
+
+
+def load_event_names(path):
+    """Event names in id order, from the TRACE_EVENT_LIST X-macro."""
+    with open(path) as f:
+        text = f.read()
+    block = re.search(r"#define TRACE_EVENT_LIST\(X\)(.*?)\n\n", text, re.S)
+    if not block:
+        sys.exit("TRACE_EVENT_LIST not found in " + path)
+    return re.findall(r"X\((\w+)\)", block.group(1))
+
+
+def read_records(text):
+    """Raw record bytes from serial dump lines or uploaded diagnostics parts."""
+    serial = [m.group(1) for m in re.finditer(r"TRACE ([0-9a-f]+)\s*$", text, re.M)]
+    if serial:
+        return bytes.fromhex("".join(serial))
+
+    parts = {}
+    for m in re.finditer(r'"part"\s*:\s*(\d+)\s*,\s*"parts"\s*:\s*\d+\s*,\s*"records"\s*:\s*"([^"]*)"', text):
+        parts[int(m.group(1))] = base64.b64decode(m.group(2))
+    return b"".join(parts[k] for k in sorted(parts))
+
+
+def to_chrome_trace(data, names):
+    events = []
+    last = None
+    wraps = 0
+    for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        timestamp, event, phase, arg = RECORD.unpack_from(data, offset)
+        # micros() wraps every ~71.6 minutes
+        if last is not None and timestamp < last:
+            wraps += 1
+        last = timestamp
+        name = names[event] if event < len(names) else "EVENT_%d" % event
+        entry = {
+            "name": name,
+            "ph": chr(phase),
+            "ts": timestamp + (wraps << 32),
+            "pid": 1,
+            "tid": 1,
+            "args": {"arg": arg},
+        }
+        if entry["ph"] == "i":
+            entry["s"] = "t"
+        events.append(entry)
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("input", help="serial capture or diagnostics messages")
+    parser.add_argument("-o", "--output", default="-", help="output JSON (default: stdout)")
+    parser.add_argument("--trace-h", default=TRACE_H, help="path to src/Trace.h")
+    args = parser.parse_args()
+
+    names = load_event_names(args.trace_h)
+    with open(args.input) as f:
+        data = read_records(f.read())
+    if not data:
+        sys.exit("no trace records found in " + args.input)
+
+    trace = to_chrome_trace(data, names)
+    out = sys.stdout if args.output == "-" else open(args.output, "w")
+    json.dump(trace, out, indent=1)
+    if out is not sys.stdout:
+        out.close()
+        print("%d events -> %s" % (len(trace["traceEvents"]), args.output), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()